@@ -0,0 +1,231 @@
+#ifndef BINARY_PROTOCOL_H__
+#define BINARY_PROTOCOL_H__
+
+#include "response_writer.h"
+#include "symbol_table.h"
+#include "text_protocol.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Length-prefixed binary protocol, alternative to line-based text protocol.
+// Frame is 32-bit length of the rest of the frame, 8-bit frame type and
+// fields of the type packed without padding. Numbers are in native byte
+// order, little-endian on supported platforms. Exchanges and currencies are
+// referred to by integer identifiers, bound to names by Symbol frames.
+// Timestamps are nanoseconds since 1970-01-01T00:00:00Z, as 64-bit integers.
+// Responses are written as frames in order of requests.
+enum class BinaryFrameType : std::uint8_t {
+	// Binds identifier to name of exchange or currency: uint8 kind (BinarySymbolKind),
+	// uint32 identifier, name up to the end of frame. Binding can't be changed,
+	// repeated frame with the same identifier and name is accepted.
+	Symbol = 1,
+
+	// Rate info: int64 timestamp, uint32 exchange, uint32 source currency,
+	// uint32 destination currency, double forward factor, double backward factor
+	PriceUpdate = 2,
+
+	// Rate request: uint32 source exchange, uint32 source currency, uint32
+	// destination exchange, uint32 destination currency, uint32 maximal number of
+	// hops (0 if unlimited), uint32 number of best paths to report (0 means 1)
+	RateRequest = 3,
+
+	// Transfer fee: uint32 exchange, uint32 currency, double withdrawal factor,
+	// double deposit factor
+	TransferFee = 4,
+
+	// Response to rate request, one per reported path: uint32 source exchange,
+	// uint32 source currency, uint32 destination exchange, uint32 destination
+	// currency, double total rate (0 if there is no path), uint32 number of
+	// path vertices, then uint32 exchange, uint32 currency, double factor and
+	// int64 quote timestamp of hop leading to every vertex (1 and 0 for the first)
+	BestRates = 0x81,
+
+	// Profitable cycle: double cycle rate, uint32 number of vertices, then
+	// uint32 exchange and uint32 currency of every vertex, the first one
+	// is repeated at the end
+	Arbitrage = 0x82,
+
+	// No profitable cycle left, no fields
+	ArbitrageCleared = 0x83
+};
+
+// Kind of symbol bound by Symbol frame
+enum class BinarySymbolKind : std::uint8_t {
+	Exchange = 0,
+	Currency = 1
+};
+
+// Size of frame length prefix in bytes
+constexpr std::size_t BINARY_FRAME_PREFIX_SIZE = sizeof(std::uint32_t);
+
+// Maximal length of frame after prefix. Longer length means corrupted stream.
+constexpr std::size_t MAX_BINARY_FRAME_SIZE = 64 * 1024;
+
+// Identifiers of symbols must be below this value, identifier maps are
+// arrays indexed by them
+constexpr std::uint32_t MAX_WIRE_SYMBOL_ID = 1u << 20;
+
+// Identifier written for symbol which has no identifier bound
+constexpr std::uint32_t NO_WIRE_SYMBOL_ID = std::numeric_limits<std::uint32_t>::max();
+
+// Nanoseconds per second of binary protocol timestamps
+constexpr std::int64_t NANOSECONDS_PER_SECOND = 1000000000;
+
+// Reads fields of binary frame one after another.
+// Throws std::invalid_argument if frame is shorter than its fields.
+class BinaryFieldReader {
+public:
+	// Constructs reader of given frame, without length prefix
+	explicit BinaryFieldReader(std::string_view frame) noexcept :
+		m_data(frame)
+	{
+	}
+
+	// Reads next field
+	template <class T>
+	T read()
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only plain data can be read");
+		if (m_data.length() < sizeof(T)) {
+			throw std::invalid_argument("truncated binary frame");
+		}
+		T value;
+		std::memcpy(&value, m_data.data(), sizeof(T));
+		m_data.remove_prefix(sizeof(T));
+		return value;
+	}
+
+	// Returns the rest of frame and skips it
+	std::string_view readRest() noexcept
+	{
+		const auto rest = m_data;
+		m_data = std::string_view();
+		return rest;
+	}
+
+	// Throws if frame has data after the last field
+	void checkEnd() const
+	{
+		if (!m_data.empty()) {
+			throw std::invalid_argument("unexpected data at the end of binary frame");
+		}
+	}
+
+private:
+	// Unread part of frame
+	std::string_view m_data;
+};
+
+// Two-way mapping of identifiers of binary protocol to symbol table identifiers
+class WireSymbolMap {
+public:
+	// Binds wire identifier to symbol identifier. Throws std::invalid_argument
+	// if wire identifier is out of range or either of them is bound to other one.
+	void bind(std::uint32_t wireId, std::size_t id)
+	{
+		if (wireId >= MAX_WIRE_SYMBOL_ID) {
+			throw std::invalid_argument("symbol id " + std::to_string(wireId) + " is out of range");
+		}
+		if (find(wireId) == id && this->wireId(id) == wireId) {
+			return;
+		}
+		if (find(wireId) != SymbolTable::INVALID_ID || this->wireId(id) != NO_WIRE_SYMBOL_ID) {
+			throw std::invalid_argument("symbol id " + std::to_string(wireId)
+				+ " or its name is bound already");
+		}
+		if (wireId >= m_ids.size()) {
+			m_ids.resize(wireId + 1, SymbolTable::INVALID_ID);
+		}
+		if (id >= m_wireIds.size()) {
+			m_wireIds.resize(id + 1, NO_WIRE_SYMBOL_ID);
+		}
+		m_ids[wireId] = id;
+		m_wireIds[id] = wireId;
+	}
+
+	// Returns symbol identifier bound to wire identifier, SymbolTable::INVALID_ID if none
+	std::size_t find(std::uint32_t wireId) const noexcept
+	{
+		return wireId < m_ids.size() ? m_ids[wireId] : SymbolTable::INVALID_ID;
+	}
+
+	// Returns wire identifier bound to symbol identifier, NO_WIRE_SYMBOL_ID if none
+	std::uint32_t wireId(std::size_t id) const noexcept
+	{
+		return id < m_wireIds.size() ? m_wireIds[id] : NO_WIRE_SYMBOL_ID;
+	}
+
+private:
+	// Symbol identifiers indexed by wire identifiers
+	std::vector<std::size_t> m_ids;
+
+	// Wire identifiers indexed by symbol identifiers
+	std::vector<std::uint32_t> m_wireIds;
+};
+
+// Writes length prefix and type of frame with given size of fields
+inline void writeBinaryFrameHeader(ResponseWriter& out, BinaryFrameType type,
+	std::size_t fieldsSize)
+{
+	out.writeBinary(static_cast<std::uint32_t>(sizeof(type) + fieldsSize));
+	out.writeBinary(type);
+}
+
+// Writes response to rate request as BestRates frame, binary counterpart of
+// writeBestRatesResponse(). "names" provides exchangeWireId(index) and
+// currencyWireId(index) of path vertices, vertices for which isTransferHub(index)
+// is true are skipped and factor of hop following them includes factor of hop
+// leading to them. "path" can be nullptr, then response has no vertices.
+template <class Names>
+void writeBinaryBestRatesResponse(ResponseWriter& out, const Names& names,
+	std::uint32_t sourceExchange, std::uint32_t sourceCurrency,
+	std::uint32_t destinationExchange, std::uint32_t destinationCurrency,
+	const std::vector<std::size_t>* path, const PathRates& rates)
+{
+	std::uint32_t vertexCount = 0;
+	if (path) {
+		for (const auto index : *path) {
+			vertexCount += !names.isTransferHub(index);
+		}
+	}
+
+	constexpr std::size_t VERTEX_SIZE = 2 * sizeof(std::uint32_t) + sizeof(double)
+		+ sizeof(std::int64_t);
+	writeBinaryFrameHeader(out, BinaryFrameType::BestRates, 5 * sizeof(std::uint32_t)
+		+ sizeof(double) + vertexCount * VERTEX_SIZE);
+	out.writeBinary(sourceExchange);
+	out.writeBinary(sourceCurrency);
+	out.writeBinary(destinationExchange);
+	out.writeBinary(destinationCurrency);
+	out.writeBinary(rates.totalRate);
+	out.writeBinary(vertexCount);
+	if (path) {
+		double skippedFactor = 1.0;
+		for (std::size_t i = 0; i < path->size(); ++i) {
+			const auto index = (*path)[i];
+			if (names.isTransferHub(index)) {
+				if (i > 0) {
+					skippedFactor *= rates.hops[i].first;
+				}
+				continue;
+			}
+			out.writeBinary(names.exchangeWireId(index));
+			out.writeBinary(names.currencyWireId(index));
+			out.writeBinary(i > 0 ? skippedFactor * rates.hops[i].first : 1.0);
+			out.writeBinary(i > 0 ? static_cast<std::int64_t>(rates.hops[i].second)
+				* NANOSECONDS_PER_SECOND : std::int64_t(0));
+			skippedFactor = 1.0;
+		}
+	}
+	out.endResponse();
+}
+
+#endif // BINARY_PROTOCOL_H__
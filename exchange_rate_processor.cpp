@@ -1,28 +1,232 @@
 #include "exchange_rate_processor.h"
+#include "binary_protocol.h"
+#include "floyd_warsall.h"
+#include "rate_snapshot.h"
+#include "state_file.h"
+#include "text_protocol.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <clocale>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
-#include <iomanip>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <sstream>
 
 namespace {
-	const std::string TOKEN_DELIMITERS = " \t\v\r\n";
-	const std::string EXCHANGE_RATE_REQUEST = "EXCHANGE_RATE_REQUEST";
-	const std::string BEST_RATES_BEGIN = "BEST_RATES_BEGIN"; 
-	const std::string BEST_RATES_END = "BEST_RATES_END"; 
 	constexpr std::size_t INVALID_INDEX = std::numeric_limits<std::size_t>::max();
+
+	// RATE_TOLERANCE_FACTOR for searches over -log(rate) distances
+	const double LOG_RATE_TOLERANCE = std::log(RATE_TOLERANCE_FACTOR);
+
+	// Number of edges exhaustive search for best simple path may look at
+	constexpr std::size_t SIMPLE_PATH_SEARCH_BUDGET = 1000000;
+
+	// Cells of cached best rates affected by worsened edges are repaired
+	// by search over affected cells of the row, O(n) per cell. It pays off
+	// while they are at most this fraction of all cells, otherwise
+	// full Floyd-Warsall is faster.
+	constexpr std::size_t MAX_REPAIRED_CELLS_DIVISOR = 8;
+
+	// Edge timestamps are stored as 32-bit offsets from this time (2000-01-01T00:00:00Z),
+	// so rate info timestamps are limited to years 2000 to 2136
+	constexpr std::time_t TIMESTAMP_BASE = 946684800;
+
+	// Exchange identifier of transfer hub vertex in state file
+	constexpr std::uint32_t STATE_NO_EXCHANGE = std::numeric_limits<std::uint32_t>::max();
+
+	// Returns stored representation of timestamp in supported range
+	std::uint32_t encodeTimestamp(std::time_t timestamp) noexcept
+	{
+		return static_cast<std::uint32_t>(timestamp - TIMESTAMP_BASE);
+	}
+
+	// Returns timestamp by its stored representation
+	std::time_t decodeTimestamp(std::uint32_t time) noexcept
+	{
+		return TIMESTAMP_BASE + static_cast<std::time_t>(time);
+	}
+
+	// Parses given number of decimal digits starting at given offset.
+	// Returns -1 if there is non-digit character.
+	int parseDigits(std::string_view s, std::size_t offset, std::size_t count) noexcept
+	{
+		int value = 0;
+		for (std::size_t i = offset; i < offset + count; ++i) {
+			const auto digit = s[i] - '0';
+			if (digit < 0 || digit > 9) {
+				return -1;
+			}
+			value = value * 10 + digit;
+		}
+		return value;
+	}
+
+	// Returns number of days in given month (1..12) of given year
+	int daysInMonth(int year, int month) noexcept
+	{
+		constexpr int DAYS[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+		const bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+		return month == 2 && leap ? 29 : DAYS[month - 1];
+	}
+
+	// Returns number of days since 1970-01-01 for given date of proleptic
+	// Gregorian calendar. Based on public domain algorithm by Howard Hinnant:
+	// http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+	std::time_t daysFromCivil(int year, int month, int day) noexcept
+	{
+		year -= month <= 2;
+		const int era = (year >= 0 ? year : year - 399) / 400;
+		const int yearOfEra = year - era * 400;
+		const int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+		const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+		return static_cast<std::time_t>(era) * 146097 + dayOfEra - 719468;
+	}
+
+	// Parses whole string as floating-point number in "C" locale format, like
+	// std::from_chars with default format. Returns std::errc() on success,
+	// std::errc::invalid_argument or std::errc::result_out_of_range otherwise.
+	std::errc parseDouble(std::string_view s, double& value)
+	{
+#ifdef __cpp_lib_to_chars
+		const auto result = std::from_chars(s.data(), s.data() + s.length(), value);
+		return result.ec == std::errc() && result.ptr != s.data() + s.length()
+			? std::errc::invalid_argument : result.ec;
+#else
+		// Standard library has no floating-point std::from_chars (MSVC v141,
+		// GCC before 11). strtod needs terminated string, short numbers are
+		// copied to stack. It is called with "C" locale regardless of global one.
+		// Forms which std::from_chars doesn't accept are rejected: leading
+		// whitespace or plus sign and hexadecimal numbers.
+		constexpr std::size_t MAX_BUFFERED_LENGTH = 63;
+		if (s.empty() || std::isspace(static_cast<unsigned char>(s[0])) || s[0] == '+'
+			|| s.find_first_of("xX") != std::string_view::npos) {
+			return std::errc::invalid_argument;
+		}
+		char buffer[MAX_BUFFERED_LENGTH + 1];
+		std::string copy;
+		const char* number = buffer;
+		if (s.length() <= MAX_BUFFERED_LENGTH) {
+			std::memcpy(buffer, s.data(), s.length());
+			buffer[s.length()] = '\0';
+		} else {
+			copy.assign(s);
+			number = copy.c_str();
+		}
+#ifdef _MSC_VER
+		static const _locale_t C_LOCALE = _create_locale(LC_NUMERIC, "C");
+		char* end = nullptr;
+		errno = 0;
+		value = _strtod_l(number, &end, C_LOCALE);
+#else
+		static const locale_t C_LOCALE = newlocale(LC_NUMERIC_MASK, "C", locale_t());
+		char* end = nullptr;
+		errno = 0;
+		value = strtod_l(number, &end, C_LOCALE);
+#endif
+		if (end != number + s.length()) {
+			return std::errc::invalid_argument;
+		}
+		return errno == ERANGE ? std::errc::result_out_of_range : std::errc();
+#endif
+	}
+
+	// Copies symbols of one table into other, empty one. Symbols are
+	// interned in id order, so ids stay the same.
+	void copySymbols(const SymbolTable& from, SymbolTable& to)
+	{
+		to.reserve(from.size());
+		for (std::size_t id = 0; id < from.size(); ++id) {
+			to.intern(from.name(id));
+		}
+	}
 }
 
-ExchangeRateProcessor::ExchangeRateProcessor() :
+ExchangeRateProcessor::ExchangeRateProcessor(const ExchangeRateProcessorOptions& options) :
+	m_options(options),
+	m_responseWriter(options.captureResponses ? nullptr : &std::cout, options.outputBufferSize,
+		options.flushPerResponse),
 	m_exchanges(),
 	m_currencies(),
+	m_wireExchanges(),
+	m_wireCurrencies(),
 	m_exchangeCurrencyPairToIndexMapping(),
-	m_exchangeCurrencyPairsByIndex()
+	m_exchangeCurrencyPairsByIndex(),
+	m_transferHubs(),
+	m_adjacencyRates(),
+	m_adjacencyTimes(),
+	m_adjacencyLists(),
+	m_rate(),
+	m_next(),
+	m_hops(),
+	m_threadPool(options.threadCount > 1 ? new ThreadPool(options.threadCount) : nullptr),
+	m_allPairsValid(false),
+	m_hasPositiveCycle(false),
+	m_arbitrageReported(false),
+	m_pendingEdgeUpdates(),
+	m_streamTime(0),
+	m_restoredStreamTime(0),
+	m_lastStateSaveTime(0),
+	m_edgeExpiries(),
+	m_context(m_responseWriter),
+	m_snapshotVersion(0)
+{
+}
+
+ExchangeRateProcessor::ExchangeRateProcessor(const ExchangeRateProcessor& other) :
+	m_options(other.m_options),
+	m_responseWriter(nullptr, other.m_options.outputBufferSize, false),
+	m_exchanges(),
+	m_currencies(),
+	m_wireExchanges(other.m_wireExchanges),
+	m_wireCurrencies(other.m_wireCurrencies),
+	m_exchangeCurrencyPairToIndexMapping(other.m_exchangeCurrencyPairToIndexMapping),
+	m_exchangeCurrencyPairsByIndex(other.m_exchangeCurrencyPairsByIndex),
+	m_transferHubs(other.m_transferHubs),
+	m_adjacencyRates(),
+	m_adjacencyTimes(),
+	m_adjacencyLists(other.m_adjacencyLists),
+	m_rate(),
+	m_next(),
+	m_hops(),
+	m_threadPool(),
+	m_allPairsValid(other.m_allPairsValid),
+	m_hasPositiveCycle(other.m_hasPositiveCycle),
+	m_arbitrageReported(other.m_arbitrageReported),
+	m_pendingEdgeUpdates(other.m_pendingEdgeUpdates),
+	m_streamTime(other.m_streamTime),
+	m_restoredStreamTime(other.m_restoredStreamTime),
+	m_lastStateSaveTime(other.m_lastStateSaveTime),
+	m_edgeExpiries(),
+	m_context(m_responseWriter),
+	m_snapshotVersion(other.m_snapshotVersion)
+{
+	copySymbols(other.m_exchanges, m_exchanges);
+	copySymbols(other.m_currencies, m_currencies);
+
+	// Padding of adjacency table may be uninitialized after growth, so only cells are copied
+	m_adjacencyRates.copyCellsFrom(other.m_adjacencyRates, 0.0);
+	m_adjacencyTimes.copyCellsFrom(other.m_adjacencyTimes, 0);
+	m_rate.copyCellsFrom(other.m_rate, 0.0);
+	m_next.copyCellsFrom(other.m_next, NO_NEXT_VERTEX);
+	m_hops.copyCellsFrom(other.m_hops, 0);
+}
+
+void ExchangeRateProcessor::processData(std::string_view data)
 {
+	applyLine(parseLine(data), data);
 }
 
-void ExchangeRateProcessor::processData(const std::string& data)
+ParsedLine ExchangeRateProcessor::parseLine(std::string_view data)
 {
+	ParsedLine line;
 	try {
 		// Try to get first token. If we can't do that,
 		// report error and stop further processing.
@@ -33,13 +237,42 @@ void ExchangeRateProcessor::processData(const std::string& data)
 		const auto token = t.getToken();
 
 		// Determine whether this is rate information or request
-		// and route data to approproate processing function.
+		// and route data to approproate parsing function.
 		if (token == EXCHANGE_RATE_REQUEST) {
-			processRequest(t);
+			parseRequest(t, line);
+		} else if (token == EXCHANGE_RATE_BATCH_REQUEST) {
+			parseBatchRequest(t, line);
+		} else if (token == TRANSFER_FEE) {
+			parseTransferFee(t, line);
 		} else {
-			// We will need to parse info from scratch, so reset tokenizer
-			t.reset();
-			processInfo(t);
+			// First token is timestamp of rate info
+			parseInfo(t, line);
+		}
+	} catch (std::exception& ex) {
+		line.kind = ParsedLine::Kind::Invalid;
+		line.error = ex.what();
+	}
+	return line;
+}
+
+void ExchangeRateProcessor::applyLine(const ParsedLine& line, std::string_view data)
+{
+	try {
+		switch (line.kind) {
+		case ParsedLine::Kind::Info:
+			processInfo(line);
+			break;
+		case ParsedLine::Kind::Request:
+			processRequest(line);
+			break;
+		case ParsedLine::Kind::BatchRequest:
+			processBatchRequest(line.queries);
+			break;
+		case ParsedLine::Kind::TransferFee:
+			processTransferFee(line);
+			break;
+		default:
+			throw std::invalid_argument(line.error);
 		}
 	} catch (std::exception& ex) {
 		// Report error if data was not properly processed
@@ -47,114 +280,703 @@ void ExchangeRateProcessor::processData(const std::string& data)
 	}
 }
 
-void ExchangeRateProcessor::processInfo(StringTokenizer& data)
+void ExchangeRateProcessor::processFrame(std::string_view frame)
+{
+	try {
+		applyFrame(frame);
+	} catch (std::exception& ex) {
+		// Report error, frame type identifies data
+		std::cerr << "Error: " << ex.what() << ", binary frame of type "
+			<< (frame.empty() ? 0u : static_cast<unsigned>(static_cast<std::uint8_t>(frame[0])))
+			<< std::endl;
+	}
+}
+
+void ExchangeRateProcessor::applyFrame(std::string_view frame)
+{
+	BinaryFieldReader fields(frame);
+	const auto type = fields.read<BinaryFrameType>();
+	ParsedLine line;
+	switch (type) {
+	case BinaryFrameType::Symbol: {
+		const auto kind = fields.read<BinarySymbolKind>();
+		const auto wireId = fields.read<std::uint32_t>();
+		bindWireSymbol(kind, wireId, fields.readRest());
+		break;
+	}
+	case BinaryFrameType::PriceUpdate: {
+		const auto timestamp = fields.read<std::int64_t>();
+		const auto exchangeId = resolveWireSymbol(m_wireExchanges,
+			fields.read<std::uint32_t>(), "exchange");
+		const auto sourceCurrencyId = resolveWireSymbol(m_wireCurrencies,
+			fields.read<std::uint32_t>(), "source_currency");
+		const auto destinationCurrencyId = resolveWireSymbol(m_wireCurrencies,
+			fields.read<std::uint32_t>(), "destination_currency");
+		line.forwardFactor = fields.read<double>();
+		line.backwardFactor = fields.read<double>();
+		fields.checkEnd();
+		line.timestamp = static_cast<std::time_t>(timestamp / NANOSECONDS_PER_SECOND);
+		line.truncatedTimestamp = true;
+		validateInfo(line);
+
+		// Symbols are known already, rate info is applied without name lookups
+		if (!skipRestoredInfo(line.timestamp)) {
+			applyInfo(std::make_pair(exchangeId, false), std::make_pair(sourceCurrencyId, false),
+				std::make_pair(destinationCurrencyId, false), line);
+		}
+		break;
+	}
+	case BinaryFrameType::RateRequest: {
+		std::uint32_t wireIds[4];
+		for (auto& wireId : wireIds) {
+			wireId = fields.read<std::uint32_t>();
+		}
+		line.maxHops = fields.read<std::uint32_t>();
+		line.pathCount = std::max<std::size_t>(fields.read<std::uint32_t>(), 1);
+		fields.checkEnd();
+		if (line.pathCount > MAX_PATH_COUNT) {
+			throw std::invalid_argument("too many best paths requested");
+		}
+
+		// Query with unbound identifier is answered with empty path like unknown pair
+		const std::size_t ids[4] = { m_wireExchanges.find(wireIds[0]),
+			m_wireCurrencies.find(wireIds[1]), m_wireExchanges.find(wireIds[2]),
+			m_wireCurrencies.find(wireIds[3]) };
+		if (std::find(std::begin(ids), std::end(ids), SymbolTable::INVALID_ID) != std::end(ids)) {
+			writeBinaryBestRatesResponse(m_responseWriter, *this, wireIds[0], wireIds[1],
+				wireIds[2], wireIds[3], nullptr, PathRates());
+			throw std::invalid_argument("unknown symbol id in rate request");
+		}
+		line.fields[0] = m_exchanges.name(ids[0]);
+		line.fields[1] = m_currencies.name(ids[1]);
+		line.fields[2] = m_exchanges.name(ids[2]);
+		line.fields[3] = m_currencies.name(ids[3]);
+		processRequest(line);
+		break;
+	}
+	case BinaryFrameType::TransferFee: {
+		line.fields[0] = m_exchanges.name(resolveWireSymbol(m_wireExchanges,
+			fields.read<std::uint32_t>(), "exchange"));
+		line.fields[1] = m_currencies.name(resolveWireSymbol(m_wireCurrencies,
+			fields.read<std::uint32_t>(), "currency"));
+		line.forwardFactor = fields.read<double>();
+		line.backwardFactor = fields.read<double>();
+		fields.checkEnd();
+		validateTransferFee(line);
+		processTransferFee(line);
+		break;
+	}
+	default:
+		throw std::invalid_argument("unknown binary frame type");
+	}
+}
+
+void ExchangeRateProcessor::bindWireSymbol(const BinarySymbolKind kind,
+	const std::uint32_t wireId, std::string_view name)
+{
+	// Names must be valid in text protocol too
+	if (name.empty() || name.find_first_of(TOKEN_DELIMITERS) != std::string_view::npos) {
+		throw std::invalid_argument("invalid symbol name");
+	}
+
+	if (kind == BinarySymbolKind::Exchange) {
+		m_wireExchanges.bind(wireId, m_exchanges.intern(name).first);
+	} else if (kind == BinarySymbolKind::Currency) {
+		// Brand new currency gets transfer hub and pairs for all exchanges,
+		// as if it came with rate info
+		const auto currency = m_currencies.intern(name);
+		if (currency.second) {
+			m_allPairsValid = false;
+			provisionNewCurrency(currency.first, provisioningTime());
+		}
+		m_wireCurrencies.bind(wireId, currency.first);
+	} else {
+		throw std::invalid_argument("invalid symbol kind");
+	}
+}
+
+std::size_t ExchangeRateProcessor::resolveWireSymbol(const WireSymbolMap& symbols,
+	const std::uint32_t wireId, const char* fieldName)
+{
+	const auto id = symbols.find(wireId);
+	if (id == SymbolTable::INVALID_ID) {
+		throw std::invalid_argument(std::string("unknown symbol id of ") + fieldName);
+	}
+	return id;
+}
+
+void ExchangeRateProcessor::flushOutput()
+{
+	m_responseWriter.flush();
+}
+
+void ExchangeRateProcessor::takeOutput(std::string& output)
+{
+	m_responseWriter.take(output);
+}
+
+void ExchangeRateProcessor::reserve(const std::size_t exchangeCount,
+	const std::size_t currencyCount)
+{
+	// Every currency has transfer hub vertex in addition to exchange/currency pairs
+	if (currencyCount && exchangeCount >= MAX_VERTEX_COUNT / currencyCount) {
+		throw std::length_error("too many exchanges and currencies");
+	}
+	const auto vertexCount = exchangeCount * currencyCount + currencyCount;
+	m_exchanges.reserve(exchangeCount);
+	m_currencies.reserve(currencyCount);
+	m_exchangeCurrencyPairToIndexMapping.reserve(exchangeCount);
+	m_exchangeCurrencyPairsByIndex.reserve(vertexCount);
+	m_transferHubs.reserve(currencyCount);
+	if (m_options.routingEngine == RoutingEngine::SingleSource) {
+		m_adjacencyLists.reserve(vertexCount);
+	} else {
+		m_adjacencyRates.reserve(vertexCount);
+		m_adjacencyTimes.reserve(vertexCount);
+	}
+}
+
+void ExchangeRateProcessor::refreshBestRates()
+{
+	expireStaleEdges();
+	if (m_options.routingEngine == RoutingEngine::AllPairs) {
+		updateAllPairsBestRates();
+		if (m_options.reportArbitrage) {
+			checkArbitrage();
+		}
+	}
+}
+
+std::unique_ptr<const RateSnapshot> ExchangeRateProcessor::createSnapshot()
+{
+	refreshBestRates();
+	return std::make_unique<const RateSnapshot>(++m_snapshotVersion, *this);
+}
+
+void ExchangeRateProcessor::saveState(const std::string& fileName)
+{
+	expireStaleEdges();
+	const bool saveBestRates = m_options.routingEngine == RoutingEngine::AllPairs;
+	if (saveBestRates) {
+		updateAllPairsBestRates();
+	}
+
+	StateFileWriter file(fileName);
+
+	// Names in order of identifiers
+	for (const auto symbols : { &m_exchanges, &m_currencies }) {
+		file.writeValue(static_cast<std::uint64_t>(symbols->size()));
+		for (std::size_t id = 0; id < symbols->size(); ++id) {
+			file.writeString(symbols->name(id));
+		}
+	}
+
+	// Vertices as exchange and currency identifiers, exchange of transfer hub
+	// is NO_EXCHANGE
+	const auto n = m_exchangeCurrencyPairsByIndex.size();
+	file.writeValue(static_cast<std::uint64_t>(n));
+	for (const auto& pair : m_exchangeCurrencyPairsByIndex) {
+		file.writeValue(pair.first == SymbolTable::INVALID_ID ? STATE_NO_EXCHANGE
+			: static_cast<std::uint32_t>(pair.first));
+		file.writeValue(static_cast<std::uint32_t>(pair.second));
+	}
+
+	// Present edges as arrays of sources, destinations, encoded timestamps and rates
+	std::vector<std::uint32_t> sources;
+	std::vector<std::uint32_t> destinations;
+	std::vector<std::uint32_t> times;
+	std::vector<double> rates;
+	for (std::size_t i = 0; i < n; ++i) {
+		forEachEdge(i, [&](std::size_t j, double rate) {
+			sources.push_back(static_cast<std::uint32_t>(i));
+			destinations.push_back(static_cast<std::uint32_t>(j));
+			times.push_back(encodeTimestamp(edgeTimestamp(i, j)));
+			rates.push_back(rate);
+		});
+	}
+	file.writeValue(static_cast<std::int64_t>(m_streamTime));
+	file.writeValue(static_cast<std::uint64_t>(rates.size()));
+	file.writeArray(sources.data(), sources.size());
+	file.writeArray(destinations.data(), destinations.size());
+	file.writeArray(times.data(), times.size());
+	file.writeArray(rates.data(), rates.size());
+
+	// Best rates, next vertices and hop counts, rows without padding
+	file.writeValue(static_cast<std::uint8_t>(saveBestRates));
+	if (saveBestRates) {
+		for (std::size_t i = 0; i < n; ++i) {
+			file.writeArray(m_rate.row(i), n);
+		}
+		for (std::size_t i = 0; i < n; ++i) {
+			file.writeArray(m_next.row(i), n);
+		}
+		for (std::size_t i = 0; i < n; ++i) {
+			file.writeArray(m_hops.row(i), n);
+		}
+	}
+	file.commit();
+}
+
+void ExchangeRateProcessor::loadState(const std::string& fileName)
+{
+	if (!m_exchangeCurrencyPairsByIndex.empty()) {
+		throw std::logic_error("state can be loaded only into empty processor");
+	}
+	StateFileReader file(fileName.c_str());
+
+	// Names get the same identifiers as they had in saved state
+	for (const auto symbols : { &m_exchanges, &m_currencies }) {
+		const auto count = file.readValue<std::uint64_t>();
+		for (std::uint64_t id = 0; id < count; ++id) {
+			if (!symbols->intern(file.readString()).second) {
+				throw std::runtime_error("Duplicate name in state file");
+			}
+		}
+	}
+
+	// Vertices are added in saved order, so they get the same indices.
+	// Hub of currency precedes its exchange/currency pairs.
+	const auto n = file.readValue<std::uint64_t>();
+	if (n > file.remaining() / (2 * sizeof(std::uint32_t))) {
+		throw std::runtime_error("Invalid number of vertices in state file");
+	}
+	for (std::uint64_t i = 0; i < n; ++i) {
+		const auto exchangeId = file.readValue<std::uint32_t>();
+		const auto currencyId = file.readValue<std::uint32_t>();
+		if (currencyId >= m_currencies.size() || (exchangeId != STATE_NO_EXCHANGE
+			&& exchangeId >= m_exchanges.size())) {
+			throw std::runtime_error("Invalid vertex in state file");
+		}
+		const bool hubKnown = currencyId < m_transferHubs.size()
+			&& m_transferHubs[currencyId] != INVALID_INDEX;
+		if (exchangeId == STATE_NO_EXCHANGE) {
+			if (hubKnown) {
+				throw std::runtime_error("Invalid vertex in state file");
+			}
+			addTransferHub(currencyId);
+		} else if (!hubKnown || findExchangeCurrencyPair(exchangeId, currencyId) != INVALID_INDEX) {
+			throw std::runtime_error("Invalid vertex in state file");
+		} else {
+			addExchangeCurrencyPair(exchangeId, currencyId);
+		}
+	}
+
+	// Edges. Count is validated before storage is allocated, so corrupted
+	// file can't request more memory than its size justifies.
+	m_streamTime = static_cast<std::time_t>(file.readValue<std::int64_t>());
+	const auto edgeCount = file.readValue<std::uint64_t>();
+	constexpr std::size_t EDGE_SIZE = 3 * sizeof(std::uint32_t) + sizeof(double);
+	if (edgeCount > n * n || edgeCount > file.remaining() / EDGE_SIZE) {
+		throw std::runtime_error("Invalid number of edges in state file");
+	}
+	std::vector<std::uint32_t> sources(edgeCount);
+	std::vector<std::uint32_t> destinations(edgeCount);
+	std::vector<std::uint32_t> times(edgeCount);
+	std::vector<double> rates(edgeCount);
+	file.readArray(sources.data(), edgeCount);
+	file.readArray(destinations.data(), edgeCount);
+	file.readArray(times.data(), edgeCount);
+	file.readArray(rates.data(), edgeCount);
+	for (std::size_t k = 0; k < edgeCount; ++k) {
+		if (sources[k] >= n || destinations[k] >= n || !(rates[k] > 0.0)) {
+			throw std::runtime_error("Invalid edge in state file");
+		}
+		const auto cell = adjacencyCell(sources[k], destinations[k]);
+		cell.rate = rates[k];
+		cell.time = times[k];
+
+		// Quotes expire as if they came from input, hub edges never expire
+		const auto timestamp = decodeTimestamp(times[k]);
+		if (m_options.maxQuoteAge && !isTransferHub(sources[k])
+			&& !isTransferHub(destinations[k])) {
+			m_edgeExpiries.push(EdgeExpiry{timestamp + m_options.maxQuoteAge, timestamp,
+				sources[k], destinations[k]});
+		}
+	}
+
+	// Best rates are used only by all-pairs engine
+	if (file.readValue<std::uint8_t>()) {
+		const bool loadBestRates = m_options.routingEngine == RoutingEngine::AllPairs;
+		if (loadBestRates) {
+			m_rate.assign(n, 0.0);
+			m_next.assign(n, NO_NEXT_VERTEX);
+			m_hops.assign(n, 0);
+		}
+		ScratchArena::Scope scope(m_context.scratch);
+		auto rateRow = makeScratchVector(m_context.scratch, n, 0.0);
+		for (std::size_t i = 0; i < n; ++i) {
+			file.readArray(loadBestRates ? m_rate.row(i) : rateRow.data(), n);
+		}
+		auto nextRow = makeScratchVector(m_context.scratch, n, NO_NEXT_VERTEX);
+		for (std::size_t i = 0; i < n; ++i) {
+			const auto next = loadBestRates ? m_next.row(i) : nextRow.data();
+			file.readArray(next, n);
+			for (std::size_t j = 0; j < n; ++j) {
+				if (next[j] >= n && next[j] != NO_NEXT_VERTEX) {
+					throw std::runtime_error("Invalid best rates in state file");
+				}
+			}
+		}
+		auto hopsRow = makeScratchVector(m_context.scratch, n, HopCount(0));
+		for (std::size_t i = 0; i < n; ++i) {
+			file.readArray(loadBestRates ? m_hops.row(i) : hopsRow.data(), n);
+		}
+		if (loadBestRates) {
+			m_hasPositiveCycle = detectPositiveCycle();
+			m_allPairsValid = true;
+		}
+	}
+	file.checkEnd();
+
+	m_restoredStreamTime = m_streamTime;
+	m_lastStateSaveTime = m_streamTime;
+}
+
+void ExchangeRateProcessor::saveStatePeriodically()
+{
+	if (!m_lastStateSaveTime) {
+		m_lastStateSaveTime = m_streamTime;
+	} else if (m_streamTime - m_lastStateSaveTime >= m_options.stateSaveInterval) {
+		m_lastStateSaveTime = m_streamTime;
+		try {
+			saveState(m_options.stateFileName);
+		} catch (std::exception& ex) {
+			std::cerr << "Error: " << ex.what() << std::endl;
+		}
+	}
+}
+
+void ExchangeRateProcessor::parseInfo(StringTokenizer& data, ParsedLine& line)
 {
-	// Parse fields of rate info
-	const auto timestamp = parseTimestampField(data, "timestamp");
-	const auto exchange = parseStringField(data, "exchange");
-	const auto sourceCurrency = parseStringField(data, "source_currency");
-	const auto destinationCurrency = parseStringField(data, "destination_currency");
-	const auto forwardFactor = parseDoubleField(data, "forward_factor");
-	const auto backwardFactor = parseDoubleField(data, "backward_factor");
+	// Parse fields of rate info. Timestamp is the token already parsed by parseLine().
+	line.timestamp = parseTimestampField(data.getToken(), "timestamp");
+	line.fields[0] = parseStringField(data, "exchange");
+	line.fields[1] = parseStringField(data, "source_currency");
+	line.fields[2] = parseStringField(data, "destination_currency");
+	line.forwardFactor = parseDoubleField(data, "forward_factor");
+	line.backwardFactor = parseDoubleField(data, "backward_factor");
+	validateInfo(line);
+	line.kind = ParsedLine::Kind::Info;
+}
 
+void ExchangeRateProcessor::validateInfo(const ParsedLine& line)
+{
 	// Validate forward and backward factors
-	if (forwardFactor <= 0.0) {
+	if (line.forwardFactor <= 0.0) {
 		throw std::invalid_argument("invalid forward factor");
 	}
-	if (backwardFactor <= 0.0) {
+	if (line.backwardFactor <= 0.0) {
 		throw std::invalid_argument("invalid backward factor");
 	}
-	if (forwardFactor * backwardFactor > 1.0) {
+	if (line.forwardFactor * line.backwardFactor > 1.0) {
 		throw std::invalid_argument("invalid combination of forward and backward factors");
 	}
 
-	// Update graph adjacency table
+	// Timestamp must fit its stored representation
+	if (line.timestamp < TIMESTAMP_BASE || line.timestamp - TIMESTAMP_BASE
+		> static_cast<std::time_t>(std::numeric_limits<std::uint32_t>::max())) {
+		throw std::invalid_argument("timestamp is out of supported range");
+	}
+}
+
+void ExchangeRateProcessor::parseRequest(StringTokenizer& data, ParsedLine& line)
+{
+	// Parse and validate fields of rate request
+	line.fields[0] = parseStringField(data, "source_exchange");
+	line.fields[1] = parseStringField(data, "source_currency");
+	line.fields[2] = parseStringField(data, "destination_exchange");
+	line.fields[3] = parseStringField(data, "destination_currency");
+	parseRequestOptions(data, line);
+	line.kind = ParsedLine::Kind::Request;
+}
+
+void ExchangeRateProcessor::parseRequestOptions(StringTokenizer& data, ParsedLine& line)
+{
+	while (data.parseNextToken(TOKEN_DELIMITERS)) {
+		const auto token = data.getToken();
+		std::size_t* value = nullptr;
+		std::string_view name;
+		if (token.substr(0, MAX_HOPS_OPTION.length()) == MAX_HOPS_OPTION) {
+			value = &line.maxHops;
+			name = MAX_HOPS_OPTION;
+		} else if (token.substr(0, TOP_PATHS_OPTION.length()) == TOP_PATHS_OPTION) {
+			value = &line.pathCount;
+			name = TOP_PATHS_OPTION;
+		} else {
+			throw std::invalid_argument("unknown request option " + std::string(token));
+		}
+
+		// Both options are positive integers, number of paths is bounded
+		const auto number = token.substr(name.length());
+		const auto result = std::from_chars(number.data(), number.data() + number.length(), *value);
+		if (result.ec != std::errc() || result.ptr != number.data() + number.length()
+			|| *value == 0 || line.pathCount > MAX_PATH_COUNT) {
+			throw std::invalid_argument("invalid value of request option " + std::string(token));
+		}
+	}
+}
+
+void ExchangeRateProcessor::parseBatchRequest(StringTokenizer& data, ParsedLine& line)
+{
+	// Every query consists of source exchange, source currency,
+	// destination exchange and destination currency
+	while (data.parseNextToken(TOKEN_DELIMITERS)) {
+		RateQuery query;
+		query.sourceExchange = data.getToken();
+		query.sourceCurrency = parseStringField(data, "source_currency");
+		query.destinationExchange = parseStringField(data, "destination_exchange");
+		query.destinationCurrency = parseStringField(data, "destination_currency");
+		line.queries.push_back(query);
+	}
+	if (line.queries.empty()) {
+		throw std::invalid_argument("missing source_exchange");
+	}
+	line.kind = ParsedLine::Kind::BatchRequest;
+}
+
+void ExchangeRateProcessor::parseTransferFee(StringTokenizer& data, ParsedLine& line)
+{
+	line.fields[0] = parseStringField(data, "exchange");
+	line.fields[1] = parseStringField(data, "currency");
+	line.forwardFactor = parseDoubleField(data, "withdrawal_factor");
+	line.backwardFactor = parseDoubleField(data, "deposit_factor");
+	validateTransferFee(line);
+	line.kind = ParsedLine::Kind::TransferFee;
+}
+
+void ExchangeRateProcessor::validateTransferFee(const ParsedLine& line)
+{
+	// Fee can't make transfer gain money, otherwise transfers back and
+	// forth would be profitable cycle
+	if (line.forwardFactor <= 0.0 || line.forwardFactor > 1.0) {
+		throw std::invalid_argument("invalid withdrawal factor");
+	}
+	if (line.backwardFactor <= 0.0 || line.backwardFactor > 1.0) {
+		throw std::invalid_argument("invalid deposit factor");
+	}
+}
+
+void ExchangeRateProcessor::processInfo(const ParsedLine& line)
+{
+	if (skipRestoredInfo(line.timestamp)) {
+		return;
+	}
 
 	// Attempt to add exchanges and currencies, as result also determine
 	// whether they are already known or not
-	const auto pibExchange = m_exchanges.insert(exchange);
-	const auto pibSourceCurrency = m_currencies.insert(sourceCurrency);
-	const auto pibDestinationCurrency = m_currencies.insert(destinationCurrency);
-
-	if (pibSourceCurrency.second) {
-		// Source currency is brand new currency
-		provisionNewCurrency(sourceCurrency);
-	} else if (pibExchange.second) {
-		// Source currency is already known, but this is new exchange,
-		// so provision source currency for it
-		provisionCurrencyForExchange(sourceCurrency, exchange);
-	}
-	if (pibDestinationCurrency.second) {
-		// Destination currency is brand new currency
-		provisionNewCurrency(destinationCurrency);
-	} else if (pibExchange.second) {
-		// Destination currency is already known, but this is new exchange,
-		// so provision destination currency for it
-		provisionCurrencyForExchange(destinationCurrency, exchange);
+	const auto pibExchange = m_exchanges.intern(line.fields[0]);
+	const auto pibSourceCurrency = m_currencies.intern(line.fields[1]);
+	const auto pibDestinationCurrency = m_currencies.intern(line.fields[2]);
+	applyInfo(pibExchange, pibSourceCurrency, pibDestinationCurrency, line);
+}
+
+bool ExchangeRateProcessor::skipRestoredInfo(const std::time_t timestamp)
+{
+	// Rate info which loaded state already contains is skipped
+	// until input catches up with it
+	if (m_restoredStreamTime) {
+		if (timestamp < m_restoredStreamTime) {
+			return true;
+		}
+		m_restoredStreamTime = 0;
 	}
+	return false;
+}
+
+void ExchangeRateProcessor::applyInfo(const std::pair<std::size_t, bool>& exchange,
+	const std::pair<std::size_t, bool>& sourceCurrency,
+	const std::pair<std::size_t, bool>& destinationCurrency, const ParsedLine& line)
+{
+	// Rate info timestamps drive the clock of quote expiry
+	m_streamTime = std::max(m_streamTime, line.timestamp);
+
+	// Update graph adjacency table
 
 	// Find or add exchange/currency pairs
-	const auto sourceIndex = findExchangeCurrencyPair(exchange, sourceCurrency);
-	const auto destinationIndex = findExchangeCurrencyPair(exchange, destinationCurrency); 
+	const auto sourceIndex = provisionExchangeCurrencyPair(exchange, sourceCurrency,
+		line.timestamp);
+	const auto destinationIndex = provisionExchangeCurrencyPair(exchange, destinationCurrency,
+		line.timestamp);
+
+	// Update source -> destination and destination -> source edges
+	updateEdge(sourceIndex, destinationIndex, line.timestamp, line.forwardFactor,
+		line.truncatedTimestamp);
+	updateEdge(destinationIndex, sourceIndex, line.timestamp, line.backwardFactor,
+		line.truncatedTimestamp);
 
-	// Update source -> destination edge
-	auto& sourceToDestinationCell = m_adjacencyTable[sourceIndex][destinationIndex];
-	if (sourceToDestinationCell.first < timestamp) {
-		sourceToDestinationCell.first = timestamp;
-		sourceToDestinationCell.second = forwardFactor;
+	// In all-pairs mode check only while cached best rates can be repaired
+	// incrementally, otherwise check is deferred to next full recomputation
+	if (m_options.reportArbitrage && (m_allPairsValid
+		|| m_options.routingEngine != RoutingEngine::AllPairs)) {
+		checkArbitrage();
 	}
 
-	// Update destination -> source edge
-	auto& destinationToSourceCell = m_adjacencyTable[destinationIndex][sourceIndex];
-	if (destinationToSourceCell.first < timestamp) {
-		destinationToSourceCell.first = timestamp;
-		destinationToSourceCell.second = backwardFactor;
+	if (m_options.stateSaveInterval) {
+		saveStatePeriodically();
 	}
 }
 
-void ExchangeRateProcessor::processRequest(StringTokenizer& data)
+void ExchangeRateProcessor::processRequest(const ParsedLine& line)
 {
-	// Parse and validate fields of rate request
-	const auto sourceExchange = parseStringField(data, "source_exchange");
-	const auto sourceCurrency = parseStringField(data, "source_currency");
-	const auto destinationExchange = parseStringField(data, "destination_exchange");
-	const auto destinationCurrency = parseStringField(data, "destination_currency");
+	refreshBestRates();
+	answerRequest(line, m_context);
+}
+
+void ExchangeRateProcessor::answerRequest(const ParsedLine& line,
+	RequestContext& context) const
+{
+	const RateQuery query{line.fields[0], line.fields[1], line.fields[2], line.fields[3]};
+
+	// Locate source and destination exchnage/currency pairs
+	std::size_t sourceIndex = INVALID_INDEX;
+	std::size_t destinationIndex = INVALID_INDEX;
+	const auto error = locateQuery(query, sourceIndex, destinationIndex);
+	if (!error.empty()) {
+		printPath(query, nullptr, context);
+		throw std::invalid_argument(error);
+	}
+
+	// Hop limit and alternative paths need dedicated search,
+	// every found path is reported as separate response
+	if (line.maxHops || line.pathCount > 1) {
+		const auto count = findBestPaths(sourceIndex, destinationIndex, line.maxHops,
+			line.pathCount, context.paths, context.scratch);
+		if (!count) {
+			context.paths.front().clear();
+			printPath(query, &context.paths.front(), context);
+		}
+		for (std::size_t i = 0; i < count; ++i) {
+			printPath(query, &context.paths[i], context, i == 0 && !line.maxHops);
+		}
+		return;
+	}
+
+	// Find best rate exchange path and print it out.
+	if (context.paths.empty()) {
+		context.paths.emplace_back();
+	}
+	auto& path = context.paths.front();
+	if (m_options.routingEngine == RoutingEngine::SingleSource) {
+		generateExchangePathSingleSource(sourceIndex, destinationIndex, path, context.scratch);
+	} else {
+		generateExchangePath(sourceIndex, destinationIndex, path, context.scratch);
+	}
+	printPath(query, &path, context);
+}
+
+void ExchangeRateProcessor::processBatchRequest(const std::vector<RateQuery>& queries)
+{
+	refreshBestRates();
+	answerBatchRequest(queries, m_context);
+	std::cerr << m_context.errors << std::flush;
+	m_context.errors.clear();
+}
+
+void ExchangeRateProcessor::answerBatchRequest(const std::vector<RateQuery>& queries,
+	RequestContext& context) const
+{
+	// Locate vertices of all queries, report unknown pairs
+	auto& scratch = context.scratch;
+	ScratchArena::Scope scope(scratch);
+	auto indices = makeScratchVector(scratch, queries.size(),
+		std::make_pair(INVALID_INDEX, INVALID_INDEX));
+	auto order = makeScratchVector<std::size_t>(scratch);
+	order.reserve(queries.size());
+	for (std::size_t i = 0; i < queries.size(); ++i) {
+		const auto error = locateQuery(queries[i], indices[i].first, indices[i].second);
+		if (error.empty()) {
+			order.push_back(i);
+		} else {
+			context.reportError(error);
+		}
+	}
+
+	// Find best paths of located queries
+	auto& paths = context.paths;
+	if (paths.size() < queries.size()) {
+		paths.resize(queries.size());
+	}
+	if (m_options.routingEngine == RoutingEngine::SingleSource) {
+		// Group queries by source, one search serves the whole group
+		std::stable_sort(order.begin(), order.end(), [&indices](std::size_t a, std::size_t b) {
+			return indices[a].first < indices[b].first;
+		});
+		auto previous = makeScratchVector<std::size_t>(scratch);
+		bool treeValid = false;
+		for (std::size_t k = 0; k < order.size(); ++k) {
+			const auto i = order[k];
+			const auto sourceIndex = indices[i].first;
+			if (k == 0 || sourceIndex != indices[order[k - 1]].first) {
+				treeValid = computeSingleSourceTree(sourceIndex, previous, scratch);
+			}
+			if (treeValid) {
+				extractPath(previous, sourceIndex, indices[i].second, paths[i]);
+			} else {
+				findBestSimplePath(sourceIndex, indices[i].second, paths[i], scratch);
+			}
+		}
+	} else {
+		for (const auto i : order) {
+			generateExchangePath(indices[i].first, indices[i].second, paths[i], scratch);
+		}
+	}
+
+	// Print responses in order of queries
+	for (std::size_t i = 0; i < queries.size(); ++i) {
+		const auto& query = queries[i];
+		const bool located = indices[i].second != INVALID_INDEX;
+		printPath(query, located ? &paths[i] : nullptr, context);
+	}
+}
+
+void ExchangeRateProcessor::processTransferFee(const ParsedLine& line)
+{
+	// Fee may be set before the first rate info of the pair
+	const auto index = provisionExchangeCurrencyPair(m_exchanges.intern(line.fields[0]),
+		m_currencies.intern(line.fields[1]), provisioningTime());
+
+	// Only the edges between pair and hub of its currency change,
+	// cached best rates are repaired from them like after rate info
+	const auto hubIndex = m_transferHubs[m_exchangeCurrencyPairsByIndex[index].second];
+	setEdgeRate(index, hubIndex, line.forwardFactor);
+	setEdgeRate(hubIndex, index, line.backwardFactor);
+
+	if (m_options.reportArbitrage && (m_allPairsValid
+		|| m_options.routingEngine != RoutingEngine::AllPairs)) {
+		checkArbitrage();
+	}
+}
 
-	// Locate source exchnage/currency pair
-	const auto sourceIndex = findExchangeCurrencyPair(sourceExchange, sourceCurrency);
+std::string ExchangeRateProcessor::locateQuery(const RateQuery& query,
+	std::size_t& sourceIndex, std::size_t& destinationIndex) const
+{
+	sourceIndex = findExchangeCurrencyPair(query.sourceExchange, query.sourceCurrency);
 	if (sourceIndex == INVALID_INDEX) {
-		printPath(sourceExchange, sourceCurrency, destinationExchange,
-			destinationCurrency, nullptr);
 		std::ostringstream err;
-		err << "source currency/exchnage pair " << sourceExchange << "/" 
-			<< sourceCurrency << " is unknown";
-		throw std::invalid_argument(err.str());
+		err << "source currency/exchnage pair " << query.sourceExchange << "/"
+			<< query.sourceCurrency << " is unknown";
+		return err.str();
 	}
 
-	// Locate destination exchnage/currency pair
-	const auto destinationIndex = findExchangeCurrencyPair(destinationExchange,
-		destinationCurrency);
+	destinationIndex = findExchangeCurrencyPair(query.destinationExchange,
+		query.destinationCurrency);
 	if (destinationIndex == INVALID_INDEX) {
-		printPath(sourceExchange, sourceCurrency, destinationExchange,
-			destinationCurrency, nullptr);
 		std::ostringstream err;
-		err << "destination currency/exchnage pair " << destinationExchange << "/"
-			<< destinationCurrency << " is unknown";
-		throw std::invalid_argument(err.str());
+		err << "destination currency/exchnage pair " << query.destinationExchange << "/"
+			<< query.destinationCurrency << " is unknown";
+		return err.str();
 	}
-
-	// Find best rate exchange path and print it out.
-	auto path = generateExchangePath(sourceIndex, destinationIndex);
-	printPath(sourceExchange, sourceCurrency, destinationExchange, destinationCurrency, &path);
+	return std::string();
 }
 
-std::string ExchangeRateProcessor::parseStringField(StringTokenizer& data, const char* fieldName)
+std::string_view ExchangeRateProcessor::parseStringField(StringTokenizer& data,
+	const char* fieldName)
 {
 	// Try read next token
 	if (!data.parseNextToken(TOKEN_DELIMITERS)) {
 		throw std::invalid_argument(std::string("missing ") + fieldName);
 	}
-	const auto& value = data.getToken();
+	const auto value = data.getToken();
 
 	// Check that token is not empty
 	if (value.empty()) {
@@ -164,257 +986,1301 @@ std::string ExchangeRateProcessor::parseStringField(StringTokenizer& data, const
 	return value;
 }
 
-std::time_t ExchangeRateProcessor::parseTimestampField(StringTokenizer& data, const char* fieldName)
+std::time_t ExchangeRateProcessor::parseTimestampField(std::string_view value,
+	const char* fieldName)
 {
-	// Read timestamp as string and validate its length
-	auto timestamp = parseStringField(data, fieldName);
+	// Timestamp has fixed format YYYY-MM-DDTHH:MM:SS+HH:MM (or -HH:MM),
+	// so parse it directly, without locale-dependent and time zone-dependent
+	// library functions.
 	constexpr std::size_t TIME_STRING_LENGTH = 25;
-	if (timestamp.length() != TIME_STRING_LENGTH) {
+	if (value.length() != TIME_STRING_LENGTH) {
 		throw std::invalid_argument(std::string("invalid length of time field ") + fieldName);
 	}
 
-	// Extract timezone sign
-	const auto tzSign = timestamp[19];
-	if (!(tzSign == '-' || tzSign == '+')) {
+	// Validate separators and extract timezone sign
+	const auto tzSign = value[19];
+	if (value[4] != '-' || value[7] != '-' || value[10] != 'T' || value[13] != ':'
+		|| value[16] != ':' || !(tzSign == '-' || tzSign == '+') || value[22] != ':') {
 		throw std::invalid_argument(std::string("invalid value of time field ") + fieldName);
 	}
 
-	// Extract time zone
-	auto timeZone = timestamp.substr(20);
-	timestamp.erase(timestamp.begin() + 19, timestamp.end());
-
-	// Parse timestamp
-	std::tm tmbTimestamp;
-	memset(&tmbTimestamp, 0, sizeof(tmbTimestamp));
-	tmbTimestamp.tm_isdst = 0;
-	std::istringstream timestampInputStream(timestamp);
-	timestampInputStream >> std::get_time(&tmbTimestamp, "%Y-%m-%dT%H:%M:%S");
-	if (timestampInputStream.fail()) {
+	// Parse date and time
+	const auto year = parseDigits(value, 0, 4);
+	const auto month = parseDigits(value, 5, 2);
+	const auto day = parseDigits(value, 8, 2);
+	const auto hour = parseDigits(value, 11, 2);
+	const auto minute = parseDigits(value, 14, 2);
+	const auto second = parseDigits(value, 17, 2);
+	if (year < 0 || month < 1 || month > 12 || day < 1 || day > daysInMonth(year, month)
+		|| hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 60) {
 		throw std::invalid_argument(std::string("invalid date or time in time field ") + fieldName);
 	}
 
 	// Parse time zone
-	std::tm tmbTimeZone;
-	memset(&tmbTimeZone, 0, sizeof(tmbTimeZone));
-	std::istringstream timeZoneInputStream(timeZone);
-	timeZoneInputStream >> std::get_time(&tmbTimeZone, "%H:%M");
-	if (timestampInputStream.fail()) {
+	const auto tzHour = parseDigits(value, 20, 2);
+	const auto tzMinute = parseDigits(value, 23, 2);
+	if (tzHour < 0 || tzHour > 23 || tzMinute < 0 || tzMinute > 59) {
 		throw std::invalid_argument(std::string("invalid time zone in time field ") + fieldName);
 	}
 
 	// Create GMT time
-	auto t = std::mktime(&tmbTimestamp);
+	const std::time_t t = daysFromCivil(year, month, day) * 86400
+		+ (hour * 60 + minute) * 60 + second;
 	// Apply correction for time zone and return result
-	const int tzOffset = (tzSign == '+' ? -1 : +1) 
-		* (tmbTimeZone.tm_min + 60 * tmbTimeZone.tm_hour) * 60;
+	const int tzOffset = (tzSign == '+' ? -1 : +1) * (tzMinute + 60 * tzHour) * 60;
 	return t + tzOffset;
 }
 
 double ExchangeRateProcessor::parseDoubleField(StringTokenizer& data, const char* fieldName)
 {
-	const auto s = parseStringField(data, fieldName);
-	try {
-		std::size_t pos = 0;
-		const auto v = std::stod(s, &pos);
-		if (pos < s.length()) {
-			throw std::invalid_argument("invalid floating-point number");
-		}
-		return v;
-	} catch (std::exception& ex) {
+	auto s = parseStringField(data, fieldName);
+	// parseDouble() doesn't accept explicit plus sign, skip it
+	if (s.length() > 1 && s[0] == '+') {
+		s.remove_prefix(1);
+	}
+	double v = 0.0;
+	const auto ec = parseDouble(s, v);
+	if (ec != std::errc()) {
 		std::ostringstream err;
-		err << "invalid value of " << fieldName << ": " << ex.what();
+		err << "invalid value of " << fieldName << ": " << (ec == std::errc::result_out_of_range
+			? "floating-point number out of range" : "invalid floating-point number");
 		throw std::invalid_argument(err.str());
 	}
+	return v;
 }
 
-std::size_t ExchangeRateProcessor::addExchangeCurrencyPair(const std::string& exchange,
-	const std::string& currency)
+std::size_t ExchangeRateProcessor::addExchangeCurrencyPair(const std::size_t exchangeId,
+	const std::size_t currencyId)
 {
+	// Make sure mapping has cell for the pair
+	if (exchangeId >= m_exchangeCurrencyPairToIndexMapping.size()) {
+		m_exchangeCurrencyPairToIndexMapping.resize(exchangeId + 1);
+	}
+	auto& row = m_exchangeCurrencyPairToIndexMapping[exchangeId];
+	if (currencyId >= row.size()) {
+		row.resize(m_currencies.size(), INVALID_INDEX);
+	}
+
 	// Try to insert
-	auto pair = std::make_pair(exchange, currency); 
-	const auto pib = m_exchangeCurrencyPairToIndexMapping.insert(std::make_pair(pair,
-		m_exchangeCurrencyPairsByIndex.size()));
-	if (pib.second) {
+	auto& index = row[currencyId];
+	if (index == INVALID_INDEX) {
 		// This is new pair
-		m_exchangeCurrencyPairsByIndex.push_back(std::move(pair));
+		index = m_exchangeCurrencyPairsByIndex.size();
+		m_exchangeCurrencyPairsByIndex.emplace_back(exchangeId, currencyId);
 		extendAdjancencyTable();
 	}
-	return pib.first->second;
+	return index;
 }
 
-std::size_t ExchangeRateProcessor::findExchangeCurrencyPair(const std::string& exchange,
-	const std::string& currency) const
+std::size_t ExchangeRateProcessor::findExchangeCurrencyPair(const std::size_t exchangeId,
+	const std::size_t currencyId) const
 {
-	auto it = m_exchangeCurrencyPairToIndexMapping.find(std::make_pair(exchange, currency));
-	return it == m_exchangeCurrencyPairToIndexMapping.end() 
-		? std::numeric_limits<std::size_t>::max()
-		: it->second;
+	if (exchangeId >= m_exchangeCurrencyPairToIndexMapping.size()) {
+		return INVALID_INDEX;
+	}
+	const auto& row = m_exchangeCurrencyPairToIndexMapping[exchangeId];
+	return currencyId < row.size() ? row[currencyId] : INVALID_INDEX;
 }
 
-void ExchangeRateProcessor::extendAdjancencyTable()
+std::size_t ExchangeRateProcessor::findExchangeCurrencyPair(std::string_view exchange,
+	std::string_view currency) const
 {
-	// Add extra column to all existing rows 
-	for (auto& row: m_adjacencyTable) {
-		row.push_back(std::pair<std::time_t, double>());
+	const auto exchangeId = m_exchanges.find(exchange);
+	const auto currencyId = m_currencies.find(currency);
+	if (exchangeId == SymbolTable::INVALID_ID || currencyId == SymbolTable::INVALID_ID) {
+		return INVALID_INDEX;
 	}
-
-	// Add new row
-	m_adjacencyTable.push_back(std::vector<std::pair<std::time_t, double>>(
-		m_exchangeCurrencyPairsByIndex.size()));
+	return findExchangeCurrencyPair(exchangeId, currencyId);
 }
 
-void ExchangeRateProcessor::provisionNewCurrency(const std::string& currency)
+ExchangeRateProcessor::EdgeCell ExchangeRateProcessor::adjacencyCell(
+	const std::size_t sourceIndex, const std::size_t destinationIndex)
 {
-	// Enumerate all exchanges
-	for (auto it1 = m_exchanges.cbegin(); it1 != m_exchanges.cend(); ++it1) {
-		// Add currency for current exchange
-		const auto& exchange1 = *it1;
-		addExchangeCurrencyPair(exchange1, currency);
+	if (m_options.routingEngine != RoutingEngine::SingleSource) {
+		return EdgeCell{m_adjacencyRates(sourceIndex, destinationIndex),
+			m_adjacencyTimes(sourceIndex, destinationIndex)};
 	}
 
-	// Enumerate all exchanges
-	for (auto it1 = m_exchanges.cbegin(); it1 != m_exchanges.cend(); ++it1) {
-		// Add currency for current exchange
-		const auto& exchange1 = *it1;
-		const auto index1 = findExchangeCurrencyPair(exchange1, currency);
-		// Enumerate "other" exchanges starting from next one to current
-		auto it = it1;
-		for (auto it2 = ++it; it2 != m_exchanges.cend(); ++it2) {
-			const auto& exchange2 = *it2;
-			const auto index2 = findExchangeCurrencyPair(exchange2, currency);
-			// Add edges between same currcies on current and "other" exchanges
-			const auto cellValue = std::make_pair(std::time(nullptr), 1.0);
-			m_adjacencyTable[index1][index2] = cellValue;
-			m_adjacencyTable[index2][index1] = cellValue;
+	// Lookup edge in adjacency list, add it if missing
+	auto& list = m_adjacencyLists[sourceIndex];
+	for (auto& entry : list) {
+		if (entry.destination == destinationIndex) {
+			return EdgeCell{entry.rate, entry.time};
 		}
 	}
+	list.push_back(AdjacencyListEntry{0.0, static_cast<std::uint32_t>(destinationIndex), 0});
+	return EdgeCell{list.back().rate, list.back().time};
 }
 
-void ExchangeRateProcessor::provisionCurrencyForExchange(const std::string& currency,
-	const std::string& exchange)
+double ExchangeRateProcessor::edgeRate(const std::size_t sourceIndex,
+	const std::size_t destinationIndex) const
 {
-	// Add currency for current exchange
-	const auto index1 = addExchangeCurrencyPair(exchange, currency);
+	if (m_options.routingEngine != RoutingEngine::SingleSource) {
+		return m_adjacencyRates(sourceIndex, destinationIndex);
+	}
 
-	// Enumerate "other" exchanges
-	for (const auto& otherExchange: m_exchanges) {
-		if (otherExchange != exchange) {
-			const auto index2 = findExchangeCurrencyPair(otherExchange, currency);
-			// Add edges between same currcies on current and "other" exchanges
-			const auto cellValue = std::make_pair(std::time(nullptr), 1.0);
-			m_adjacencyTable[index1][index2] = cellValue;
-			m_adjacencyTable[index2][index1] = cellValue;
+	for (const auto& entry : m_adjacencyLists[sourceIndex]) {
+		if (entry.destination == destinationIndex) {
+			return entry.rate;
 		}
 	}
+	return 0.0;
 }
 
-std::vector<std::size_t> ExchangeRateProcessor::generateExchangePath(const std::size_t sourceIndex,
+std::time_t ExchangeRateProcessor::edgeTimestamp(const std::size_t sourceIndex,
 	const std::size_t destinationIndex) const
 {
-	// Lookup table of edge weights initialized to 0 for each
-	// (source_vertex, destination_vertex) pair
-	std::vector<std::vector<double>> rate;
-	const auto n = m_adjacencyTable.size();
-	for (std::size_t i = 0; i < n; ++i) {
-		rate.push_back(std::vector<double>(n));
+	if (m_options.routingEngine != RoutingEngine::SingleSource) {
+		return decodeTimestamp(m_adjacencyTimes(sourceIndex, destinationIndex));
 	}
 
-	// Lookup table of vertices initialized to INVALID_INDEX for each
-	// (source_vertex, destination_vertex) pair.
-	std::vector<std::vector<std::size_t>> next;
-	for (std::size_t i = 0; i < n; ++i) {
-		next.push_back(std::vector<std::size_t>(n, INVALID_INDEX));
+	for (const auto& entry : m_adjacencyLists[sourceIndex]) {
+		if (entry.destination == destinationIndex) {
+			return decodeTimestamp(entry.time);
+		}
+	}
+	return std::time_t();
+}
+
+void ExchangeRateProcessor::updateEdge(const std::size_t sourceIndex,
+	const std::size_t destinationIndex, const std::time_t timestamp, const double rate,
+	const bool sameSecondIsNewer)
+{
+	// Ignore outdated rate, also quote which is already too old to be used
+	const auto cell = adjacencyCell(sourceIndex, destinationIndex);
+	const auto storedTimestamp = decodeTimestamp(cell.time);
+	if ((cell.rate != 0.0 && (storedTimestamp > timestamp
+			|| (storedTimestamp == timestamp && !sameSecondIsNewer)))
+		|| (m_options.maxQuoteAge && timestamp < m_streamTime - m_options.maxQuoteAge)) {
+		return;
+	}
+
+	// Remember change, so that cached best rates can be repaired incrementally.
+	// No need to do that if cache is already invalid, it will be fully recomputed anyway.
+	if (m_allPairsValid) {
+		m_pendingEdgeUpdates.push_back(EdgeUpdate{sourceIndex, destinationIndex,
+			cell.rate, rate});
+	}
+
+	cell.rate = rate;
+	cell.time = encodeTimestamp(timestamp);
+	if (m_options.maxQuoteAge) {
+		m_edgeExpiries.push(EdgeExpiry{timestamp + m_options.maxQuoteAge, timestamp,
+			sourceIndex, destinationIndex});
+	}
+}
+
+void ExchangeRateProcessor::expireStaleEdges()
+{
+	// Quote expires when its age exceeds maxQuoteAge
+	while (!m_edgeExpiries.empty() && m_edgeExpiries.top().expiryTime < m_streamTime) {
+		const auto expiry = m_edgeExpiries.top();
+		m_edgeExpiries.pop();
+
+		// Skip entry if edge was updated after it was indexed
+		const auto cell = adjacencyCell(expiry.source, expiry.destination);
+		if (cell.rate == 0.0 || decodeTimestamp(cell.time) != expiry.timestamp) {
+			continue;
+		}
+
+		// Removed edge is the same as rate dropped to 0 for cached best rates
+		if (m_allPairsValid) {
+			m_pendingEdgeUpdates.push_back(EdgeUpdate{expiry.source, expiry.destination,
+				cell.rate, 0.0});
+		}
+		cell.rate = 0.0;
+	}
+}
+
+void ExchangeRateProcessor::setEdgeRate(const std::size_t sourceIndex,
+	const std::size_t destinationIndex, const double rate)
+{
+	const auto cell = adjacencyCell(sourceIndex, destinationIndex);
+	if (m_allPairsValid && cell.rate != rate) {
+		m_pendingEdgeUpdates.push_back(EdgeUpdate{sourceIndex, destinationIndex,
+			cell.rate, rate});
+	}
+	cell.rate = rate;
+}
+
+void ExchangeRateProcessor::extendAdjancencyTable()
+{
+	// Vertex indices are stored as 32-bit values
+	if (m_exchangeCurrencyPairsByIndex.size() > MAX_VERTEX_COUNT) {
+		throw std::length_error("too many exchange/currency pairs");
+	}
+
+	// In single-source mode just add empty adjacency list for new vertex
+	if (m_options.routingEngine == RoutingEngine::SingleSource) {
+		m_adjacencyLists.emplace_back();
+		return;
+	}
+
+	// Add extra column and row, storage grows geometrically
+	m_adjacencyRates.extend(0.0);
+	m_adjacencyTimes.extend(0);
+}
+
+void ExchangeRateProcessor::provisionNewCurrency(const std::size_t currencyId,
+	const std::time_t timestamp)
+{
+	// Add currency for all exchanges and connect them through hub of the currency
+	const auto hubIndex = addTransferHub(currencyId);
+	for (std::size_t exchangeId = 0; exchangeId < m_exchanges.size(); ++exchangeId) {
+		const auto index = addExchangeCurrencyPair(exchangeId, currencyId);
+		connectToTransferHub(index, hubIndex, timestamp);
 	}
+}
+
+void ExchangeRateProcessor::provisionCurrencyForExchange(const std::size_t currencyId,
+	const std::size_t exchangeId, const std::time_t timestamp)
+{
+	// Add currency for current exchange, transfers to and from other
+	// exchanges listing it go through hub of the currency
+	const auto index = addExchangeCurrencyPair(exchangeId, currencyId);
+	connectToTransferHub(index, m_transferHubs[currencyId], timestamp);
+}
+
+std::size_t ExchangeRateProcessor::provisionExchangeCurrencyPair(
+	const std::pair<std::size_t, bool>& exchange, const std::pair<std::size_t, bool>& currency,
+	const std::time_t timestamp)
+{
+	if (exchange.second || currency.second) {
+		// Graph is about to get new vertices, cached best rates become obsolete
+		m_allPairsValid = false;
+	}
+
+	if (currency.second) {
+		// Brand new currency
+		provisionNewCurrency(currency.first, timestamp);
+	} else if (findExchangeCurrencyPair(exchange.first, currency.first) == INVALID_INDEX) {
+		// Currency is already known, but not yet traded on this exchange,
+		// so provision currency for it
+		m_allPairsValid = false;
+		provisionCurrencyForExchange(currency.first, exchange.first, timestamp);
+	}
+	return findExchangeCurrencyPair(exchange.first, currency.first);
+}
+
+std::time_t ExchangeRateProcessor::provisioningTime() const
+{
+	// Timestamps of edges must be in supported range
+	return std::max(m_streamTime, TIMESTAMP_BASE);
+}
+
+std::size_t ExchangeRateProcessor::addTransferHub(const std::size_t currencyId)
+{
+	if (currencyId >= m_transferHubs.size()) {
+		m_transferHubs.resize(currencyId + 1, INVALID_INDEX);
+	}
+	const auto index = m_exchangeCurrencyPairsByIndex.size();
+	m_exchangeCurrencyPairsByIndex.emplace_back(SymbolTable::INVALID_ID, currencyId);
+	extendAdjancencyTable();
+	m_transferHubs[currencyId] = index;
+	return index;
+}
 
-	// Fill "rate" and "next"
+void ExchangeRateProcessor::connectToTransferHub(const std::size_t index,
+	const std::size_t hubIndex, const std::time_t timestamp)
+{
+	const auto time = encodeTimestamp(timestamp);
+	const auto exitCell = adjacencyCell(index, hubIndex);
+	exitCell.rate = 1.0;
+	exitCell.time = time;
+	const auto entryCell = adjacencyCell(hubIndex, index);
+	entryCell.rate = 1.0;
+	entryCell.time = time;
+}
+
+void ExchangeRateProcessor::updateAllPairsBestRates()
+{
+	// Try to repair cached best rates using changed edges only
+	if (m_allPairsValid) {
+		if (m_pendingEdgeUpdates.empty()) {
+			// Nothing to do, graph didn't change since last computation
+			return;
+		}
+		if (applyPendingEdgeUpdates()) {
+			return;
+		}
+	}
+	m_pendingEdgeUpdates.clear();
+
+	// "rate" table starts as copy of edge rates, "next" table points to
+	// destination of every present edge, which is single hop.
+	// Already allocated buffers are reused.
+	const auto n = m_adjacencyRates.size();
+	m_rate.copyCellsFrom(m_adjacencyRates, 0.0);
+	m_next.assign(n, NO_NEXT_VERTEX);
+	m_hops.assign(n, 0);
 	for (std::size_t i = 0; i < n; ++i) {
-		const auto& sourceRow = m_adjacencyTable[i];
-		auto& destinationRow = rate[i];
-		auto& nextRow = next[i];
+		const auto rateRow = m_rate.row(i);
+		const auto nextRow = m_next.row(i);
+		const auto hopsRow = m_hops.row(i);
 		for (std::size_t j = 0; j < n; ++j) {
-			const auto& sourceCell = sourceRow[j];
-			// nonzero timestamp in 'first' is indicator of edge presence
-			if (sourceCell.first) {
-				destinationRow[j] = sourceCell.second;
-				nextRow[j] = j;
+			if (rateRow[j] != 0.0) {
+				nextRow[j] = static_cast<NextVertex>(j);
+				hopsRow[j] = 1;
 			}
 		}
 	}
 
 	// Modified Floyd-Warsall implementation
+	computeBestRates(m_rate, m_next, m_hops, m_threadPool.get());
+
+	m_hasPositiveCycle = detectPositiveCycle();
+	m_allPairsValid = true;
+}
+
+bool ExchangeRateProcessor::applyPendingEdgeUpdates()
+{
+	// Incremental repair costs O(n^2) per edge, so it pays off only
+	// while number of changed edges is below number of vertices.
+	// Also it is not applicable if graph contains positive cycle,
+	// Floyd-Warsall result depends on evaluation order in this case.
+	const auto n = m_adjacencyRates.size();
+	if (m_hasPositiveCycle || m_pendingEdgeUpdates.size() >= n) {
+		return false;
+	}
+
+	// Rate got worse. If old edge was not tight (i.e. best rate between
+	// its ends is achieved by other path which is better beyond tolerance),
+	// no best path can go over it, so cached result stays valid. Otherwise
+	// cells whose best paths may use it are repaired, before any improved
+	// edge is relaxed.
+	std::vector<std::vector<std::size_t>> affectedColumns;
+	std::size_t affectedCount = 0;
+	for (const auto& update : m_pendingEdgeUpdates) {
+		if (update.newRate < update.oldRate && update.oldRate * RATE_TOLERANCE_FACTOR
+			>= m_rate(update.source, update.destination)) {
+			affectedColumns.resize(n);
+			affectedCount += markCellsUsingEdge(update.source, update.destination,
+				update.oldRate, affectedColumns);
+			if (affectedCount > n * n / MAX_REPAIRED_CELLS_DIVISOR) {
+				return false;
+			}
+		}
+	}
+	if (affectedCount && !repairBestRateCells(affectedColumns)) {
+		return false;
+	}
+
+	// Edge may change more than once, relax it with its current rate
+	for (const auto& update : m_pendingEdgeUpdates) {
+		if (update.newRate > update.oldRate) {
+			const auto rate = edgeRate(update.source, update.destination);
+			if (rate != 0.0) {
+				relaxEdge(update.source, update.destination, rate);
+			}
+		}
+	}
+	m_pendingEdgeUpdates.clear();
+
+	// Improved edge can close positive cycle, full recomputation is needed then
+	return !(m_hasPositiveCycle = detectPositiveCycle());
+}
+
+void ExchangeRateProcessor::relaxEdge(const std::size_t sourceIndex,
+	const std::size_t destinationIndex, const double rate)
+{
+	// Check for every (i, j) pair whether path i -> ... -> source -> destination -> ... -> j
+	// is better than current best path. Head and tail of path are best paths
+	// from cached tables, empty when i is source or j is destination.
+	const auto n = m_adjacencyRates.size();
+	const auto destinationRateRow = m_rate.row(destinationIndex);
+	const auto destinationHopsRow = m_hops.row(destinationIndex);
+	for (std::size_t i = 0; i < n; ++i) {
+		const auto rateRow = m_rate.row(i);
+		const auto nextRow = m_next.row(i);
+		const auto hopsRow = m_hops.row(i);
+		const auto headRate = i == sourceIndex ? 1.0 : rateRow[sourceIndex];
+		if (headRate == 0.0) {
+			// There is no path from i to source
+			continue;
+		}
+		const auto headNext = i == sourceIndex ? static_cast<NextVertex>(destinationIndex)
+			: nextRow[sourceIndex];
+		const auto headAndEdgeRate = headRate * rate;
+		const HopCount headAndEdgeHops = (i == sourceIndex ? 0 : hopsRow[sourceIndex]) + 1;
+		for (std::size_t j = 0; j < n; ++j) {
+			const bool tail = j != destinationIndex;
+			const auto newR = headAndEdgeRate * (tail ? destinationRateRow[j] : 1.0);
+			const auto newHops = headAndEdgeHops + (tail ? destinationHopsRow[j] : 0);
+			if (isBetterPath(newR, newHops, rateRow[j], hopsRow[j])) {
+				rateRow[j] = newR;
+				nextRow[j] = headNext;
+				hopsRow[j] = newHops;
+			}
+		}
+	}
+}
+
+std::size_t ExchangeRateProcessor::markCellsUsingEdge(const std::size_t sourceIndex,
+	const std::size_t destinationIndex, const double rate,
+	std::vector<std::vector<std::size_t>>& affectedColumns) const
+{
+	// Cell (i, j) is affected if path i -> ... -> source -> destination -> ... -> j
+	// has its best rate, like in relaxEdge()
+	const auto n = m_adjacencyRates.size();
+	const auto destinationRateRow = m_rate.row(destinationIndex);
+	std::size_t count = 0;
+	for (std::size_t i = 0; i < n; ++i) {
+		const auto rateRow = m_rate.row(i);
+		const auto headRate = i == sourceIndex ? 1.0 : rateRow[sourceIndex];
+		if (headRate == 0.0) {
+			continue;
+		}
+		const auto headAndEdgeRate = headRate * rate;
+		for (std::size_t j = 0; j < n; ++j) {
+			const auto tailRate = j == destinationIndex ? 1.0 : destinationRateRow[j];
+			const auto pathRate = headAndEdgeRate * tailRate;
+			if (pathRate != 0.0 && pathRate * RATE_TOLERANCE_FACTOR >= rateRow[j]) {
+				affectedColumns[i].push_back(j);
+				++count;
+			}
+		}
+	}
+	return count;
+}
+
+bool ExchangeRateProcessor::repairBestRateCells(
+	std::vector<std::vector<std::size_t>>& affectedColumns)
+{
+	const auto n = m_adjacencyRates.size();
+
+	// Searches use only edges ending in affected columns. Collect them in one
+	// sequential pass over adjacency table, random access to it is much slower.
+	std::vector<bool> isAffectedColumn(n, false);
+	for (auto& columns : affectedColumns) {
+		std::sort(columns.begin(), columns.end());
+		columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
+		for (const auto j : columns) {
+			isAffectedColumn[j] = true;
+		}
+	}
+	struct Edge {
+		std::size_t vertex;
+		double rate;
+	};
+	std::vector<std::vector<Edge>> predecessors(n);
+	std::vector<std::vector<Edge>> successors(n);
 	for (std::size_t k = 0; k < n; ++k) {
-		auto& rateKRow = rate[k];
-		for (std::size_t i = 0; i < n; ++i) {
-			auto& rateRow = rate[i];
-			auto& nextRow = next[i];
-			for (std::size_t j = 0; j < n; ++j) {
-				auto& r = rateRow[j];
-				const auto newR = rateRow[k] * rateKRow[j];
-				if (r < newR) {
-					r = newR;
-					nextRow[j] = nextRow[k];
+		const auto adjacencyRow = m_adjacencyRates.row(k);
+		for (std::size_t j = 0; j < n; ++j) {
+			if (isAffectedColumn[j] && adjacencyRow[j] != 0.0) {
+				predecessors[j].push_back(Edge{k, adjacencyRow[j]});
+				successors[k].push_back(Edge{j, adjacencyRow[j]});
+			}
+		}
+	}
+
+	// Search state of one thread, rows are split between threads
+	struct SearchState {
+		std::vector<bool> affected;
+		std::vector<bool> settled;
+		std::vector<double> potential;
+		std::vector<std::pair<double, std::size_t>> queue;
+	};
+	const auto threadCount = m_threadPool ? m_threadPool->threadCount() : 1;
+	std::vector<SearchState> states(threadCount);
+	for (auto& state : states) {
+		state.affected.assign(n, false);
+		state.settled.assign(n, false);
+		state.potential.assign(n, 0.0);
+	}
+	std::atomic<bool> failed(false);
+	const auto repairRows = [&](const std::size_t thread) {
+		auto& state = states[thread];
+		for (auto i = thread; i < n && !failed; i += threadCount) {
+			const auto& columns = affectedColumns[i];
+			if (columns.empty()) {
+				continue;
+			}
+
+			// Dijkstra search needs factors not above 1. Best rates from source
+			// before the change, p(v), turn factor of every edge (u, v) into
+			// w(u, v) * p(u) / p(v) <= 1 and keep order of paths to any vertex.
+			// They stay valid for worsened edges; improved edge may break them,
+			// that is detected below.
+			const auto rateRow = m_rate.row(i);
+			const auto nextRow = m_next.row(i);
+			const auto hopsRow = m_hops.row(i);
+			for (const auto j : columns) {
+				state.affected[j] = true;
+				state.potential[j] = rateRow[j];
+				rateRow[j] = 0.0;
+				nextRow[j] = NO_NEXT_VERTEX;
+				hopsRow[j] = 0;
+			}
+
+			// Rates of cells which are not affected are still best ones. Best path
+			// to affected vertex enters affected set from source or from such vertex
+			// last, start with these entries. Source itself is entered with empty path.
+			for (const auto j : columns) {
+				for (const auto& edge : predecessors[j]) {
+					const auto k = edge.vertex;
+					if (k != i && (state.affected[k] || rateRow[k] == 0.0)) {
+						continue;
+					}
+					const auto newRate = (k == i ? 1.0 : rateRow[k]) * edge.rate;
+					const HopCount newHops = (k == i ? 0 : hopsRow[k]) + 1;
+					if (isBetterPath(newRate, newHops, rateRow[j], hopsRow[j])) {
+						rateRow[j] = newRate;
+						nextRow[j] = k == i ? static_cast<NextVertex>(j) : nextRow[k];
+						hopsRow[j] = newHops;
+					}
+				}
+				if (rateRow[j] != 0.0) {
+					state.queue.emplace_back(rateRow[j] / state.potential[j], j);
+				}
+			}
+			std::make_heap(state.queue.begin(), state.queue.end());
+
+			// Dijkstra search within affected set, queue entries of improved
+			// vertices are left in place and skipped. Cell of source itself
+			// holds rate of cycle, it is not extended further. Tie with fewer
+			// hops replaces path of vertex until the vertex is settled.
+			while (!state.queue.empty()) {
+				std::pop_heap(state.queue.begin(), state.queue.end());
+				const auto u = state.queue.back().second;
+				state.queue.pop_back();
+				if (state.settled[u]) {
+					continue;
+				}
+				state.settled[u] = true;
+				if (u == i) {
+					continue;
+				}
+				for (const auto& edge : successors[u]) {
+					const auto v = edge.vertex;
+					const auto newRate = rateRow[u] * edge.rate;
+					const HopCount newHops = hopsRow[u] + 1;
+					if (!state.affected[v]
+						|| !isBetterPath(newRate, newHops, rateRow[v], hopsRow[v])) {
+						continue;
+					}
+					if (state.settled[v]) {
+						// Potential is not valid for changed graph if rate improved
+						if (rateRow[v] * RATE_TOLERANCE_FACTOR < newRate) {
+							failed = true;
+						}
+						continue;
+					}
+					rateRow[v] = newRate;
+					nextRow[v] = nextRow[u];
+					hopsRow[v] = newHops;
+					state.queue.emplace_back(newRate / state.potential[v], v);
+					std::push_heap(state.queue.begin(), state.queue.end());
 				}
 			}
+			for (const auto j : columns) {
+				state.affected[j] = false;
+				state.settled[j] = false;
+			}
 		}
+	};
+	if (m_threadPool) {
+		m_threadPool->run(threadCount, repairRows);
+	} else {
+		repairRows(0);
 	}
+	return !failed;
+}
+
+bool ExchangeRateProcessor::detectPositiveCycle() const
+{
+	// Best rate from vertex to itself above 1 means there is profitable cycle.
+	// Rate 1 computed with rounding error is not a profit.
+	for (std::size_t i = 0; i < m_rate.size(); ++i) {
+		if (m_rate(i, i) > RATE_TOLERANCE_FACTOR) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void ExchangeRateProcessor::generateExchangePath(const std::size_t sourceIndex,
+	const std::size_t destinationIndex, std::vector<std::size_t>& path,
+	ScratchArena& scratch) const
+{
 
 #ifdef _DEBUG
 	std::cerr << std::endl << "Finding path from " << sourceIndex << " to " << destinationIndex << std::endl;
 	printAdjacencyTable();
-	printFloydWarsallTables(rate, next);
+	printFloydWarsallTables(m_rate, m_next);
 #endif
 
+	// Profitable cycles make best rates unbounded and "next" table may lead
+	// into a loop, answer with best simple path then
+	if (m_hasPositiveCycle) {
+		findBestSimplePath(sourceIndex, destinationIndex, path, scratch);
+		return;
+	}
+
 	// Construct path
-	std::vector<std::size_t> path;
-	std::unordered_set<std::size_t> visited;
-	if (next[sourceIndex][destinationIndex] != INVALID_INDEX) {
+	std::size_t loopVertex = INVALID_INDEX;
+	if (!reconstructPath(m_next, sourceIndex, destinationIndex, path, loopVertex)) {
+		// Ties over cycles of rate 1 (e.g. buying and selling at the same
+		// price) may still make "next" table loop. Best rates are exact,
+		// build path from single source tree then.
+		generateExchangePathSingleSource(sourceIndex, destinationIndex, path, scratch);
+	}
+}
+
+void ExchangeRateProcessor::generateExchangePathSingleSource(const std::size_t sourceIndex,
+	const std::size_t destinationIndex, std::vector<std::size_t>& path,
+	ScratchArena& scratch) const
+{
+	ScratchArena::Scope scope(scratch);
+	auto previous = makeScratchVector<std::size_t>(scratch);
+	if (computeSingleSourceTree(sourceIndex, previous, scratch)) {
+		extractPath(previous, sourceIndex, destinationIndex, path);
+	} else {
+		findBestSimplePath(sourceIndex, destinationIndex, path, scratch);
+	}
+}
+
+bool ExchangeRateProcessor::computeSingleSourceTree(const std::size_t sourceIndex,
+	ScratchVector<std::size_t>& previous, ScratchArena& scratch) const
+{
+	// Best rate path maximizes product of rates, which is the same as
+	// shortest path with edge weights -log(rate). Weights can be negative,
+	// so use SPFA (queue-based Bellman-Ford) which also detects negative
+	// cycles, i.e. profitable exchange cycles. Distances equal within
+	// tolerance are a tie, path with fewer hops wins it as in all-pairs tables.
+	// "previous" is sized before scope of search arrays opens, as it outlives them.
+	const auto n = m_exchangeCurrencyPairsByIndex.size();
+	previous.assign(n, INVALID_INDEX);
+	ScratchArena::Scope scope(scratch);
+	auto distance = makeScratchVector(scratch, n, std::numeric_limits<double>::infinity());
+	auto hops = makeScratchVector(scratch, n, HopCount(0));
+	auto relaxCount = makeScratchVector(scratch, n, std::size_t(0));
+	auto queued = makeScratchVector(scratch, n, false);
+
+	// Checks whether vertex is on path from source to u. Predecessors of
+	// profitable cycle loop, so walk longer than any path counts as match.
+	const auto onPath = [&](std::size_t v, std::size_t u) {
+		for (std::size_t length = 0; u != INVALID_INDEX; u = previous[u]) {
+			if (u == v || ++length > n) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	// Vertex is queued at most once at a time, so queue is ring buffer of n entries
+	auto queue = makeScratchVector(scratch, n, std::size_t(0));
+	std::size_t queueHead = 0;
+	std::size_t queueSize = 0;
+
+	distance[sourceIndex] = 0.0;
+	queue[queueSize++] = sourceIndex;
+	queued[sourceIndex] = true;
+	bool negativeCycle = false;
+	while (queueSize && !negativeCycle) {
+		const auto u = queue[queueHead];
+		queueHead = queueHead + 1 == n ? 0 : queueHead + 1;
+		--queueSize;
+		queued[u] = false;
+		forEachEdge(u, [&](const std::size_t v, const double rate) {
+			if (negativeCycle) {
+				return;
+			}
+			const auto newDistance = distance[u] - std::log(rate);
+			const HopCount newHops = hops[u] + 1;
+			const bool improved = newDistance < distance[v] - LOG_RATE_TOLERANCE;
+			// Tie never attaches vertex to path which contains it
+			if (!improved && (newDistance > distance[v] + LOG_RATE_TOLERANCE
+				|| newHops >= hops[v] || onPath(v, u))) {
+				return;
+			}
+			distance[v] = newDistance;
+			previous[v] = u;
+			hops[v] = newHops;
+			// Vertex distance can't improve more than n-1 times
+			// unless there is negative cycle reachable from source
+			if (improved && ++relaxCount[v] >= n) {
+				negativeCycle = true;
+			} else if (!queued[v]) {
+				queue[(queueHead + queueSize++) % n] = v;
+				queued[v] = true;
+			}
+		});
+	}
+	return !negativeCycle;
+}
+
+void ExchangeRateProcessor::extractPath(const ScratchVector<std::size_t>& previous,
+	const std::size_t sourceIndex, const std::size_t destinationIndex,
+	std::vector<std::size_t>& path)
+{
+	// Construct path by going back from destination
+	path.clear();
+	if (sourceIndex == destinationIndex || previous[destinationIndex] != INVALID_INDEX) {
+		for (auto u = destinationIndex; u != sourceIndex; u = previous[u]) {
+			path.push_back(u);
+		}
 		path.push_back(sourceIndex);
-		visited.insert(sourceIndex);
-		auto u = sourceIndex;
-		while (u != destinationIndex) {
-			u = next[u][destinationIndex];
-			if (visited.count(u) > 0) {
-				// OOPS, there is an endless loop over cycle
-				std::cerr << "Warning: endless loop over cycle detected: ";
-				const auto& pair = m_exchangeCurrencyPairsByIndex[u];
-				std::cerr << "starting with: " << u << " (" << pair.first << '/' << pair.second
-					<< "), path: ";
-				bool first = true;
-				for (const auto index : path) {
-					const auto& pair = m_exchangeCurrencyPairsByIndex[index];
-					if (first) {
-						first = false;
-					} else {
-						std::cerr << " -> ";
-					}
-					std::cerr << index << " (" << pair.first << '/' << pair.second
-						<< ')';
-				}
-				std::cerr << std::endl;
+		std::reverse(path.begin(), path.end());
+	}
+}
+
+bool ExchangeRateProcessor::findArbitrage(ArbitrageCycle& cycle)
+{
+	expireStaleEdges();
+	if (m_options.routingEngine == RoutingEngine::AllPairs) {
+		// Diagonal of best rates is maintained with every update, cycle itself
+		// is looked for only if it shows there is one
+		updateAllPairsBestRates();
+		if (!m_hasPositiveCycle) {
+			return false;
+		}
+	}
+	return findProfitableCycle(cycle);
+}
+
+bool ExchangeRateProcessor::findProfitableCycle(ArbitrageCycle& cycle) const
+{
+	// Virtual source connected to every vertex: all distances start at 0
+	const auto n = m_exchangeCurrencyPairsByIndex.size();
+	std::vector<double> distance(n, 0.0);
+	std::vector<std::size_t> previous(n, INVALID_INDEX);
+	std::vector<std::size_t> relaxCount(n, 0);
+	std::vector<bool> queued(n, true);
+	std::deque<std::size_t> queue;
+	for (std::size_t i = 0; i < n; ++i) {
+		queue.push_back(i);
+	}
+
+	// Looks for cycle in predecessor graph going back from given vertex.
+	// Any such cycle has negative weight.
+	const auto extractCycle = [&](std::size_t v) {
+		// After n steps back we are inside cycle, unless chain ends
+		for (std::size_t step = 0; step < n; ++step) {
+			v = previous[v];
+			if (v == INVALID_INDEX) {
+				return false;
+			}
+		}
+		cycle.path.clear();
+		auto u = v;
+		do {
+			cycle.path.push_back(u);
+			u = previous[u];
+		} while (u != v);
+		cycle.path.push_back(v);
+		std::reverse(cycle.path.begin(), cycle.path.end());
+		return true;
+	};
+
+	bool found = false;
+	while (!queue.empty() && !found) {
+		const auto u = queue.front();
+		queue.pop_front();
+		queued[u] = false;
+		forEachEdge(u, [&](const std::size_t v, const double rate) {
+			// Gain within rate tolerance is rounding noise, not a profit
+			const auto newDistance = distance[u] - std::log(rate);
+			if (found || !(newDistance < distance[v] - LOG_RATE_TOLERANCE)) {
+				return;
+			}
+			distance[v] = newDistance;
+			previous[v] = u;
+			// Vertex distance can't improve n times without negative cycle
+			if (++relaxCount[v] >= n && extractCycle(v)) {
+				found = true;
+				return;
+			}
+			if (!queued[v]) {
+				queue.push_back(v);
+				queued[v] = true;
+			}
+		});
+	}
+	if (!found) {
+		return false;
+	}
+
+	cycle.rate = pathRate(cycle.path.data(), cycle.path.size());
+	return true;
+}
+
+void ExchangeRateProcessor::findBestSimplePath(const std::size_t sourceIndex,
+	const std::size_t destinationIndex, std::vector<std::size_t>& path,
+	ScratchArena& scratch) const
+{
+	const auto n = m_exchangeCurrencyPairsByIndex.size();
+	ScratchArena::Scope scope(scratch);
+	auto rate = makeScratchVector(scratch, n, 0.0);
+	auto previous = makeScratchVector(scratch, n, INVALID_INDEX);
+	auto relaxCount = makeScratchVector(scratch, n, std::size_t(0));
+	auto queued = makeScratchVector(scratch, n, false);
+
+	// Checks whether vertex is on path from source to u
+	const auto onPath = [&](std::size_t v, std::size_t u) {
+		for (; u != INVALID_INDEX; u = previous[u]) {
+			if (u == v) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	// Vertex is queued at most once at a time, so queue is ring buffer of n entries
+	auto queue = makeScratchVector(scratch, n, std::size_t(0));
+	std::size_t queueHead = 0;
+	std::size_t queueSize = 0;
+
+	rate[sourceIndex] = 1.0;
+	queue[queueSize++] = sourceIndex;
+	queued[sourceIndex] = true;
+	while (queueSize) {
+		const auto u = queue[queueHead];
+		queueHead = queueHead + 1 == n ? 0 : queueHead + 1;
+		--queueSize;
+		queued[u] = false;
+		forEachEdge(u, [&](const std::size_t v, const double edgeRate) {
+			// Predecessors always form tree rooted at source: v is attached
+			// only to path which doesn't contain it
+			const auto newRate = rate[u] * edgeRate;
+			if (newRate <= rate[v] || onPath(v, u)) {
+				return;
+			}
+			rate[v] = newRate;
+			previous[v] = u;
+			// Limit number of improvements, like Bellman-Ford does
+			if (++relaxCount[v] < n && !queued[v]) {
+				queue[(queueHead + queueSize++) % n] = v;
+				queued[v] = true;
+			}
+		});
+	}
+
+	extractPath(previous, sourceIndex, destinationIndex, path);
+	if (path.empty() || sourceIndex == destinationIndex) {
+		return;
+	}
+	double bestRate = 1.0;
+	for (std::size_t i = 1; i < path.size(); ++i) {
+		bestRate *= edgeRate(path[i - 1], path[i]);
+	}
+
+	// Improve result with exhaustive depth-first enumeration of simple paths,
+	// which is exact for small graphs. Amount of work is bounded, edges are
+	// tried in order of decreasing rate, so good paths come first.
+	// Edges of vertex u are edges[edgeStart[u]] to edges[edgeStart[u + 1] - 1].
+	auto edgeStart = makeScratchVector(scratch, n + 1, std::size_t(0));
+	for (std::size_t u = 0; u < n; ++u) {
+		edgeStart[u + 1] = edgeStart[u];
+		forEachEdge(u, [&](std::size_t, double) {
+			++edgeStart[u + 1];
+		});
+	}
+	auto edges = makeScratchVector(scratch, edgeStart[n], std::make_pair(0.0, std::size_t(0)));
+	for (std::size_t u = 0; u < n; ++u) {
+		auto edge = edges.begin() + edgeStart[u];
+		forEachEdge(u, [&](const std::size_t v, const double edgeRate) {
+			*edge++ = std::make_pair(edgeRate, v);
+		});
+		std::sort(edges.begin() + edgeStart[u], edge, std::greater<std::pair<double, std::size_t>>());
+	}
+
+	// Simple path has at most n vertices, stack never reallocates
+	struct Frame {
+		std::size_t vertex;
+		double rate;
+		std::size_t nextEdge;
+	};
+	auto stack = makeScratchVector<Frame>(scratch);
+	stack.reserve(n);
+	auto onStack = makeScratchVector(scratch, n, false);
+	stack.push_back(Frame{sourceIndex, 1.0, edgeStart[sourceIndex]});
+	onStack[sourceIndex] = true;
+	std::size_t budget = SIMPLE_PATH_SEARCH_BUDGET;
+	while (!stack.empty() && budget > 0) {
+		auto& frame = stack.back();
+		if (frame.vertex == destinationIndex || frame.nextEdge == edgeStart[frame.vertex + 1]) {
+			if (frame.vertex == destinationIndex && frame.rate > bestRate) {
+				bestRate = frame.rate;
 				path.clear();
-				break;
+				for (const auto& f : stack) {
+					path.push_back(f.vertex);
+				}
+			}
+			onStack[frame.vertex] = false;
+			stack.pop_back();
+			continue;
+		}
+		--budget;
+		const auto& edge = edges[frame.nextEdge++];
+		if (!onStack[edge.second]) {
+			onStack[edge.second] = true;
+			stack.push_back(Frame{edge.second, frame.rate * edge.first, edgeStart[edge.second]});
+		}
+	}
+}
+
+void ExchangeRateProcessor::findHopBoundedPath(const std::size_t sourceIndex,
+	const std::size_t destinationIndex, const std::size_t maxHops,
+	const ScratchVector<bool>& blocked, const ScratchVector<std::size_t>& blockedSuccessors,
+	ScratchVector<std::size_t>& path, ScratchArena& scratch) const
+{
+	path.clear();
+	if (sourceIndex == destinationIndex) {
+		path.push_back(sourceIndex);
+		return;
+	}
+
+	// Simple path has at most n - 1 hops
+	const auto n = m_exchangeCurrencyPairsByIndex.size();
+	const auto hopLimit = maxHops ? std::min(maxHops, n - 1) : n - 1;
+
+	// Best rates are updated in place, but level h extends only paths found
+	// at level h - 1: vertices improved there and their rates at that time.
+	// Transfer between exchanges goes through hub and counts as single hop,
+	// so hubs improved at level h are extended at the same level.
+	// Every improvement is recorded as (level, predecessor) for path reconstruction,
+	// records of vertex are linked from the latest one.
+	struct Improvement {
+		std::size_t level;
+		std::size_t predecessor;
+		std::size_t earlier;
+	};
+	ScratchArena::Scope scope(scratch);
+	auto rate = makeScratchVector(scratch, n, 0.0);
+	auto latestImprovement = makeScratchVector(scratch, n, INVALID_INDEX);
+	auto improvements = makeScratchVector<Improvement>(scratch);
+	improvements.reserve(n);
+
+	// Vertex enters next frontier at most once per level
+	auto frontier = makeScratchVector<std::pair<std::size_t, double>>(scratch);
+	auto nextFrontier = makeScratchVector<std::pair<std::size_t, double>>(scratch);
+	auto hubs = makeScratchVector<std::size_t>(scratch);
+	frontier.reserve(n);
+	nextFrontier.reserve(n);
+	hubs.reserve(n);
+	auto inNextFrontier = makeScratchVector(scratch, n, false);
+	std::size_t level = 0;
+	const auto relaxEdges = [&](const std::size_t u, const double rateU) {
+		forEachEdge(u, [&](const std::size_t v, const double edgeRate) {
+			if (blocked[v] || (u == sourceIndex && std::find(blockedSuccessors.begin(),
+				blockedSuccessors.end(), v) != blockedSuccessors.end())) {
+				return;
+			}
+			const auto newRate = rateU * edgeRate;
+			if (rate[v] * RATE_TOLERANCE_FACTOR >= newRate) {
+				return;
+			}
+			rate[v] = newRate;
+			const auto latest = latestImprovement[v];
+			if (latest != INVALID_INDEX && improvements[latest].level == level) {
+				improvements[latest].predecessor = u;
+			} else {
+				latestImprovement[v] = improvements.size();
+				improvements.push_back(Improvement{level, u, latest});
+			}
+			if (!inNextFrontier[v]) {
+				inNextFrontier[v] = true;
+				if (isTransferHub(v)) {
+					hubs.push_back(v);
+				} else {
+					nextFrontier.emplace_back(v, 0.0);
+				}
+			}
+		});
+	};
+	rate[sourceIndex] = 1.0;
+	frontier.emplace_back(sourceIndex, 1.0);
+	for (level = 1; level <= hopLimit && !frontier.empty(); ++level) {
+		for (const auto& entry : frontier) {
+			relaxEdges(entry.first, entry.second);
+		}
+		for (const auto hub : hubs) {
+			relaxEdges(hub, rate[hub]);
+			inNextFrontier[hub] = false;
+		}
+		hubs.clear();
+		frontier.swap(nextFrontier);
+		nextFrontier.clear();
+		for (auto& entry : frontier) {
+			entry.second = rate[entry.first];
+			inNextFrontier[entry.first] = false;
+		}
+	}
+	if (latestImprovement[destinationIndex] == INVALID_INDEX) {
+		return;
+	}
+
+	// Go back from destination: predecessor of vertex reached with at most
+	// h hops is taken from its latest improvement at level h or below
+	auto walk = makeScratchVector<std::size_t>(scratch);
+	walk.push_back(destinationIndex);
+	level = hopLimit;
+	for (auto v = destinationIndex; v != sourceIndex;) {
+		auto record = latestImprovement[v];
+		while (improvements[record].level > level) {
+			record = improvements[record].earlier;
+		}
+		v = improvements[record].predecessor;
+		level = isTransferHub(v) ? improvements[record].level : improvements[record].level - 1;
+		walk.push_back(v);
+	}
+
+	// Only profitable cycles make best walk visit vertex twice,
+	// cut them out to keep path loopless
+	auto position = makeScratchVector(scratch, n, INVALID_INDEX);
+	for (auto it = walk.rbegin(); it != walk.rend(); ++it) {
+		const auto v = *it;
+		if (position[v] != INVALID_INDEX) {
+			for (auto i = position[v] + 1; i < path.size(); ++i) {
+				position[path[i]] = INVALID_INDEX;
+			}
+			path.resize(position[v] + 1);
+			continue;
+		}
+		position[v] = path.size();
+		path.push_back(v);
+	}
+}
+
+std::size_t ExchangeRateProcessor::findBestPaths(const std::size_t sourceIndex,
+	const std::size_t destinationIndex, const std::size_t maxHops, const std::size_t pathCount,
+	std::vector<std::vector<std::size_t>>& paths, ScratchArena& scratch) const
+{
+	// Unconstrained best path is the same as for plain request.
+	// Spur path storage is reserved before searches open their scopes.
+	const auto n = m_exchangeCurrencyPairsByIndex.size();
+	ScratchArena::Scope scope(scratch);
+	auto blocked = makeScratchVector(scratch, n, false);
+	auto blockedSuccessors = makeScratchVector<std::size_t>(scratch);
+	auto spurPath = makeScratchVector<std::size_t>(scratch);
+	spurPath.reserve(n);
+	if (paths.empty()) {
+		paths.emplace_back();
+	}
+	if (maxHops) {
+		findHopBoundedPath(sourceIndex, destinationIndex, maxHops, blocked, blockedSuccessors,
+			spurPath, scratch);
+		paths[0].assign(spurPath.begin(), spurPath.end());
+	} else if (m_options.routingEngine == RoutingEngine::SingleSource) {
+		generateExchangePathSingleSource(sourceIndex, destinationIndex, paths[0], scratch);
+	} else {
+		generateExchangePath(sourceIndex, destinationIndex, paths[0], scratch);
+	}
+	if (paths[0].empty()) {
+		return 0;
+	}
+
+	// Yen's algorithm: every next path deviates from the previous one at some
+	// spur vertex. Root of previous path up to spur vertex is kept, spur path
+	// must avoid root vertices and edges already taken by known paths with
+	// the same root. Vertices of candidates are stored one after another.
+	struct Candidate {
+		double rate;
+		std::size_t offset;
+		std::size_t length;
+		bool taken;
+	};
+	auto candidates = makeScratchVector<Candidate>(scratch);
+	auto candidateVertices = makeScratchVector<std::size_t>(scratch);
+	std::size_t found = 1;
+	std::size_t remaining = 0;
+	while (found < pathCount) {
+		const auto& previous = paths[found - 1];
+		for (std::size_t i = 0; i + 1 < previous.size(); ++i) {
+			blockedSuccessors.clear();
+			for (std::size_t k = 0; k < found; ++k) {
+				const auto& path = paths[k];
+				if (path.size() > i + 1
+					&& std::equal(previous.begin(), previous.begin() + i + 1, path.begin())) {
+					blockedSuccessors.push_back(path[i + 1]);
+				}
+			}
+			// Transfer through hub is single hop
+			std::size_t rootHops = 0;
+			for (std::size_t j = 0; j < i; ++j) {
+				blocked[previous[j]] = true;
+				rootHops += !isTransferHub(previous[j + 1]);
+			}
+			findHopBoundedPath(previous[i], destinationIndex, maxHops ? maxHops - rootHops : 0,
+				blocked, blockedSuccessors, spurPath, scratch);
+			for (std::size_t j = 0; j < i; ++j) {
+				blocked[previous[j]] = false;
+			}
+			if (spurPath.empty()) {
+				continue;
+			}
+
+			// Candidate is root followed by spur path
+			const auto offset = candidateVertices.size();
+			candidateVertices.insert(candidateVertices.end(), previous.begin(), previous.begin() + i);
+			candidateVertices.insert(candidateVertices.end(), spurPath.begin(), spurPath.end());
+			const auto length = candidateVertices.size() - offset;
+			const auto candidate = candidateVertices.begin() + offset;
+			const bool known = std::any_of(candidates.begin(), candidates.end(),
+				[&](const Candidate& c) {
+					return !c.taken && c.length == length
+						&& std::equal(candidate, candidate + length, candidateVertices.begin() + c.offset);
+				});
+			if (known) {
+				candidateVertices.resize(offset);
+			} else {
+				candidates.push_back(Candidate{pathRate(&*candidate, length), offset, length, false});
+				++remaining;
 			}
-			path.push_back(u);
-			visited.insert(u);
 		}
+		if (!remaining) {
+			break;
+		}
+
+		// Next path is the best candidate, fewer hops win ties as in best rates
+		const Candidate* best = nullptr;
+		for (const auto& c : candidates) {
+			if (!c.taken && (!best || isBetterPath(c.rate, static_cast<HopCount>(c.length),
+				best->rate, static_cast<HopCount>(best->length)))) {
+				best = &c;
+			}
+		}
+		if (found == paths.size()) {
+			paths.emplace_back();
+		}
+		paths[found++].assign(candidateVertices.begin() + best->offset,
+			candidateVertices.begin() + best->offset + best->length);
+		candidates[best - candidates.data()].taken = true;
+		--remaining;
+	}
+	return found;
+}
+
+double ExchangeRateProcessor::pathRate(const std::size_t* path, const std::size_t length) const
+{
+	double rate = 1.0;
+	for (std::size_t i = 1; i < length; ++i) {
+		rate *= edgeRate(path[i - 1], path[i]);
+	}
+	return rate;
+}
+
+void ExchangeRateProcessor::checkArbitrage()
+{
+	ArbitrageCycle cycle;
+	const bool found = findArbitrage(cycle);
+	if (found == m_arbitrageReported) {
+		return;
+	}
+	m_arbitrageReported = found;
+
+	auto& out = m_responseWriter;
+	if (m_options.protocol == WireProtocol::Binary) {
+		writeBinaryArbitrage(found ? &cycle : nullptr);
+		return;
+	}
+	if (found) {
+		out << ARBITRAGE_BEGIN << ' ' << cycle.rate << '\n';
+		// Start cycle from exchange/currency pair, hubs are not reported
+		const auto length = cycle.path.size() - 1;
+		std::size_t start = 0;
+		while (start < length && isTransferHub(cycle.path[start])) {
+			++start;
+		}
+		for (std::size_t i = 0; i <= length; ++i) {
+			const auto index = cycle.path[(start + i) % length];
+			if (!isTransferHub(index)) {
+				out << exchangeName(index) << ", " << currencyName(index) << '\n';
+			}
+		}
+		out << ARBITRAGE_END << '\n';
+	} else {
+		out << ARBITRAGE_CLEARED << '\n';
 	}
+	out.endResponse();
+}
 
-	return path;
+void ExchangeRateProcessor::writeBinaryArbitrage(const ArbitrageCycle* cycle)
+{
+	auto& out = m_responseWriter;
+	if (!cycle) {
+		writeBinaryFrameHeader(out, BinaryFrameType::ArbitrageCleared, 0);
+		out.endResponse();
+		return;
+	}
+
+	// Cycle starts from exchange/currency pair as in text protocol, hubs are skipped
+	const auto& path = cycle->path;
+	const auto length = path.size() - 1;
+	std::size_t start = 0;
+	while (start < length && isTransferHub(path[start])) {
+		++start;
+	}
+	std::uint32_t vertexCount = 0;
+	for (std::size_t i = 0; i <= length; ++i) {
+		vertexCount += !isTransferHub(path[(start + i) % length]);
+	}
+	writeBinaryFrameHeader(out, BinaryFrameType::Arbitrage, sizeof(double)
+		+ sizeof(std::uint32_t) + vertexCount * 2 * sizeof(std::uint32_t));
+	out.writeBinary(cycle->rate);
+	out.writeBinary(vertexCount);
+	for (std::size_t i = 0; i <= length; ++i) {
+		const auto index = path[(start + i) % length];
+		if (!isTransferHub(index)) {
+			out.writeBinary(exchangeWireId(index));
+			out.writeBinary(currencyWireId(index));
+		}
+	}
+	out.endResponse();
 }
 
-void ExchangeRateProcessor::printPath(const std::string& sourceExchange,
-	const std::string& sourceCurrency, const std::string& destinationExchange,
-	const std::string& destinationCurrency, const std::vector<std::size_t>* path) const
+void ExchangeRateProcessor::collectPathRates(const std::vector<std::size_t>& path,
+	const bool bestPath, PathRates& rates) const
 {
-	std::cout << BEST_RATES_BEGIN << ' ' << sourceExchange << ' ' <<  sourceCurrency
-		<< ' ' << destinationExchange << ' ' << destinationCurrency << std::endl;
-	if (path) {
-		for (const auto index: *path) {
-			const auto& pair = m_exchangeCurrencyPairsByIndex[index];
-			std::cout << pair.first << ", " << pair.second << std::endl; 
+	rates.totalRate = 0.0;
+	rates.hops.clear();
+	if (path.empty()) {
+		return;
+	}
+
+	// Factors and timestamps of hops come straight from adjacency table
+	double product = 1.0;
+	rates.hops.resize(path.size(), std::make_pair(0.0, std::time_t()));
+	for (std::size_t i = 1; i < path.size(); ++i) {
+		const auto rate = edgeRate(path[i - 1], path[i]);
+		if (rate != 0.0) {
+			rates.hops[i] = std::make_pair(rate, edgeTimestamp(path[i - 1], path[i]));
+			product *= rate;
 		}
 	}
-	std::cout << BEST_RATES_END << std::endl;
+
+	// All-pairs engine already knows total rate, unless profitable cycles
+	// inflate it. Single-source search keeps only -log(rate) sums,
+	// so multiply factors for exact value instead.
+	const bool useBestRate = bestPath && m_options.routingEngine == RoutingEngine::AllPairs
+		&& !m_hasPositiveCycle && path.size() > 1;
+	rates.totalRate = useBestRate ? m_rate(path.front(), path.back()) : product;
+}
+
+void ExchangeRateProcessor::printPath(const RateQuery& query,
+	const std::vector<std::size_t>* path, RequestContext& context, const bool bestPath) const
+{
+	if (m_options.protocol == WireProtocol::Binary) {
+		// Binary responses always carry rates, they cost nothing to format
+		const std::vector<std::size_t> noPath;
+		collectPathRates(path ? *path : noPath, bestPath, context.pathRates);
+		writeBinaryBestRatesResponse(context.out, *this,
+			m_wireExchanges.wireId(m_exchanges.find(query.sourceExchange)),
+			m_wireCurrencies.wireId(m_currencies.find(query.sourceCurrency)),
+			m_wireExchanges.wireId(m_exchanges.find(query.destinationExchange)),
+			m_wireCurrencies.wireId(m_currencies.find(query.destinationCurrency)),
+			path, context.pathRates);
+	} else if (m_options.extendedResponses) {
+		const std::vector<std::size_t> noPath;
+		collectPathRates(path ? *path : noPath, bestPath, context.pathRates);
+		writeBestRatesResponse(context.out, *this, query.sourceExchange,
+			query.sourceCurrency, query.destinationExchange, query.destinationCurrency,
+			path, &context.pathRates);
+	} else {
+		writeBestRatesResponse(context.out, *this, query.sourceExchange,
+			query.sourceCurrency, query.destinationExchange, query.destinationCurrency, path);
+	}
 }
 
 #ifdef _DEBUG
@@ -423,11 +2289,11 @@ void ExchangeRateProcessor::printAdjacencyTable() const
 	std::cerr << "---------------------------------------------------" << std::endl;
 	std::cerr << "Current adjacency table:" << std::endl;
 	std::cerr << "---------------------------------------------------" << std::endl;
-	for (std::size_t i = 0; i < m_adjacencyTable.size(); ++i) {
-		const auto& pair = m_exchangeCurrencyPairsByIndex[i];
-		std::cout << pair.first << '/' << pair.second << '\t';
-		for (const auto& cell : m_adjacencyTable[i]) {
-			std::cout << '\t' << cell.second;
+	for (std::size_t i = 0; i < m_adjacencyRates.size(); ++i) {
+		std::cout << (isTransferHub(i) ? std::string("*") : exchangeName(i)) << '/'
+			<< currencyName(i) << '\t';
+		for (std::size_t j = 0; j < m_adjacencyRates.size(); ++j) {
+			std::cout << '\t' << m_adjacencyRates(i, j);
 		}
 		std::cout << std::endl;
 	}
@@ -435,17 +2301,17 @@ void ExchangeRateProcessor::printAdjacencyTable() const
 }
 
 
-void ExchangeRateProcessor::printFloydWarsallTables(const std::vector<std::vector<double>>& rate,
-	const std::vector<std::vector<std::size_t>>& next) const
+void ExchangeRateProcessor::printFloydWarsallTables(const FlatMatrix<double>& rate,
+	const FlatMatrix<NextVertex>& next) const
 {
 	std::cerr << "---------------------------------------------------" << std::endl;
 	std::cerr << "Current 'rate' table:" << std::endl;
 	std::cerr << "---------------------------------------------------" << std::endl;
 	for (std::size_t i = 0; i < rate.size(); ++i) {
-		const auto& pair = m_exchangeCurrencyPairsByIndex[i];
-		std::cout << pair.first << '/' << pair.second << '\t';
-		for (const auto& cell : rate[i]) {
-			std::cout << '\t' << cell;
+		std::cout << (isTransferHub(i) ? std::string("*") : exchangeName(i)) << '/'
+			<< currencyName(i) << '\t';
+		for (std::size_t j = 0; j < rate.size(); ++j) {
+			std::cout << '\t' << rate(i, j);
 		}
 		std::cout << std::endl;
 	}
@@ -454,10 +2320,10 @@ void ExchangeRateProcessor::printFloydWarsallTables(const std::vector<std::vecto
 	std::cerr << "Current 'next' table:" << std::endl;
 	std::cerr << "---------------------------------------------------" << std::endl;
 	for (std::size_t i = 0; i < next.size(); ++i) {
-		const auto& pair = m_exchangeCurrencyPairsByIndex[i];
-		std::cout << pair.first << '/' << pair.second << '\t';
-		for (const auto& cell : next[i]) {
-			std::cout << '\t' << cell;
+		std::cout << (isTransferHub(i) ? std::string("*") : exchangeName(i)) << '/'
+			<< currencyName(i) << '\t';
+		for (std::size_t j = 0; j < next.size(); ++j) {
+			std::cout << '\t' << next(i, j);
 		}
 		std::cout << std::endl;
 	}
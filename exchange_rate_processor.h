@@ -1,90 +1,715 @@
 #ifndef EXCHANGE_RATE_PROCESSOR_H__
 #define EXCHANGE_RATE_PROCESSOR_H__
 
+#include "binary_protocol.h"
+#include "flat_matrix.h"
+#include "floyd_warsall.h"
+#include "response_writer.h"
+#include "scratch_arena.h"
 #include "string_tokenizer.h"
-#include "pair_hash.h"
+#include "symbol_table.h"
+#include "text_protocol.h"
+#include "thread_pool.h"
+#include <cstdint>
 #include <ctime>
-#include <unordered_map>
-#include <unordered_set>
+#include <memory>
+#include <queue>
+#include <string>
+#include <string_view>
 #include <vector>
 
+// Algorithm used to find best exchange path
+enum class RoutingEngine {
+	// Dense adjacency table, all-pairs best rates (Floyd-Warsall) cached between requests
+	AllPairs,
+
+	// Sparse adjacency lists, single-source search (SPFA on -log(rate)) for each request
+	SingleSource
+};
+
+// Format of input and responses
+enum class WireProtocol {
+	// Whitespace-separated text lines, see text_protocol.h
+	Text,
+
+	// Length-prefixed binary frames, see binary_protocol.h
+	Binary
+};
+
+// Upper limit of maxQuoteAge option. Quote timestamps span 2^32 seconds
+// (see validation of rate info), so older quotes can't exist anyway,
+// and expiry time of any quote fits std::time_t.
+constexpr std::time_t MAX_QUOTE_AGE = 0xFFFFFFFF;
+
+// Upper limit of number of best paths of rate request (TOP option). Number
+// of loopless paths may grow exponentially with graph size, search for more
+// of them could keep the thread busy indefinitely.
+constexpr std::size_t MAX_PATH_COUNT = 10;
+
+// Upper limit of number of graph vertices, exchange/currency pairs and
+// transfer hubs. Vertex indices are stored as 32-bit values.
+constexpr std::size_t MAX_VERTEX_COUNT = NO_NEXT_VERTEX;
+
+// Settings of exchange rate processor
+struct ExchangeRateProcessorOptions {
+	// Algorithm used to find best exchange path
+	RoutingEngine routingEngine = RoutingEngine::AllPairs;
+
+	// Format of input and responses
+	WireProtocol protocol = WireProtocol::Text;
+
+	// Number of threads used for all-pairs best rates computation
+	std::size_t threadCount = 1;
+
+	// Size of output buffer, responses are written out when it is full.
+	// At most MAX_OUTPUT_BUFFER_SIZE.
+	std::size_t outputBufferSize = 64 * 1024;
+
+	// Write out and flush every response immediately, for interactive consumers
+	bool flushPerResponse = false;
+
+	// Keep responses in memory until they are taken with takeOutput(),
+	// instead of writing them to standard output
+	bool captureResponses = false;
+
+	// Report total rate and factor and quote timestamp of every hop in responses
+	bool extendedResponses = false;
+
+	// Maximal age of quote in seconds, older edges are not used for routing.
+	// Age is measured against stream time, the latest timestamp of rate info seen.
+	// 0 means quotes never expire. At most MAX_QUOTE_AGE.
+	std::time_t maxQuoteAge = 0;
+
+	// Check for profitable cycles after every rate info and write
+	// ARBITRAGE_BEGIN/ARBITRAGE_CLEARED events to output when state changes
+	bool reportArbitrage = false;
+
+	// File state is saved to periodically, see saveState(). Empty if not saved.
+	std::string stateFileName;
+
+	// Period of state saving in seconds of stream time. 0 means state is
+	// not saved periodically.
+	std::time_t stateSaveInterval = 0;
+};
+
+// Destination of responses and working memory of answering rate requests.
+// Processor has its own context, readers of snapshots bring one per thread,
+// so that requests are answered from shared snapshot concurrently.
+struct RequestContext {
+	explicit RequestContext(ResponseWriter& writer) :
+		out(writer),
+		errors(),
+		scratch(),
+		paths(),
+		pathRates()
+	{
+	}
+
+	// Appends error message line to errors
+	void reportError(std::string_view message)
+	{
+		errors.append("Error: ").append(message.data(), message.length()).push_back('\n');
+	}
+
+	// Writer of responses
+	ResponseWriter& out;
+
+	// Errors of answered requests, written out by owner of context. Query
+	// threads don't share standard error, its stream isn't synchronized.
+	std::string errors;
+
+	// Memory for temporary data of route computations. Searches take their
+	// arrays from it, so requests don't allocate from heap in steady state.
+	ScratchArena scratch;
+
+	// Paths found for current request and their rates, kept to reuse memory
+	std::vector<std::vector<std::size_t>> paths;
+	PathRates pathRates;
+};
+
+class RateSnapshot;
+
+// Source and destination of single rate request
+struct RateQuery {
+	std::string_view sourceExchange;
+	std::string_view sourceCurrency;
+	std::string_view destinationExchange;
+	std::string_view destinationCurrency;
+};
+
+// Profitable exchange cycle: product of its rates is above 1
+struct ArbitrageCycle {
+	// Vertices (exchange/currency pair indices) of cycle, first vertex is repeated at the end
+	std::vector<std::size_t> path;
+
+	// Product of rates along the cycle
+	double rate = 0.0;
+};
+
+// Input line parsed and validated independently of processor state.
+// Lines can be parsed concurrently and applied later in input order.
+// String fields are views into the line, which must outlive the record.
+struct ParsedLine {
+	enum class Kind {
+		// Rate info: exchange, source currency, destination currency
+		Info,
+
+		// Rate request: source exchange, source currency,
+		// destination exchange, destination currency
+		Request,
+
+		// Batch of rate requests, see "queries"
+		BatchRequest,
+
+		// Transfer fee: exchange, currency; withdrawal factor is in
+		// forwardFactor and deposit factor in backwardFactor
+		TransferFee,
+
+		// Line could not be parsed, "error" describes the problem
+		Invalid
+	};
+
+	Kind kind = Kind::Invalid;
+	std::string_view fields[4];
+
+	// Rate info values, factors are used by transfer fee too
+	std::time_t timestamp = 0;
+	double forwardFactor = 0.0;
+	double backwardFactor = 0.0;
+
+	// Rate info timestamp was truncated to seconds from finer clock (binary
+	// protocol). Quote of the same second as stored one then replaces it,
+	// as it comes later in the stream.
+	bool truncatedTimestamp = false;
+
+	// Options of rate request: maximal number of hops of path (0 if unlimited)
+	// and number of best paths to report, at most MAX_PATH_COUNT
+	std::size_t maxHops = 0;
+	std::size_t pathCount = 1;
+
+	// Queries of batch request
+	std::vector<RateQuery> queries;
+
+	// Parse error message
+	std::string error;
+};
+
 class ExchangeRateProcessor {
 public:
 	// Constructor
-	ExchangeRateProcessor();
+	explicit ExchangeRateProcessor(
+		const ExchangeRateProcessorOptions& options = ExchangeRateProcessorOptions());
 
 	// Process incoming data.
-	void processData(const std::string& data);
+	void processData(std::string_view data);
+
+	// Parse single line of incoming data. Doesn't touch processor state,
+	// so it can be called from any thread.
+	static ParsedLine parseLine(std::string_view data);
+
+	// Apply parsed line to graph or answer parsed request.
+	// "data" is the original line, used for error reporting.
+	void applyLine(const ParsedLine& line, std::string_view data);
+
+	// Process single frame of binary protocol, without length prefix.
+	// Rate info and requests share processing with text lines, responses
+	// are written as binary frames if protocol option is binary.
+	void processFrame(std::string_view frame);
+
+	// Write out buffered responses. Call at the end of batch or when input is idle.
+	void flushOutput();
+
+	// Append buffered responses to given string instead of writing them out.
+	// Used with captureResponses option to route responses to their requester.
+	void takeOutput(std::string& output);
+
+	// Pre-allocate graph storage for given number of exchanges and currencies,
+	// so that loading known catalogue doesn't cause repeated reallocations.
+	// Throws std::length_error if they make more than MAX_VERTEX_COUNT vertices,
+	// std::bad_alloc if storage can't be allocated.
+	void reserve(std::size_t exchangeCount, std::size_t currencyCount);
+
+	// Answer many rate requests in one pass and write responses in order of queries.
+	// Queries are grouped by source, so single-source engine runs one search per
+	// distinct source; all-pairs engine answers all of them from cached best rates.
+	// Queries with unknown exchange/currency pair get empty path, error is reported.
+	void processBatchRequest(const std::vector<RateQuery>& queries);
+
+	// Find profitable cycle in current graph. Returns false if there is none.
+	// In all-pairs mode cycle is searched only if cached best rates
+	// (brought up to date first) show rate above 1 from some vertex to itself.
+	bool findArbitrage(ArbitrageCycle& cycle);
+
+	// Remove expired quotes and bring all-pairs best rates up to date,
+	// reporting change of arbitrage state if configured. Requests do it
+	// before they are answered; server calls it after feed input, so that
+	// arbitrage events go to feed connection rather than to querying client.
+	void refreshBestRates();
+
+	// Bring routing state up to date, see refreshBestRates(), and return its
+	// immutable copy. Readers answer requests from snapshot concurrently with
+	// further processing, see RateSnapshot and SnapshotPublisher.
+	std::unique_ptr<const RateSnapshot> createSnapshot();
+
+	// Save graph state to binary file: names of exchanges and currencies,
+	// vertices, edges, stream time and in all-pairs mode best rates, brought
+	// up to date first. File is replaced atomically. Throws std::runtime_error
+	// if file can't be written.
+	void saveState(const std::string& fileName);
+
+	// Restore graph state saved by saveState(), processor must be empty.
+	// Best rates are taken from file if it has them and routing engine is
+	// all-pairs, otherwise they are recomputed on demand. Until input reaches
+	// stream time of saved state, rate info older than it is skipped, so the
+	// input which state was built from can be fed again. Throws
+	// std::runtime_error if file can't be read or is malformed.
+	void loadState(const std::string& fileName);
+
+	// Returns true if vertex is transfer hub of currency rather than exchange/currency pair.
+	// Hubs have no exchange, they are never reported in responses.
+	bool isTransferHub(std::size_t index) const noexcept
+	{
+		return m_exchangeCurrencyPairsByIndex[index].first == SymbolTable::INVALID_ID;
+	}
+
+	// Returns name of exchange of given exchange/currency pair
+	const std::string& exchangeName(std::size_t index) const noexcept
+	{
+		return m_exchanges.name(m_exchangeCurrencyPairsByIndex[index].first);
+	}
+
+	// Returns name of currency of given exchange/currency pair
+	const std::string& currencyName(std::size_t index) const noexcept
+	{
+		return m_currencies.name(m_exchangeCurrencyPairsByIndex[index].second);
+	}
+
+	// Returns binary protocol identifier of exchange of given exchange/currency pair
+	std::uint32_t exchangeWireId(std::size_t index) const noexcept
+	{
+		return m_wireExchanges.wireId(m_exchangeCurrencyPairsByIndex[index].first);
+	}
+
+	// Returns binary protocol identifier of currency of given exchange/currency pair
+	std::uint32_t currencyWireId(std::size_t index) const noexcept
+	{
+		return m_wireCurrencies.wireId(m_exchangeCurrencyPairsByIndex[index].second);
+	}
 
 private:
-	// Process rate info.
-	void processInfo(StringTokenizer& data);
+	friend class RateSnapshot;
+
+	// Copies graph and routing state for snapshot. Copy has no thread pool,
+	// expiry index nor pending output, it is only used to answer requests.
+	ExchangeRateProcessor(const ExchangeRateProcessor& other);
+
+	ExchangeRateProcessor& operator=(const ExchangeRateProcessor&) = delete;
+
+	// Parse and validate rate info. First token (timestamp) must be already parsed.
+	static void parseInfo(StringTokenizer& data, ParsedLine& line);
+
+	// Parse rate request
+	static void parseRequest(StringTokenizer& data, ParsedLine& line);
+
+	// Parse optional MAX_HOPS=N and TOP=K trailing fields of rate request
+	static void parseRequestOptions(StringTokenizer& data, ParsedLine& line);
 
-	// Process rate request
-	void processRequest(StringTokenizer& data);
+	// Parse batch of rate requests
+	static void parseBatchRequest(StringTokenizer& data, ParsedLine& line);
 
-	// Parse single string field
-	std::string parseStringField(StringTokenizer& data, const char* fieldName);
+	// Parse and validate transfer fee
+	static void parseTransferFee(StringTokenizer& data, ParsedLine& line);
 
-	// Parse single time field
-	std::time_t parseTimestampField(StringTokenizer& data, const char* fieldName);
+	// Validate factors and timestamp of parsed rate info
+	static void validateInfo(const ParsedLine& line);
+
+	// Validate factors of parsed transfer fee
+	static void validateTransferFee(const ParsedLine& line);
+
+	// Apply binary frame, throws std::invalid_argument if frame is invalid
+	void applyFrame(std::string_view frame);
+
+	// Binds binary protocol identifier to exchange or currency, adding it
+	// if name is new. New currency is provisioned for all exchanges.
+	void bindWireSymbol(BinarySymbolKind kind, std::uint32_t wireId, std::string_view name);
+
+	// Returns symbol identifier bound to binary protocol identifier,
+	// throws std::invalid_argument if there is none
+	static std::size_t resolveWireSymbol(const WireSymbolMap& symbols, std::uint32_t wireId,
+		const char* fieldName);
+
+	// Process parsed rate info
+	void processInfo(const ParsedLine& line);
+
+	// Returns true if rate info with given timestamp is contained in loaded
+	// state and must be skipped
+	bool skipRestoredInfo(std::time_t timestamp);
+
+	// Apply rate info to graph. Arguments are results of interning exchange
+	// and currency names of the rate info, see SymbolTable::intern().
+	void applyInfo(const std::pair<std::size_t, bool>& exchange,
+		const std::pair<std::size_t, bool>& sourceCurrency,
+		const std::pair<std::size_t, bool>& destinationCurrency, const ParsedLine& line);
+
+	// Process parsed rate request
+	void processRequest(const ParsedLine& line);
+
+	// Answer parsed rate request from routing state, which must be up to date.
+	// Responses go to context. Throws std::invalid_argument after writing
+	// empty response if exchange/currency pair is unknown.
+	void answerRequest(const ParsedLine& line, RequestContext& context) const;
+
+	// Answer batch of rate requests from routing state, which must be up to date.
+	// Responses go to context, queries with unknown pair get empty path.
+	void answerBatchRequest(const std::vector<RateQuery>& queries,
+		RequestContext& context) const;
+
+	// Process parsed transfer fee
+	void processTransferFee(const ParsedLine& line);
+
+	// Saves state to file of options when stream time has advanced by
+	// save interval since the last save. Failure is reported, not thrown.
+	void saveStatePeriodically();
+
+	// Parse single string field. Returned value is view into parsed data.
+	static std::string_view parseStringField(StringTokenizer& data, const char* fieldName);
+
+	// Parse value of single time field
+	static std::time_t parseTimestampField(std::string_view value, const char* fieldName);
 
 	// Parse single floating-point number field
-	double parseDoubleField(StringTokenizer& data, const char* fieldName);
+	static double parseDoubleField(StringTokenizer& data, const char* fieldName);
+
+	// Locates source and destination vertices of query.
+	// Returns error message if pair is unknown, empty string on success.
+	std::string locateQuery(const RateQuery& query, std::size_t& sourceIndex,
+		std::size_t& destinationIndex) const;
 
 	// Adds new exchange/currency pair. Returns index of the new pair.
-	std::size_t addExchangeCurrencyPair(const std::string& exchange, const std::string& currency);
+	std::size_t addExchangeCurrencyPair(std::size_t exchangeId, std::size_t currencyId);
 
 	// Find existing exchange/currency pair. Returns index of pair or max std::sizet value of not found.
-	std::size_t findExchangeCurrencyPair(const std::string& exchange,
-		const std::string& currency) const;
+	std::size_t findExchangeCurrencyPair(std::size_t exchangeId, std::size_t currencyId) const;
+
+	// Find existing exchange/currency pair by names.
+	// Returns index of pair or max std::sizet value of not found.
+	std::size_t findExchangeCurrencyPair(std::string_view exchange,
+		std::string_view currency) const;
+
+	// References to rate and encoded timestamp of edge in adjacency storage
+	struct EdgeCell {
+		double& rate;
+		std::uint32_t& time;
+	};
+
+	// Returns adjacency storage cell for edge from source to destination.
+	// In single-source mode missing edge is inserted into adjacency list.
+	EdgeCell adjacencyCell(std::size_t sourceIndex, std::size_t destinationIndex);
+
+	// Returns rate of edge from source to destination, 0 if there is no such edge
+	double edgeRate(std::size_t sourceIndex, std::size_t destinationIndex) const;
+
+	// Returns quote timestamp of existing edge from source to destination
+	std::time_t edgeTimestamp(std::size_t sourceIndex, std::size_t destinationIndex) const;
+
+	// Updates single edge of adjacency table, unless given rate is outdated.
+	// Quote of the same second as stored one is outdated unless sameSecondIsNewer.
+	// Change is recorded for incremental repair of cached best rates.
+	void updateEdge(std::size_t sourceIndex, std::size_t destinationIndex,
+		std::time_t timestamp, double rate, bool sameSecondIsNewer);
+
+	// Removes edges whose quotes got older than maxQuoteAge, in order of age.
+	// Removal is recorded for repair of cached best rates like any rate change.
+	void expireStaleEdges();
+
+	// Sets rate of existing edge without changing its timestamp.
+	// Change is recorded for incremental repair of cached best rates.
+	void setEdgeRate(std::size_t sourceIndex, std::size_t destinationIndex, double rate);
+
+	// Adds transfer hub vertex of given currency. Returns index of the hub.
+	std::size_t addTransferHub(std::size_t currencyId);
+
+	// Connects exchange/currency pair to transfer hub of its currency
+	// with edges in both directions
+	void connectToTransferHub(std::size_t index, std::size_t hubIndex, std::time_t timestamp);
 
 	// Extends adjancency table by 1 row and 1 column
 	void extendAdjancencyTable();
 
-	// Provision brand new currency for all exchanges
-	void provisionNewCurrency(const std::string& currency);
+	// Provision brand new currency for all exchanges. Transfer edges get
+	// given timestamp, the time of line which provisions them.
+	void provisionNewCurrency(std::size_t currencyId, std::time_t timestamp);
+
+	// Provision new currency for given exchange, transfer edges get given timestamp
+	void provisionCurrencyForExchange(std::size_t currencyId, std::size_t exchangeId,
+		std::time_t timestamp);
+
+	// Provision exchange/currency pair unless it is known already. Arguments are
+	// results of interning exchange and currency names and timestamp of new
+	// transfer edges. Returns index of the pair.
+	std::size_t provisionExchangeCurrencyPair(const std::pair<std::size_t, bool>& exchange,
+		const std::pair<std::size_t, bool>& currency, std::time_t timestamp);
+
+	// Returns timestamp of transfer edges provisioned by line without timestamp
+	// (TRANSFER_FEE line, symbol frame): stream time, or start of supported
+	// range before the first rate info
+	std::time_t provisioningTime() const;
+
+	// Recompute all-pairs best rates if adjacency table changed since last computation.
+	// Edge changes are applied incrementally where possible, otherwise
+	// tables are recomputed from scratch.
+	void updateAllPairsBestRates();
+
+	// Repair cached best rates using pending edge updates.
+	// Returns false if full recomputation is required.
+	bool applyPendingEdgeUpdates();
+
+	// Repair cached best rates after rate of given edge improved to "rate". O(n^2).
+	void relaxEdge(std::size_t sourceIndex, std::size_t destinationIndex, double rate);
+
+	// Adds columns of cells of cached best rates whose best paths may go over
+	// given edge with given old rate to their row lists. O(n^2).
+	// Returns number of added cells.
+	std::size_t markCellsUsingEdge(std::size_t sourceIndex, std::size_t destinationIndex,
+		double rate, std::vector<std::vector<std::size_t>>& affectedColumns) const;
+
+	// Recomputes affected cells of cached best rates from adjacency table and
+	// the other cells, by Dijkstra search over affected cells of every row.
+	// Lists may contain duplicates. Returns false if graph changed so that
+	// full recomputation is required.
+	bool repairBestRateCells(std::vector<std::vector<std::size_t>>& affectedColumns);
+
+	// Checks cached best rates for profitable (rate above 1) cycles
+	bool detectPositiveCycle() const;
 
-	// Provision new currency for given exchange
-	void provisionCurrencyForExchange(const std::string& currency, const std::string& exchange);
+	// Generate best exchange path from source to destination into "path",
+	// its memory is reused. Uses all-pairs best rates, which must be up to date.
+	// Searches fall back to take temporary arrays from "scratch".
+	void generateExchangePath(std::size_t sourceIndex, std::size_t destinationIndex,
+		std::vector<std::size_t>& path, ScratchArena& scratch) const;
 
-	// Generate best exchange path from source to destination.
-	std::vector<std::size_t> generateExchangePath(const std::size_t sourceIndex,
-		const std::size_t destinationIndex) const;
+	// Generate best exchange path from source to destination into "path"
+	// using single-source search over adjacency lists
+	void generateExchangePathSingleSource(std::size_t sourceIndex,
+		std::size_t destinationIndex, std::vector<std::size_t>& path,
+		ScratchArena& scratch) const;
 
-	// Prints output headers and given path.
-	// "path" can be nullptr, then just headers printed out.
-	void printPath(const std::string& sourceExchange, const std::string&sourceCurrency,
-		const std::string& destinationExchange, const std::string& destinationCurrency,
-		const std::vector<std::size_t>* path) const;
+	// Single-source search over adjacency lists. Fills "previous" with
+	// predecessor of every vertex on its best path from source.
+	// Returns false if profitable cycle is reachable from source.
+	bool computeSingleSourceTree(std::size_t sourceIndex,
+		ScratchVector<std::size_t>& previous, ScratchArena& scratch) const;
+
+	// Extracts path from source to destination out of predecessor table into "path"
+	static void extractPath(const ScratchVector<std::size_t>& previous,
+		std::size_t sourceIndex, std::size_t destinationIndex, std::vector<std::size_t>& path);
+
+	// Calls f(destinationIndex, rate) for every present edge leaving given vertex
+	template <class Function>
+	void forEachEdge(const std::size_t sourceIndex, Function f) const
+	{
+		// nonzero rate is indicator of edge presence
+		if (m_options.routingEngine == RoutingEngine::SingleSource) {
+			for (const auto& entry : m_adjacencyLists[sourceIndex]) {
+				if (entry.rate != 0.0) {
+					f(std::size_t(entry.destination), entry.rate);
+				}
+			}
+		} else {
+			const auto row = m_adjacencyRates.row(sourceIndex);
+			for (std::size_t j = 0; j < m_adjacencyRates.size(); ++j) {
+				if (row[j] != 0.0) {
+					f(j, row[j]);
+				}
+			}
+		}
+	}
+
+	// Finds negative cycle in -log(rate) space, i.e. profitable cycle,
+	// with SPFA started from all vertices at once. Returns false if there is none.
+	bool findProfitableCycle(ArbitrageCycle& cycle) const;
+
+	// Finds good path from source to destination which doesn't visit any vertex twice.
+	// Used when profitable cycles make best path unbounded. Best simple path is
+	// NP-hard in general, so this is label-correcting search which never extends
+	// path to vertex it already contains. Path is left empty if there is none.
+	void findBestSimplePath(std::size_t sourceIndex, std::size_t destinationIndex,
+		std::vector<std::size_t>& path, ScratchArena& scratch) const;
+
+	// Finds best path from source to destination with at most maxHops hops
+	// (unlimited if 0) by hop-bounded Bellman-Ford: level h holds best rates
+	// of paths with at most h hops. Vertices marked in "blocked" and edges from
+	// source to "blockedSuccessors" are not used. Path is left empty if there
+	// is none. It must have capacity for all vertices already, as search arrays
+	// are released to arena when it returns.
+	void findHopBoundedPath(std::size_t sourceIndex, std::size_t destinationIndex,
+		std::size_t maxHops, const ScratchVector<bool>& blocked,
+		const ScratchVector<std::size_t>& blockedSuccessors, ScratchVector<std::size_t>& path,
+		ScratchArena& scratch) const;
+
+	// Finds up to pathCount best loopless paths from source to destination with
+	// at most maxHops hops (unlimited if 0), in order of decreasing rate (Yen's algorithm).
+	// Best rates must be up to date in all-pairs mode. Paths are stored in the first
+	// elements of "paths", which grows if needed, returns number of paths found.
+	std::size_t findBestPaths(std::size_t sourceIndex, std::size_t destinationIndex,
+		std::size_t maxHops, std::size_t pathCount, std::vector<std::vector<std::size_t>>& paths,
+		ScratchArena& scratch) const;
+
+	// Returns product of rates along path of given length
+	double pathRate(const std::size_t* path, std::size_t length) const;
+
+	// Reports change of arbitrage state to output, if configured
+	void checkArbitrage();
+
+	// Writes Arbitrage frame for given cycle, ArbitrageCleared if it is nullptr
+	void writeBinaryArbitrage(const ArbitrageCycle* cycle);
+
+	// Collects total rate and hop factors and timestamps of given path.
+	// Best rates must be up to date in all-pairs mode. "bestPath" tells that
+	// path is unconstrained best one, so its total rate is known from best rates.
+	// Result is stored into "rates", memory of its hops is reused.
+	void collectPathRates(const std::vector<std::size_t>& path, bool bestPath,
+		PathRates& rates) const;
+
+	// Prints output headers and given path to context, extended with rates if
+	// configured. "path" can be nullptr, then just headers printed out.
+	// "bestPath" is false for alternative and hop-limited paths.
+	void printPath(const RateQuery& query, const std::vector<std::size_t>* path,
+		RequestContext& context, bool bestPath = true) const;
 
 #ifdef _DEBUG
 	// Print adjacency table to stderr for debugging purposes
 	void printAdjacencyTable() const;
 
 	// Print Floyd-Warsall algorithm tables to stderr for debugging purposes
-	void printFloydWarsallTables(const std::vector<std::vector<double>>& rate, 
-		const std::vector<std::vector<std::size_t>>& next) const;
+	void printFloydWarsallTables(const FlatMatrix<double>& rate,
+		const FlatMatrix<NextVertex>& next) const;
 #endif
 
 	//////////////////////// DATA /////////////////////////////////////////
 
+	// Processor settings
+	const ExchangeRateProcessorOptions m_options;
+
+	// Buffered writer of responses to standard output
+	ResponseWriter m_responseWriter;
+
 	// All known exchanges
-	std::unordered_set<std::string> m_exchanges;
+	SymbolTable m_exchanges;
 
 	// All known currencies
-	std::unordered_set<std::string> m_currencies;
+	SymbolTable m_currencies;
+
+	// Binary protocol identifiers of exchanges and currencies
+	WireSymbolMap m_wireExchanges;
+	WireSymbolMap m_wireCurrencies;
+
+	// Mapping of exchange/currency pair to its index: row is exchange identifier,
+	// column is currency identifier. Rows grow lazily as currencies are added,
+	// missing columns and INVALID_INDEX cells mean pair is unknown.
+	std::vector<std::vector<std::size_t>> m_exchangeCurrencyPairToIndexMapping;
+
+	// Stores exchange/currency pair identifiers at respective index.
+	// Exchange identifier of transfer hub vertex is SymbolTable::INVALID_ID.
+	std::vector<std::pair<std::size_t, std::size_t>> m_exchangeCurrencyPairsByIndex;
+
+	// Transfer hub vertex of every currency. Transfer of currency between
+	// exchanges goes through its hub: pair -> hub -> pair, rates of the edges
+	// are withdrawal and deposit fee factors (1 by default), see TRANSFER_FEE.
+	// It takes 2 edges per exchange instead of edge for every pair of exchanges.
+	std::vector<std::size_t> m_transferHubs;
+
+	// Adjacency table of exchange rate graph, used by all-pairs routing engine.
+	// Rates and timestamps of edges are kept in separate tables, rate 0 means
+	// there is no edge. So rate table is input of Floyd-Warsall as is, and
+	// searches over edges don't load timestamps. Timestamps are stored as
+	// 32-bit offsets, see encodeTimestamp().
+	FlatMatrix<double> m_adjacencyRates;
+	FlatMatrix<std::uint32_t> m_adjacencyTimes;
+
+	// Entry of adjacency list: edge rate, destination vertex and timestamp
+	// encoded in the same way as in adjacency table
+	struct AdjacencyListEntry {
+		double rate;
+		std::uint32_t destination;
+		std::uint32_t time;
+	};
+
+	// Adjacency lists of exchange rate graph, used by single-source routing engine
+	// instead of adjacency table. Only edges which are present are stored.
+	std::vector<std::vector<AdjacencyListEntry>> m_adjacencyLists;
+
+	// Floyd-Warsall "rate" table: best known rate for each (source, destination) pair.
+	// Cached between requests, valid only if m_allPairsValid is true.
+	FlatMatrix<double> m_rate;
+
+	// Floyd-Warsall "next" table: next vertex on best path for each (source, destination) pair.
+	// Cached between requests, valid only if m_allPairsValid is true.
+	FlatMatrix<NextVertex> m_next;
+
+	// Number of edges of best path for each (source, destination) pair, breaks
+	// ties between paths of equal rate. Valid only if m_allPairsValid is true.
+	FlatMatrix<HopCount> m_hops;
+
+	// Worker threads for all-pairs best rates computation,
+	// nullptr if computation is single-threaded
+	std::unique_ptr<ThreadPool> m_threadPool;
+
+	// Indicates that m_rate and m_next reflect adjacency table, except for
+	// changes listed in m_pendingEdgeUpdates
+	bool m_allPairsValid;
+
+	// Indicates that m_rate has profitable cycle, so incremental repair is not possible
+	bool m_hasPositiveCycle;
+
+	// Indicates that arbitrage was reported to output and not cleared yet
+	bool m_arbitrageReported;
+
+	// Single edge change, not yet reflected in cached best rates
+	struct EdgeUpdate {
+		std::size_t source;
+		std::size_t destination;
+		double oldRate;
+		double newRate;
+	};
+
+	// Edge changes since last best rates computation
+	std::vector<EdgeUpdate> m_pendingEdgeUpdates;
+
+	// Latest timestamp of rate info, current time for quote expiry
+	std::time_t m_streamTime;
+
+	// Stream time of loaded state, rate info older than it is skipped until
+	// input reaches it. 0 if state was not loaded or input has reached it.
+	std::time_t m_restoredStreamTime;
+
+	// Stream time of the last periodic state save, 0 before the first rate info
+	std::time_t m_lastStateSaveTime;
+
+	// Quote of edge which expires at given time, unless edge is updated before
+	struct EdgeExpiry {
+		std::time_t expiryTime;
+		std::time_t timestamp;
+		std::size_t source;
+		std::size_t destination;
+
+		// Orders priority queue so that the earliest expiry is on top
+		bool operator<(const EdgeExpiry& other) const noexcept
+		{
+			return expiryTime > other.expiryTime;
+		}
+	};
 
-	// Mapping of exchange/currency pair to its index
-	std::unordered_map<std::pair<std::string, std::string>, std::size_t, pair_hash> 
-		m_exchangeCurrencyPairToIndexMapping;
+	// Expiry index of quoted edges, used only if maxQuoteAge is set.
+	// Updated edges are not removed from it, their outdated entries are
+	// recognized by timestamp and skipped when they come to the top.
+	std::priority_queue<EdgeExpiry> m_edgeExpiries;
 
-	// Stores exchange/currency pair names at respective index
-	std::vector<std::pair<std::string, std::string>> m_exchangeCurrencyPairsByIndex;
+	// Context of requests answered by processor itself, writes to m_responseWriter
+	RequestContext m_context;
 
-	// Adjacency table of exchange rate graph
-	// Value of table cell is pair, where first is rate timestamp and second is rate value
-	std::vector<std::vector<std::pair<std::time_t, double>>> m_adjacencyTable;
+	// Version of the latest snapshot
+	std::uint64_t m_snapshotVersion;
 };
 
 #endif // EXCHANGE_RATE_PROCESSOR_H__
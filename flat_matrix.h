@@ -0,0 +1,218 @@
+#ifndef FLAT_MATRIX_H__
+#define FLAT_MATRIX_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+// Square matrix stored in single contiguous row-major buffer.
+// Buffer is aligned to cache line and rows are padded to multiple of
+// cache line, so that every row can be processed with aligned SIMD
+// loads and stores without special handling of the row tail.
+// Matrix can grow by one row and column at a time; capacity grows
+// geometrically, so row length (stride) may exceed matrix size.
+template <class T>
+class FlatMatrix {
+	static_assert(std::is_trivially_destructible<T>::value,
+		"FlatMatrix supports only trivially destructible types");
+
+public:
+	// Alignment of buffer and row length granularity in bytes
+	static constexpr std::size_t ALIGNMENT = 64;
+
+	// Constructs empty matrix
+	FlatMatrix() noexcept :
+		m_data(nullptr),
+		m_size(0),
+		m_stride(0),
+		m_bufferSize(0)
+	{
+	}
+
+	FlatMatrix(const FlatMatrix&) = delete;
+	FlatMatrix& operator=(const FlatMatrix&) = delete;
+
+	// Destructor
+	~FlatMatrix()
+	{
+		release();
+	}
+
+	// Resizes matrix to n x n and sets all cells, including padding, to given value.
+	// Row length is minimal for n columns. Buffer is reused if it is large enough.
+	void assign(std::size_t n, const T& value)
+	{
+		const auto stride = roundUpStride(n);
+		const auto bufferSize = cellCount(n, stride);
+		if (bufferSize > m_bufferSize) {
+			release();
+			m_data = allocate(bufferSize);
+			m_bufferSize = bufferSize;
+		}
+		m_size = n;
+		m_stride = stride;
+		std::uninitialized_fill(m_data, m_data + stride * n, value);
+	}
+
+	// Makes this matrix a copy of cells of other matrix with minimal row length,
+	// padding cells are set to given value. Padding of other matrix, which
+	// may be uninitialized after growth, is not read.
+	// Buffer is reused if it is large enough.
+	void copyCellsFrom(const FlatMatrix& other, const T& padding)
+	{
+		const auto n = other.m_size;
+		const auto stride = roundUpStride(n);
+		const auto bufferSize = cellCount(n, stride);
+		if (bufferSize > m_bufferSize) {
+			release();
+			m_data = allocate(bufferSize);
+			m_bufferSize = bufferSize;
+		}
+		m_size = n;
+		m_stride = stride;
+		for (std::size_t i = 0; i < n; ++i) {
+			std::uninitialized_copy(other.row(i), other.row(i) + n, row(i));
+			std::uninitialized_fill(row(i) + n, row(i) + stride, padding);
+		}
+	}
+
+	// Ensures that matrix can grow to n x n without reallocation.
+	// Existing cells are preserved.
+	void reserve(std::size_t n)
+	{
+		if (n <= capacity()) {
+			return;
+		}
+		const auto stride = roundUpStride(n);
+		const auto bufferSize = cellCount(n, stride);
+		T* data = allocate(bufferSize);
+		for (std::size_t i = 0; i < m_size; ++i) {
+			std::uninitialized_copy(row(i), row(i) + m_size, data + i * stride);
+		}
+		release();
+		m_data = data;
+		m_stride = stride;
+		m_bufferSize = bufferSize;
+	}
+
+	// Appends one row and one column, new cells are set to given value.
+	// Amortized cost is proportional to matrix size, existing cells are
+	// copied only when capacity doubles.
+	void extend(const T& value)
+	{
+		if (m_size == capacity()) {
+			reserve(std::max<std::size_t>(2 * m_size, 1));
+		}
+		for (std::size_t i = 0; i < m_size; ++i) {
+			new (row(i) + m_size) T(value);
+		}
+		std::uninitialized_fill(row(m_size), row(m_size) + m_size + 1, value);
+		++m_size;
+	}
+
+	// Returns number of rows (and columns)
+	std::size_t size() const noexcept
+	{
+		return m_size;
+	}
+
+	// Returns maximal size matrix can grow to without reallocation
+	std::size_t capacity() const noexcept
+	{
+		return m_stride ? std::min(m_stride, m_bufferSize / m_stride) : 0;
+	}
+
+	// Returns distance in elements between starts of adjacent rows
+	std::size_t stride() const noexcept
+	{
+		return m_stride;
+	}
+
+	// Returns pointer to the first cell of the matrix
+	T* data() noexcept
+	{
+		return m_data;
+	}
+
+	// Returns pointer to the first cell of the matrix
+	const T* data() const noexcept
+	{
+		return m_data;
+	}
+
+	// Returns pointer to the first cell of given row
+	T* row(std::size_t i) noexcept
+	{
+		return m_data + i * m_stride;
+	}
+
+	// Returns pointer to the first cell of given row
+	const T* row(std::size_t i) const noexcept
+	{
+		return m_data + i * m_stride;
+	}
+
+	// Returns cell at given row and column
+	T& operator()(std::size_t i, std::size_t j) noexcept
+	{
+		return m_data[i * m_stride + j];
+	}
+
+	// Returns cell at given row and column
+	const T& operator()(std::size_t i, std::size_t j) const noexcept
+	{
+		return m_data[i * m_stride + j];
+	}
+
+private:
+	// Returns row length for n columns, rounded up to alignment granularity
+	static std::size_t roundUpStride(std::size_t n) noexcept
+	{
+		constexpr std::size_t granularity = ALIGNMENT / sizeof(T) ? ALIGNMENT / sizeof(T) : 1;
+		return (n + granularity - 1) / granularity * granularity;
+	}
+
+	// Returns number of cells of n rows of given length. Throws std::length_error
+	// if buffer of that many elements can't be addressed.
+	static std::size_t cellCount(std::size_t n, std::size_t stride)
+	{
+		if (n && (stride < n || stride > std::numeric_limits<std::size_t>::max() / sizeof(T) / n)) {
+			throw std::length_error("matrix is too large");
+		}
+		return stride * n;
+	}
+
+	// Allocates aligned buffer for given number of elements
+	static T* allocate(std::size_t count)
+	{
+		return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(ALIGNMENT)));
+	}
+
+	// Frees buffer
+	void release() noexcept
+	{
+		if (m_data) {
+			::operator delete(m_data, std::align_val_t(ALIGNMENT));
+			m_data = nullptr;
+			m_bufferSize = 0;
+		}
+	}
+
+	// Matrix buffer
+	T* m_data;
+
+	// Number of rows and columns
+	std::size_t m_size;
+
+	// Row length in elements, including padding
+	std::size_t m_stride;
+
+	// Buffer size in elements
+	std::size_t m_bufferSize;
+};
+
+#endif // FLAT_MATRIX_H__
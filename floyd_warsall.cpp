@@ -0,0 +1,238 @@
+#include "floyd_warsall.h"
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(_M_X64))
+#define FLOYD_WARSALL_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_FUNCTION
+#else
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+	// Tile size in vertices. Three tiles of "rate" and "next" touched
+	// while processing single tile fit into L2 cache.
+	constexpr std::size_t TILE_SIZE = 64;
+
+	// Updates cells [begin, end) of row i of "rate", "next" and "hops" via vertex k,
+	// where rateIK, nextIK and hopsIK are values of cell (i, k).
+	typedef void (*UpdateRowFunction)(double* rateRow, NextVertex* nextRow,
+		HopCount* hopsRow, const double* rateKRow, const HopCount* hopsKRow,
+		double rateIK, NextVertex nextIK, HopCount hopsIK, std::size_t begin, std::size_t end);
+
+	void updateRowScalar(double* rateRow, NextVertex* nextRow, HopCount* hopsRow,
+		const double* rateKRow, const HopCount* hopsKRow, const double rateIK,
+		const NextVertex nextIK, const HopCount hopsIK, const std::size_t begin,
+		const std::size_t end)
+	{
+		for (std::size_t j = begin; j < end; ++j) {
+			const auto newR = rateIK * rateKRow[j];
+			const auto newHops = hopsIK + hopsKRow[j];
+			const bool better = isBetterPath(newR, newHops, rateRow[j], hopsRow[j]);
+			rateRow[j] = better ? newR : rateRow[j];
+			nextRow[j] = better ? nextIK : nextRow[j];
+			hopsRow[j] = better ? newHops : hopsRow[j];
+		}
+	}
+
+#ifdef FLOYD_WARSALL_AVX2
+	// Gathers low halves of 4 x 64-bit comparison results into 4 x 32-bit mask
+	AVX2_FUNCTION inline __m128i packComparison(__m256d mask)
+	{
+		const auto packMask = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+		return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+			_mm256_castpd_si256(mask), packMask));
+	}
+
+	// Same as updateRowScalar. Requires begin and end to be multiples of 4
+	// and rows to be aligned to 32 bytes ("next" and "hops" rows to 16 bytes).
+	AVX2_FUNCTION void updateRowAvx2(double* rateRow, NextVertex* nextRow,
+		HopCount* hopsRow, const double* rateKRow, const HopCount* hopsKRow,
+		const double rateIK, const NextVertex nextIK, const HopCount hopsIK,
+		const std::size_t begin, const std::size_t end)
+	{
+		const auto rateIKVector = _mm256_set1_pd(rateIK);
+		const auto nextIKVector = _mm_set1_epi32(static_cast<int>(nextIK));
+		const auto hopsIKVector = _mm_set1_epi32(static_cast<int>(hopsIK));
+		const auto toleranceVector = _mm256_set1_pd(RATE_TOLERANCE_FACTOR);
+		for (std::size_t j = begin; j < end; j += 4) {
+			const auto r = _mm256_load_pd(rateRow + j);
+			const auto newR = _mm256_mul_pd(rateIKVector, _mm256_load_pd(rateKRow + j));
+			const auto hopsPtr = reinterpret_cast<__m128i*>(hopsRow + j);
+			const auto h = _mm_load_si128(hopsPtr);
+			const auto newH = _mm_add_epi32(hopsIKVector,
+				_mm_load_si128(reinterpret_cast<const __m128i*>(hopsKRow + j)));
+
+			// Same condition as isBetterPath(), hop counts are far below 2^31,
+			// so signed comparison is fine
+			const auto higher = packComparison(_mm256_cmp_pd(_mm256_mul_pd(r, toleranceVector),
+				newR, _CMP_LT_OQ));
+			const auto tie = packComparison(_mm256_cmp_pd(_mm256_mul_pd(newR, toleranceVector),
+				r, _CMP_GE_OQ));
+			const auto better = _mm_or_si128(higher, _mm_and_si128(tie, _mm_cmplt_epi32(newH, h)));
+
+			_mm256_store_pd(rateRow + j, _mm256_blendv_pd(r, newR,
+				_mm256_castsi256_pd(_mm256_cvtepi32_epi64(better))));
+			auto nextPtr = reinterpret_cast<__m128i*>(nextRow + j);
+			_mm_store_si128(nextPtr, _mm_blendv_epi8(_mm_load_si128(nextPtr), nextIKVector, better));
+			_mm_store_si128(hopsPtr, _mm_blendv_epi8(h, newH, better));
+		}
+	}
+
+	bool cpuSupportsAvx2()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) {
+			return false;
+		}
+		// Check that CPU supports AVX and OS saves AVX registers
+		__cpuid(info, 1);
+		constexpr int OSXSAVE = 1 << 27;
+		constexpr int AVX = 1 << 28;
+		if ((info[2] & (OSXSAVE | AVX)) != (OSXSAVE | AVX) || (_xgetbv(0) & 6) != 6) {
+			return false;
+		}
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+#endif
+
+	// Choose row update kernel for current CPU
+	UpdateRowFunction selectUpdateRowFunction()
+	{
+#ifdef FLOYD_WARSALL_AVX2
+		if (cpuSupportsAvx2()) {
+			return &updateRowAvx2;
+		}
+#endif
+		return &updateRowScalar;
+	}
+
+	// Row update kernel, see useScalarFloydWarsall()
+	UpdateRowFunction updateRow = selectUpdateRowFunction();
+
+	// Runs Floyd-Warsall iterations [kBegin, kEnd) on rows [iBegin, iEnd)
+	// and columns [jBegin, jEnd)
+	void processTile(FlatMatrix<double>& rate, FlatMatrix<NextVertex>& next,
+		FlatMatrix<HopCount>& hops, const std::size_t kBegin, const std::size_t kEnd,
+		const std::size_t iBegin, const std::size_t iEnd, const std::size_t jBegin,
+		const std::size_t jEnd)
+	{
+		for (std::size_t k = kBegin; k < kEnd; ++k) {
+			const auto rateKRow = rate.row(k);
+			const auto hopsKRow = hops.row(k);
+			for (std::size_t i = iBegin; i < iEnd; ++i) {
+				const auto rateRow = rate.row(i);
+				const auto rateIK = rateRow[k];
+				// Nothing to improve if there is no path from i to k
+				if (rateIK != 0.0) {
+					const auto nextRow = next.row(i);
+					const auto hopsRow = hops.row(i);
+					updateRow(rateRow, nextRow, hopsRow, rateKRow, hopsKRow, rateIK,
+						nextRow[k], hopsRow[k], jBegin, jEnd);
+				}
+			}
+		}
+	}
+}
+
+void computeBestRates(FlatMatrix<double>& rate, FlatMatrix<NextVertex>& next,
+	FlatMatrix<HopCount>& hops, ThreadPool* threadPool)
+{
+	// Blocked Floyd-Warsall. For each diagonal tile b: first process tile
+	// itself, then tiles in row and column b which depend only on it,
+	// then all remaining tiles which depend on row and column b.
+	// Tiles within second and third phase are independent of each other,
+	// so they can be processed in any order or in parallel.
+	// Last column tile spans to the end of padded row, so that row update
+	// range is always multiple of SIMD width. Padding cells have rate 0,
+	// so they are never updated. Rows of 32-bit "next" and "hops" cells
+	// are padded to the same alignment, so they are at least as long.
+	const auto n = rate.size();
+	const auto stride = rate.stride();
+	const auto tileCount = (n + TILE_SIZE - 1) / TILE_SIZE;
+	const auto rowEnd = [n](std::size_t begin) { return std::min(begin + TILE_SIZE, n); };
+	const auto columnEnd = [n, stride](std::size_t begin) {
+		return begin + TILE_SIZE >= n ? stride : begin + TILE_SIZE;
+	};
+	const auto runTasks = [threadPool](std::size_t taskCount,
+		const std::function<void(std::size_t)>& task) {
+		if (threadPool) {
+			threadPool->run(taskCount, task);
+		} else {
+			for (std::size_t i = 0; i < taskCount; ++i) {
+				task(i);
+			}
+		}
+	};
+	for (std::size_t b = 0; b < n; b += TILE_SIZE) {
+		const auto bEnd = rowEnd(b);
+		processTile(rate, next, hops, b, bEnd, b, bEnd, b, columnEnd(b));
+
+		// Tasks [0, tileCount) are tiles of row b, the rest are tiles of column b
+		runTasks(2 * tileCount, [&](std::size_t task) {
+			const auto t = task % tileCount * TILE_SIZE;
+			if (t == b) {
+				return;
+			}
+			if (task < tileCount) {
+				processTile(rate, next, hops, b, bEnd, b, bEnd, t, columnEnd(t));
+			} else {
+				processTile(rate, next, hops, b, bEnd, t, rowEnd(t), b, columnEnd(b));
+			}
+		});
+
+		runTasks(tileCount * tileCount, [&](std::size_t task) {
+			const auto i = task / tileCount * TILE_SIZE;
+			const auto j = task % tileCount * TILE_SIZE;
+			if (i != b && j != b) {
+				processTile(rate, next, hops, b, bEnd, i, rowEnd(i), j, columnEnd(j));
+			}
+		});
+	}
+}
+
+bool useScalarFloydWarsall(const bool scalar)
+{
+	updateRow = scalar ? &updateRowScalar : selectUpdateRowFunction();
+	return updateRow != &updateRowScalar;
+}
+
+bool reconstructPath(const FlatMatrix<NextVertex>& next, const std::size_t source,
+	const std::size_t destination, std::vector<std::size_t>& path, std::size_t& loopVertex)
+{
+	path.clear();
+	if (next(source, destination) == NO_NEXT_VERTEX) {
+		return true;
+	}
+
+	// Path without loop has at most n vertices, so longer walk has run into a loop.
+	// Repeated vertex is searched for only then, usual walk needs no visited set.
+	const auto n = next.size();
+	path.push_back(source);
+	auto u = source;
+	while (u != destination) {
+		if (path.size() == n) {
+			std::vector<bool> visited(n, false);
+			for (std::size_t i = 0; i < path.size(); ++i) {
+				if (visited[path[i]]) {
+					loopVertex = path[i];
+					path.resize(i);
+					return false;
+				}
+				visited[path[i]] = true;
+			}
+		}
+		u = next(u, destination);
+		path.push_back(u);
+	}
+	return true;
+}
@@ -0,0 +1,68 @@
+#ifndef FLOYD_WARSALL_H__
+#define FLOYD_WARSALL_H__
+
+#include "flat_matrix.h"
+#include "thread_pool.h"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Relative improvement of rate which is treated as rounding noise. Paths of equal
+// rate computed in different order may differ in last bits; without tolerance
+// such "improvements" can make "next" pointers loop over cycles of rate 1
+// (e.g. transfers between exchanges). Rate must exceed current one by this
+// factor to replace it, and cycle is profitable if its rate exceeds this factor.
+// Rates within this factor of each other are a tie, broken by number of hops.
+constexpr double RATE_TOLERANCE_FACTOR = 1.0 + 1e-12;
+
+// Cell of "next" table. 32-bit vertex index halves table size compared to std::size_t,
+// graph can't have that many vertices anyway as tables take n^2 cells.
+typedef std::uint32_t NextVertex;
+
+// Value of "next" table cell when there is no path
+constexpr NextVertex NO_NEXT_VERTEX = std::numeric_limits<NextVertex>::max();
+
+// Cell of "hops" table: number of edges of best path, 0 if there is no path
+typedef std::uint32_t HopCount;
+
+// Returns true if path of rate newRate and newHops edges is better than path of
+// given rate and hops: its rate is higher beyond tolerance, or rates are equal
+// within tolerance and it has fewer edges. Any path is better than no path
+// (rate 0, 0 hops), no path is never better.
+inline bool isBetterPath(double newRate, HopCount newHops, double rate, HopCount hops) noexcept
+{
+	return rate * RATE_TOLERANCE_FACTOR < newRate
+		|| (newRate * RATE_TOLERANCE_FACTOR >= rate && newHops < hops);
+}
+
+// Modified Floyd-Warsall algorithm: finds paths with best (maximal) product
+// of rates instead of shortest sum of distances. Among paths of equal rate
+// (see RATE_TOLERANCE_FACTOR) the one with fewer edges is chosen, so result
+// doesn't depend on order in which ties are met.
+// On input "rate" contains edge rates (0 if there is no edge, padding cells
+// must be 0 too), "next" contains destination vertex for each present edge
+// and "hops" contains 1 for each present edge and 0 elsewhere, padding included.
+// On output "rate" contains best rates, "next" contains next vertex
+// on the best path and "hops" number of its edges for each (source, destination) pair.
+// Matrix is processed in cache-sized tiles, rows are updated branchless
+// using AVX2 if CPU supports it. If thread pool is given, independent tiles
+// of each phase are processed in parallel; result is identical to serial run.
+void computeBestRates(FlatMatrix<double>& rate, FlatMatrix<NextVertex>& next,
+	FlatMatrix<HopCount>& hops, ThreadPool* threadPool = nullptr);
+
+// Makes computeBestRates() update rows with portable scalar code even if CPU
+// supports AVX2, or goes back to the kernel chosen for CPU. Used by benchmarks
+// and to check the fallback; must not be called while computation runs.
+// Returns true if AVX2 kernel is in use afterwards.
+bool useScalarFloydWarsall(bool scalar);
+
+// Reconstructs best path from source to destination using "next" table
+// produced by computeBestRates(), where NO_NEXT_VERTEX marks absent path.
+// Path is left empty if destination is unreachable. Returns false if path
+// runs into a loop, which is possible when graph has profitable cycles;
+// then "path" holds vertices before the loop and "loopVertex" is the repeated one.
+bool reconstructPath(const FlatMatrix<NextVertex>& next, std::size_t source,
+	std::size_t destination, std::vector<std::size_t>& path, std::size_t& loopVertex);
+
+#endif // FLOYD_WARSALL_H__
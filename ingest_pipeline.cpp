@@ -0,0 +1,219 @@
+#include "ingest_pipeline.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+	// Returns parser count if it is valid. Ring size is derived from it,
+	// so it must be checked before ring is allocated.
+	std::size_t checkParserCount(const std::size_t parserCount)
+	{
+		if (parserCount < 1 || parserCount > MAX_THREAD_COUNT) {
+			throw std::invalid_argument("invalid number of parser threads");
+		}
+		return parserCount;
+	}
+}
+
+IngestPipeline::IngestPipeline(ExchangeRateProcessor& processor, const std::size_t parserCount,
+	const std::size_t chunkSize) :
+	m_processor(processor),
+	m_parserCount(checkParserCount(parserCount)),
+	m_chunkSize(std::max<std::size_t>(chunkSize, 1)),
+	// Enough slots to keep every parser busy while reader and applier work on others
+	m_chunks(2 * m_parserCount + 2),
+	m_mutex(),
+	m_chunkFree(),
+	m_chunkRead(),
+	m_chunkParsed(),
+	m_readCount(0),
+	m_nextToParse(0),
+	m_readerDone(false)
+{
+}
+
+std::size_t IngestPipeline::run(std::istream& stream)
+{
+	// Tail of the last read block which doesn't end with newline yet
+	std::string carry;
+	return execute([this, &stream, &carry](Chunk& chunk) {
+		chunk.buffer.swap(carry);
+		carry.clear();
+		for (;;) {
+			// Append next block of input
+			const auto offset = chunk.buffer.size();
+			chunk.buffer.resize(offset + m_chunkSize);
+			stream.read(&chunk.buffer[offset], m_chunkSize);
+			chunk.buffer.resize(offset + static_cast<std::size_t>(stream.gcount()));
+			if (!stream) {
+				// End of input, last line may lack newline
+				chunk.data = chunk.buffer;
+				return !chunk.buffer.empty();
+			}
+
+			// Cut chunk after the last complete line, keep the rest for next chunk.
+			// If there is no complete line yet, line is longer than block, read more.
+			const auto lastNewline = chunk.buffer.rfind('\n');
+			if (lastNewline != std::string::npos && lastNewline >= offset) {
+				carry.assign(chunk.buffer, lastNewline + 1, std::string::npos);
+				chunk.buffer.resize(lastNewline + 1);
+				chunk.data = chunk.buffer;
+				return true;
+			}
+		}
+	});
+}
+
+std::size_t IngestPipeline::run(std::string_view data)
+{
+	return execute([this, &data](Chunk& chunk) {
+		if (data.empty()) {
+			return false;
+		}
+
+		// Take at least chunk size bytes and extend to the end of line
+		auto length = std::min(m_chunkSize, data.length());
+		if (length < data.length()) {
+			const auto newline = data.find('\n', length - 1);
+			length = newline == std::string_view::npos ? data.length() : newline + 1;
+		}
+		chunk.data = data.substr(0, length);
+		data.remove_prefix(length);
+		return true;
+	});
+}
+
+std::size_t IngestPipeline::execute(const std::function<bool(Chunk&)>& readChunk)
+{
+	m_readCount = 0;
+	m_nextToParse = 0;
+	m_readerDone = false;
+	for (auto& chunk : m_chunks) {
+		chunk.state = Chunk::State::Free;
+	}
+
+	std::thread reader(&IngestPipeline::readerLoop, this, std::cref(readChunk));
+	std::vector<std::thread> parsers;
+	for (std::size_t i = 0; i < m_parserCount; ++i) {
+		parsers.emplace_back(&IngestPipeline::parserLoop, this);
+	}
+
+	// Apply chunks in sequence order on calling thread
+	std::size_t byteCount = 0;
+	for (std::uint64_t sequence = 0; ; ++sequence) {
+		auto& chunk = m_chunks[sequence % m_chunks.size()];
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			const auto ready = [&] {
+				return (sequence < m_readCount && chunk.state == Chunk::State::Parsed)
+					|| (m_readerDone && sequence == m_readCount);
+			};
+			if (!ready()) {
+				// Input is not ready yet, write out responses given so far
+				// instead of holding them while waiting
+				lock.unlock();
+				m_processor.flushOutput();
+				lock.lock();
+				m_chunkParsed.wait(lock, ready);
+			}
+			if (sequence == m_readCount) {
+				break;
+			}
+		}
+
+		for (std::size_t i = 0; i < chunk.lines.size(); ++i) {
+			m_processor.applyLine(chunk.parsedLines[i], chunk.lines[i]);
+		}
+		byteCount += chunk.data.length();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			chunk.state = Chunk::State::Free;
+		}
+		m_chunkFree.notify_one();
+	}
+
+	reader.join();
+	for (auto& parser : parsers) {
+		parser.join();
+	}
+	return byteCount;
+}
+
+void IngestPipeline::readerLoop(const std::function<bool(Chunk&)>& readChunk)
+{
+	for (std::uint64_t sequence = 0; ; ++sequence) {
+		auto& chunk = m_chunks[sequence % m_chunks.size()];
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_chunkFree.wait(lock, [&] { return chunk.state == Chunk::State::Free; });
+		}
+
+		// Slot is owned by reader until it is published
+		const bool hasData = readChunk(chunk);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (hasData) {
+				chunk.state = Chunk::State::Read;
+				++m_readCount;
+			} else {
+				m_readerDone = true;
+			}
+		}
+		m_chunkRead.notify_all();
+		if (!hasData) {
+			// Wake applier waiting for chunk which will never come
+			m_chunkParsed.notify_all();
+			return;
+		}
+	}
+}
+
+void IngestPipeline::parserLoop()
+{
+	for (;;) {
+		Chunk* chunk = nullptr;
+		{
+			// Take next read chunk, chunks are parsed in any order
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_chunkRead.wait(lock, [this] {
+				return m_nextToParse < m_readCount || m_readerDone;
+			});
+			if (m_nextToParse == m_readCount) {
+				return;
+			}
+			chunk = &m_chunks[m_nextToParse++ % m_chunks.size()];
+			chunk->state = Chunk::State::Parsing;
+		}
+
+		parseChunk(*chunk);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			chunk->state = Chunk::State::Parsed;
+		}
+		m_chunkParsed.notify_all();
+	}
+}
+
+void IngestPipeline::parseChunk(Chunk& chunk)
+{
+	chunk.lines.clear();
+	chunk.parsedLines.clear();
+	const char* position = chunk.data.data();
+	const char* const end = position + chunk.data.length();
+	while (position != end) {
+		const char* newline = static_cast<const char*>(
+			std::memchr(position, '\n', end - position));
+		const char* lineEnd = newline ? newline : end;
+		chunk.lines.emplace_back(position, lineEnd - position);
+		position = newline ? newline + 1 : end;
+	}
+
+	chunk.parsedLines.reserve(chunk.lines.size());
+	for (const auto line : chunk.lines) {
+		chunk.parsedLines.push_back(ExchangeRateProcessor::parseLine(line));
+	}
+}
@@ -0,0 +1,117 @@
+#ifndef INGEST_PIPELINE_H__
+#define INGEST_PIPELINE_H__
+
+#include "exchange_rate_processor.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Pipelined ingest of input data. Reader thread splits input into chunks
+// of whole lines, parser threads parse chunks concurrently, and calling
+// thread applies parsed lines to processor strictly in input order,
+// so output is exactly the same as with sequential processing.
+// Chunks circulate through fixed ring of slots, which bounds memory use.
+class IngestPipeline {
+public:
+	// Default number of input bytes per chunk
+	static constexpr std::size_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+
+	// Creates pipeline feeding given processor using given number of parser threads,
+	// from 1 to MAX_THREAD_COUNT, otherwise throws std::invalid_argument.
+	IngestPipeline(ExchangeRateProcessor& processor, std::size_t parserCount,
+		std::size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+	IngestPipeline(const IngestPipeline&) = delete;
+	IngestPipeline& operator=(const IngestPipeline&) = delete;
+
+	// Processes stream until end of stream or error. Returns number of bytes processed.
+	std::size_t run(std::istream& stream);
+
+	// Processes data which is already in memory, e.g. mapped file.
+	// Returns number of bytes processed.
+	std::size_t run(std::string_view data);
+
+private:
+	// Chunk of input consisting of whole lines
+	struct Chunk {
+		enum class State {
+			// Slot can be filled by reader
+			Free,
+
+			// Chunk is read and waits for parser
+			Read,
+
+			// Chunk is being parsed
+			Parsing,
+
+			// Chunk is parsed and waits for applier
+			Parsed
+		};
+
+		State state = State::Free;
+
+		// Storage for data read from stream, unused for in-memory input
+		std::string buffer;
+
+		// Chunk data
+		std::string_view data;
+
+		// Lines of chunk and their parsing results
+		std::vector<std::string_view> lines;
+		std::vector<ParsedLine> parsedLines;
+	};
+
+	// Runs pipeline. readChunk fills data of given chunk and returns false
+	// at the end of input. Returns number of bytes processed.
+	std::size_t execute(const std::function<bool(Chunk&)>& readChunk);
+
+	// Reader thread main function
+	void readerLoop(const std::function<bool(Chunk&)>& readChunk);
+
+	// Parser thread main function
+	void parserLoop();
+
+	// Splits chunk into lines and parses them
+	static void parseChunk(Chunk& chunk);
+
+	// Processor receiving parsed lines
+	ExchangeRateProcessor& m_processor;
+
+	// Number of parser threads
+	const std::size_t m_parserCount;
+
+	// Number of input bytes per chunk
+	const std::size_t m_chunkSize;
+
+	// Ring of chunk slots, chunk with sequence number s lives in slot s % size
+	std::vector<Chunk> m_chunks;
+
+	// Protects chunk states and sequence counters
+	std::mutex m_mutex;
+
+	// Signalled when chunk slot becomes free
+	std::condition_variable m_chunkFree;
+
+	// Signalled when chunk is read or reader finished
+	std::condition_variable m_chunkRead;
+
+	// Signalled when chunk is parsed
+	std::condition_variable m_chunkParsed;
+
+	// Number of chunks read so far
+	std::uint64_t m_readCount;
+
+	// Sequence number of next chunk to parse
+	std::uint64_t m_nextToParse;
+
+	// Indicates that reader reached end of input
+	bool m_readerDone;
+};
+
+#endif // INGEST_PIPELINE_H__
@@ -1,42 +1,488 @@
+#include "binary_protocol.h"
 #include "exchange_rate_processor.h"
+#include "ingest_pipeline.h"
+#include "mapped_file.h"
+#include "socket_server.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace {
+	const char* const ENGINE_OPTION = "--engine=";
+	const char* const ENGINE_ALL_PAIRS = "all-pairs";
+	const char* const ENGINE_SINGLE_SOURCE = "single-source";
+	const char* const PROTOCOL_OPTION = "--protocol=";
+	const char* const PROTOCOL_TEXT = "text";
+	const char* const PROTOCOL_BINARY = "binary";
+	const char* const THREADS_OPTION = "--threads=";
+	const char* const RESERVE_OPTION = "--reserve=";
+	const char* const OUTPUT_BUFFER_OPTION = "--output-buffer=";
+	const char* const FLUSH_PER_RESPONSE_OPTION = "--flush-per-response";
+	const char* const EXTENDED_RESPONSE_OPTION = "--extended-response";
+	const char* const REPORT_ARBITRAGE_OPTION = "--report-arbitrage";
+	const char* const MAX_QUOTE_AGE_OPTION = "--max-quote-age=";
+	const char* const REPLAY_OPTION = "--replay=";
+	const char* const STATS_OPTION = "--stats";
+	const char* const PARSE_THREADS_OPTION = "--parse-threads=";
+	const char* const LOAD_STATE_OPTION = "--load-state=";
+	const char* const SAVE_STATE_OPTION = "--save-state=";
+	const char* const SAVE_STATE_INTERVAL_OPTION = "--save-state-interval=";
+	const char* const LISTEN_OPTION = "--listen=";
+	const char* const FEED_LISTEN_OPTION = "--feed-listen=";
+	const char* const QUERY_THREADS_OPTION = "--query-threads=";
+	const char* const SNAPSHOT_INTERVAL_OPTION = "--snapshot-interval=";
+
+	// Command line settings not related to processor options
+	struct CommandLine {
+		// Input file name, nullptr for standard input
+		const char* inputFileName = nullptr;
+
+		// Expected number of exchanges and currencies, 0 if unknown
+		std::size_t exchangeCount = 0;
+		std::size_t currencyCount = 0;
+
+		// File to replay through memory mapping, nullptr if input is read as stream
+		const char* replayFileName = nullptr;
+
+		// Report input throughput to standard error at exit
+		bool printStats = false;
+
+		// Number of parser threads of ingest pipeline, 0 for sequential processing
+		std::size_t parseThreadCount = 0;
+
+		// State file to restore graph from before processing input, nullptr if none
+		const char* loadStateFileName = nullptr;
+
+		// Unix domain socket paths of server mode for query connections and
+		// feed connection, nullptr if input is not served over sockets
+		const char* listenPath = nullptr;
+		const char* feedListenPath = nullptr;
+
+		// Number of server threads answering query connections, 0 if not set
+		std::size_t queryThreadCount = 0;
+
+		// Minimal interval between snapshots of server mode in milliseconds,
+		// -1 if not set
+		long snapshotInterval = -1;
+	};
+
+	// Returns value of command line argument if it starts with given option prefix,
+	// otherwise returns nullptr.
+	const char* getOptionValue(const char* arg, const char* option)
+	{
+		const auto length = std::strlen(option);
+		return std::strncmp(arg, option, length) == 0 ? arg + length : nullptr;
+	}
+
+	// Parses thread count option value, 0 means one thread per hardware thread.
+	// Returns false if value is not a number from 0 to MAX_THREAD_COUNT;
+	// strtoul would accept minus sign and wrap negative value around.
+	bool parseThreadCount(const char* value, std::size_t& threadCount)
+	{
+		char* end = nullptr;
+		errno = 0;
+		const auto count = std::strtoul(value, &end, 10);
+		if (!std::isdigit(static_cast<unsigned char>(*value)) || *end || errno == ERANGE
+			|| count > MAX_THREAD_COUNT) {
+			return false;
+		}
+		threadCount = count ? count : std::max(1u, std::thread::hardware_concurrency());
+		return true;
+	}
+
+	// Parse options from command line. Returns false on invalid option.
+	// In debug build single non-option argument is accepted as input file name.
+	bool parseCommandLine(int argc, char** argv, ExchangeRateProcessorOptions& options,
+		CommandLine& commandLine)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const char* arg = argv[i];
+			if (const char* value = getOptionValue(arg, ENGINE_OPTION)) {
+				if (std::strcmp(value, ENGINE_ALL_PAIRS) == 0) {
+					options.routingEngine = RoutingEngine::AllPairs;
+				} else if (std::strcmp(value, ENGINE_SINGLE_SOURCE) == 0) {
+					options.routingEngine = RoutingEngine::SingleSource;
+				} else {
+					std::cerr << "Error: Unknown routing engine " << value << std::endl;
+					return false;
+				}
+			} else if (const char* value = getOptionValue(arg, PROTOCOL_OPTION)) {
+				if (std::strcmp(value, PROTOCOL_TEXT) == 0) {
+					options.protocol = WireProtocol::Text;
+				} else if (std::strcmp(value, PROTOCOL_BINARY) == 0) {
+					options.protocol = WireProtocol::Binary;
+				} else {
+					std::cerr << "Error: Unknown protocol " << value << std::endl;
+					return false;
+				}
+			} else if (const char* value = getOptionValue(arg, THREADS_OPTION)) {
+				if (!parseThreadCount(value, options.threadCount)) {
+					std::cerr << "Error: Invalid thread count " << value << ", expected 0 to "
+						<< MAX_THREAD_COUNT << std::endl;
+					return false;
+				}
+			} else if (const char* value = getOptionValue(arg, RESERVE_OPTION)) {
+				// Format is <exchanges>,<currencies>, strtoul would accept minus sign
+				char* end = nullptr;
+				errno = 0;
+				commandLine.exchangeCount = std::strtoul(value, &end, 10);
+				if (!std::isdigit(static_cast<unsigned char>(*value)) || *end != ',') {
+					std::cerr << "Error: Invalid catalogue size " << value << std::endl;
+					return false;
+				}
+				const char* currencies = end + 1;
+				commandLine.currencyCount = std::strtoul(currencies, &end, 10);
+				if (!std::isdigit(static_cast<unsigned char>(*currencies)) || *end) {
+					std::cerr << "Error: Invalid catalogue size " << value << std::endl;
+					return false;
+				}
+
+				// Exchange/currency pairs and transfer hubs must fit vertex indices
+				if (errno == ERANGE || (commandLine.currencyCount
+					&& commandLine.exchangeCount >= MAX_VERTEX_COUNT / commandLine.currencyCount)) {
+					std::cerr << "Error: Catalogue size " << value << " is too large, (exchanges + 1)"
+						" * currencies must not exceed " << MAX_VERTEX_COUNT << std::endl;
+					return false;
+				}
+			} else if (const char* value = getOptionValue(arg, OUTPUT_BUFFER_OPTION)) {
+				// strtoul would accept minus sign
+				char* end = nullptr;
+				errno = 0;
+				options.outputBufferSize = std::strtoul(value, &end, 10);
+				if (!std::isdigit(static_cast<unsigned char>(*value)) || *end || errno == ERANGE
+					|| options.outputBufferSize > MAX_OUTPUT_BUFFER_SIZE) {
+					std::cerr << "Error: Invalid output buffer size " << value << ", expected 0 to "
+						<< MAX_OUTPUT_BUFFER_SIZE << std::endl;
+					return false;
+				}
+			} else if (std::strcmp(arg, FLUSH_PER_RESPONSE_OPTION) == 0) {
+				options.flushPerResponse = true;
+			} else if (std::strcmp(arg, EXTENDED_RESPONSE_OPTION) == 0) {
+				options.extendedResponses = true;
+			} else if (std::strcmp(arg, REPORT_ARBITRAGE_OPTION) == 0) {
+				options.reportArbitrage = true;
+			} else if (const char* value = getOptionValue(arg, MAX_QUOTE_AGE_OPTION)) {
+				// 64-bit parse, long is 32-bit on Windows
+				char* end = nullptr;
+				errno = 0;
+				const auto maxQuoteAge = std::strtoll(value, &end, 10);
+				if (!*value || *end || errno == ERANGE || maxQuoteAge < 0
+					|| maxQuoteAge > MAX_QUOTE_AGE) {
+					std::cerr << "Error: Invalid quote age " << value << std::endl;
+					return false;
+				}
+				options.maxQuoteAge = static_cast<std::time_t>(maxQuoteAge);
+			} else if (const char* value = getOptionValue(arg, REPLAY_OPTION)) {
+				commandLine.replayFileName = value;
+			} else if (std::strcmp(arg, STATS_OPTION) == 0) {
+				commandLine.printStats = true;
+			} else if (const char* value = getOptionValue(arg, PARSE_THREADS_OPTION)) {
+				if (!parseThreadCount(value, commandLine.parseThreadCount)) {
+					std::cerr << "Error: Invalid parser thread count " << value << ", expected 0 to "
+						<< MAX_THREAD_COUNT << std::endl;
+					return false;
+				}
+			} else if (const char* value = getOptionValue(arg, LOAD_STATE_OPTION)) {
+				commandLine.loadStateFileName = value;
+			} else if (const char* value = getOptionValue(arg, SAVE_STATE_OPTION)) {
+				options.stateFileName = value;
+			} else if (const char* value = getOptionValue(arg, SAVE_STATE_INTERVAL_OPTION)) {
+				char* end = nullptr;
+				options.stateSaveInterval = std::strtol(value, &end, 10);
+				if (!*value || *end || options.stateSaveInterval < 0) {
+					std::cerr << "Error: Invalid state save interval " << value << std::endl;
+					return false;
+				}
+			} else if (const char* value = getOptionValue(arg, LISTEN_OPTION)) {
+				commandLine.listenPath = value;
+			} else if (const char* value = getOptionValue(arg, FEED_LISTEN_OPTION)) {
+				commandLine.feedListenPath = value;
+			} else if (const char* value = getOptionValue(arg, QUERY_THREADS_OPTION)) {
+				if (!parseThreadCount(value, commandLine.queryThreadCount)) {
+					std::cerr << "Error: Invalid query thread count " << value << ", expected 0 to "
+						<< MAX_THREAD_COUNT << std::endl;
+					return false;
+				}
+			} else if (const char* value = getOptionValue(arg, SNAPSHOT_INTERVAL_OPTION)) {
+				char* end = nullptr;
+				commandLine.snapshotInterval = std::strtol(value, &end, 10);
+				if (!*value || *end || commandLine.snapshotInterval < 0) {
+					std::cerr << "Error: Invalid snapshot interval " << value << std::endl;
+					return false;
+				}
+#ifdef _DEBUG
+			} else if (arg[0] != '-' && !commandLine.inputFileName) {
+				commandLine.inputFileName = arg;
+#endif
+			} else {
+				std::cerr << "Error: Invalid command line argument " << arg << std::endl;
+				return false;
+			}
+		}
+		if (options.stateSaveInterval && options.stateFileName.empty()) {
+			std::cerr << "Error: State save interval requires state file" << std::endl;
+			return false;
+		}
+		if (options.protocol == WireProtocol::Binary && commandLine.parseThreadCount) {
+			std::cerr << "Error: Parser threads are not used with binary protocol" << std::endl;
+			return false;
+		}
+		if ((commandLine.feedListenPath || commandLine.queryThreadCount
+			|| commandLine.snapshotInterval >= 0) && !commandLine.listenPath) {
+			std::cerr << "Error: Feed socket, query threads and snapshot interval require"
+				" server mode" << std::endl;
+			return false;
+		}
+		if (commandLine.listenPath && (options.protocol == WireProtocol::Binary
+			|| commandLine.replayFileName || commandLine.parseThreadCount)) {
+			std::cerr << "Error: Server mode serves text protocol and reads no other input"
+				<< std::endl;
+			return false;
+		}
+
+		// Server sends responses to connection which requested them
+		options.captureResponses = commandLine.listenPath != nullptr;
+		return true;
+	}
+
+	// Feed every line of memory-mapped file to processor without copying.
+	// Lines are parsed by pipeline if parseThreadCount is not 0.
+	// Returns number of bytes processed.
+	std::size_t replayFile(const char* fileName, ExchangeRateProcessor& processor,
+		std::size_t parseThreadCount)
+	{
+		const MappedFile file(fileName);
+		const auto contents = file.contents();
+		if (parseThreadCount) {
+			return IngestPipeline(processor, parseThreadCount).run(contents);
+		}
+
+		const char* position = contents.data();
+		const char* const end = position + contents.size();
+		while (position != end) {
+			// memchr is vectorized by C runtime, it scans many bytes per instruction
+			const char* newline = static_cast<const char*>(
+				std::memchr(position, '\n', end - position));
+			const char* lineEnd = newline ? newline : end;
+			processor.processData(std::string_view(position, lineEnd - position));
+			position = newline ? newline + 1 : end;
+		}
+		return contents.size();
+	}
+
+	// Feed every frame of memory-mapped file of binary protocol to processor
+	// without copying. Returns number of bytes processed, throws
+	// std::runtime_error if frame length is invalid.
+	std::size_t replayBinaryFile(const char* fileName, ExchangeRateProcessor& processor)
+	{
+		const MappedFile file(fileName);
+		auto contents = file.contents();
+		while (!contents.empty()) {
+			std::uint32_t length = 0;
+			if (contents.length() < BINARY_FRAME_PREFIX_SIZE) {
+				throw std::runtime_error("Truncated binary frame");
+			}
+			std::memcpy(&length, contents.data(), BINARY_FRAME_PREFIX_SIZE);
+			contents.remove_prefix(BINARY_FRAME_PREFIX_SIZE);
+			if (length > MAX_BINARY_FRAME_SIZE || length > contents.length()) {
+				throw std::runtime_error("Invalid length of binary frame");
+			}
+			processor.processFrame(contents.substr(0, length));
+			contents.remove_prefix(length);
+		}
+		return file.contents().size();
+	}
+
+	// Read frames of binary protocol from input stream until end of stream or
+	// error, process each frame using processor. Buffered responses are written
+	// out whenever input has no more buffered data. Returns number of bytes
+	// processed. Invalid frame length stops reading, stream can't be resynchronized.
+	std::size_t processBinaryStream(std::istream& inputStream, ExchangeRateProcessor& processor)
+	{
+		std::size_t byteCount = 0;
+		std::string frame;
+		std::uint32_t length = 0;
+		while (inputStream.read(reinterpret_cast<char*>(&length), BINARY_FRAME_PREFIX_SIZE)) {
+			if (length > MAX_BINARY_FRAME_SIZE) {
+				std::cerr << "Error: Invalid length of binary frame" << std::endl;
+				break;
+			}
+			frame.resize(length);
+			if (!inputStream.read(&frame[0], length)) {
+				std::cerr << "Error: Truncated binary frame" << std::endl;
+				break;
+			}
+			byteCount += BINARY_FRAME_PREFIX_SIZE + length;
+			processor.processFrame(frame);
+			if (inputStream.rdbuf()->in_avail() <= 0) {
+				processor.flushOutput();
+			}
+		}
+		return byteCount;
+	}
+
+	// Read input stream line by line until end of stream or error,
+	// process each line using processor. Buffered responses are written out
+	// whenever input has no more buffered data, i.e. next read may block.
+	// Returns number of bytes processed.
+	std::size_t processStream(std::istream& inputStream, ExchangeRateProcessor& processor)
+	{
+		std::size_t byteCount = 0;
+		std::string line;
+		while (std::getline(inputStream, line)) {
+			byteCount += line.length() + 1;
+			processor.processData(line);
+			if (inputStream.rdbuf()->in_avail() <= 0) {
+				processor.flushOutput();
+			}
+		}
+		return byteCount;
+	}
+}
 
 int main(int argc, char** argv)
 {
+	// Standard streams are not mixed with C stdio, so let them buffer independently.
+	// Input is not tied to output, processor flushes responses itself.
+	std::ios::sync_with_stdio(false);
+	std::cin.tie(nullptr);
+
+	// Parse command line
+	ExchangeRateProcessorOptions options;
+	CommandLine commandLine;
+	if (!parseCommandLine(argc, argv, options, commandLine)) {
+		return 1;
+	}
+
+#ifdef _WIN32
+	// Binary frames must pass standard streams without newline translation
+	if (options.protocol == WireProtocol::Binary) {
+		_setmode(_fileno(stdin), _O_BINARY);
+		_setmode(_fileno(stdout), _O_BINARY);
+	}
+#endif
+
 	// Set input stream to standard input
 	std::istream* inputStream = &std::cin;
 
 	// In debug build we allow passing input file name on the command line,
 	// it makes it easier to debug. In release build this functionality
-	// is not included. 
-#ifdef _DEBUG
+	// is not included.
 	std::unique_ptr<std::ifstream> inputFile;
-	if (argc > 1) {
+	if (commandLine.inputFileName) {
 		// Try open specified input file.
-		inputFile.reset(new std::ifstream(argv[1]));
+		inputFile.reset(new std::ifstream(commandLine.inputFileName,
+			options.protocol == WireProtocol::Binary ? std::ios::binary : std::ios::in));
 		if (!inputFile->is_open()) {
 			// Failed to open file, report error and exit.
-			std::cerr << "Error: Can't open input file " << argv[1] << std::endl;
+			std::cerr << "Error: Can't open input file " << commandLine.inputFileName << std::endl;
 			return 1;
 		} else {
 			// Set input stream to file stream
 			inputStream = inputFile.get();
 		}
 	}
-#endif
 
-	// Create exchange processor instance
-	ExchangeRateProcessor processor;
+	// Create exchange processor instance, output buffer is allocated up front
+	std::unique_ptr<ExchangeRateProcessor> processorInstance;
+	try {
+		processorInstance = std::make_unique<ExchangeRateProcessor>(options);
+	} catch (std::exception& ex) {
+		std::cerr << "Error: Can't create processor with output buffer of "
+			<< options.outputBufferSize << " bytes (" << ex.what() << ")" << std::endl;
+		return 1;
+	}
+	ExchangeRateProcessor& processor = *processorInstance;
+	try {
+		processor.reserve(commandLine.exchangeCount, commandLine.currencyCount);
+	} catch (std::exception& ex) {
+		// All-pairs engine needs memory quadratic in catalogue size
+		std::cerr << "Error: Can't reserve storage for catalogue of " << commandLine.exchangeCount
+			<< " exchanges and " << commandLine.currencyCount << " currencies (" << ex.what()
+			<< ")" << std::endl;
+		return 1;
+	}
 
-	// Read input stream line by line until end of stream or error,
-	// process each line using processor.
-	std::string line;
-	while (std::getline(*inputStream, line)) {
-		processor.processData(line);
+	// Warm start from saved state, input is expected to continue it
+	if (commandLine.loadStateFileName) {
+		try {
+			processor.loadState(commandLine.loadStateFileName);
+		} catch (std::exception& ex) {
+			std::cerr << "Error: " << ex.what() << std::endl;
+			return 1;
+		}
 	}
 
-	// If EOF reached, return success exit code (0), otherwise indicate error
-	return inputStream->eof() ? 0 : 2;
+	const auto startTime = std::chrono::steady_clock::now();
+	std::size_t byteCount = 0;
+	int exitCode = 0;
+	if (commandLine.replayFileName) {
+		// Replay historical file. Best rates are recomputed lazily on
+		// the first request after run of price lines, not per line.
+		try {
+			byteCount = options.protocol == WireProtocol::Binary
+				? replayBinaryFile(commandLine.replayFileName, processor)
+				: replayFile(commandLine.replayFileName, processor, commandLine.parseThreadCount);
+		} catch (std::exception& ex) {
+			std::cerr << "Error: " << ex.what() << std::endl;
+			exitCode = 1;
+		}
+	} else if (commandLine.listenPath) {
+		// Serve clients until stop signal
+		try {
+			SocketServer server(processor, commandLine.listenPath,
+				commandLine.feedListenPath ? commandLine.feedListenPath : "",
+				std::max<std::size_t>(commandLine.queryThreadCount, 1),
+				commandLine.snapshotInterval >= 0
+					? std::chrono::milliseconds(commandLine.snapshotInterval)
+					: SocketServer::DEFAULT_SNAPSHOT_INTERVAL);
+			byteCount = server.run();
+		} catch (std::exception& ex) {
+			std::cerr << "Error: " << ex.what() << std::endl;
+			exitCode = 1;
+		}
+	} else {
+		if (options.protocol == WireProtocol::Binary) {
+			byteCount = processBinaryStream(*inputStream, processor);
+		} else {
+			byteCount = commandLine.parseThreadCount
+				? IngestPipeline(processor, commandLine.parseThreadCount).run(*inputStream)
+				: processStream(*inputStream, processor);
+		}
+
+		// If EOF reached, return success exit code (0), otherwise indicate error
+		exitCode = inputStream->eof() ? 0 : 2;
+	}
+	processor.flushOutput();
+
+	// Final state, so that next run continues where this one stopped
+	if (!options.stateFileName.empty()) {
+		try {
+			processor.saveState(options.stateFileName);
+		} catch (std::exception& ex) {
+			std::cerr << "Error: " << ex.what() << std::endl;
+			exitCode = 1;
+		}
+	}
+
+	if (commandLine.printStats) {
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+		std::cerr << "Processed " << byteCount << " bytes in " << elapsed.count() << " s, "
+			<< (elapsed.count() > 0 ? byteCount / elapsed.count() / 1e6 : 0.0) << " MB/s"
+			<< std::endl;
+	}
+	return exitCode;
 }
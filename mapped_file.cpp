@@ -0,0 +1,117 @@
+#include "mapped_file.h"
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const char* fileName) :
+	m_data(nullptr),
+	m_size(0),
+	m_file(INVALID_HANDLE_VALUE),
+	m_mapping(nullptr)
+{
+	m_file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error(std::string("Can't open input file ") + fileName);
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size)) {
+		close();
+		throw std::runtime_error(std::string("Can't get size of input file ") + fileName);
+	}
+	m_size = static_cast<std::size_t>(size.QuadPart);
+
+	// Empty file can't be mapped, it is represented by empty contents
+	if (m_size == 0) {
+		return;
+	}
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping) {
+		m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	}
+	if (!m_data) {
+		close();
+		throw std::runtime_error(std::string("Can't map input file ") + fileName);
+	}
+}
+
+void MappedFile::close() noexcept
+{
+	if (m_data) {
+		UnmapViewOfFile(m_data);
+		m_data = nullptr;
+	}
+	if (m_mapping) {
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+	if (m_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+}
+
+#else
+
+MappedFile::MappedFile(const char* fileName) :
+	m_data(nullptr),
+	m_size(0)
+{
+	const int fd = open(fileName, O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error(std::string("Can't open input file ") + fileName);
+	}
+
+	struct stat status;
+	if (fstat(fd, &status) != 0) {
+		::close(fd);
+		throw std::runtime_error(std::string("Can't get size of input file ") + fileName);
+	}
+	m_size = static_cast<std::size_t>(status.st_size);
+
+	// Empty file can't be mapped, it is represented by empty contents
+	if (m_size == 0) {
+		::close(fd);
+		return;
+	}
+
+	// Mapping stays valid after descriptor is closed
+	void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		throw std::runtime_error(std::string("Can't map input file ") + fileName);
+	}
+	m_data = static_cast<const char*>(data);
+
+	// File is read once from start to end
+	madvise(data, m_size, MADV_SEQUENTIAL);
+}
+
+void MappedFile::close() noexcept
+{
+	if (m_data) {
+		munmap(const_cast<char*>(m_data), m_size);
+		m_data = nullptr;
+	}
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
@@ -0,0 +1,43 @@
+#ifndef MAPPED_FILE_H__
+#define MAPPED_FILE_H__
+
+#include <cstddef>
+#include <string_view>
+
+// Read-only memory mapping of whole file.
+// Throws std::runtime_error if file can't be opened or mapped.
+class MappedFile {
+public:
+	// Maps given file into memory
+	explicit MappedFile(const char* fileName);
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Unmaps file
+	~MappedFile();
+
+	// Returns file contents
+	std::string_view contents() const noexcept
+	{
+		return std::string_view(m_data, m_size);
+	}
+
+private:
+	// Releases mapping and file handles
+	void close() noexcept;
+
+	// Start of mapped region, nullptr for empty file
+	const char* m_data;
+
+	// File size in bytes
+	std::size_t m_size;
+
+#ifdef _WIN32
+	// File and file mapping handles
+	void* m_file;
+	void* m_mapping;
+#endif
+};
+
+#endif // MAPPED_FILE_H__
@@ -0,0 +1,31 @@
+#include "rate_snapshot.h"
+#include <stdexcept>
+#include <string>
+
+RateSnapshot::RateSnapshot(const std::uint64_t version, const ExchangeRateProcessor& processor) :
+	m_version(version),
+	m_processor(processor)
+{
+}
+
+void RateSnapshot::answerLine(const ParsedLine& line, std::string_view data,
+	RequestContext& context) const
+{
+	try {
+		switch (line.kind) {
+		case ParsedLine::Kind::Request:
+			m_processor.answerRequest(line, context);
+			break;
+		case ParsedLine::Kind::BatchRequest:
+			m_processor.answerBatchRequest(line.queries, context);
+			break;
+		case ParsedLine::Kind::Invalid:
+			throw std::invalid_argument(line.error);
+		default:
+			throw std::invalid_argument("snapshot answers rate requests only");
+		}
+	} catch (std::exception& ex) {
+		// Report error in the same way as processor does
+		context.reportError(std::string(ex.what()) + ", data (" + std::string(data) + ")");
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef RATE_SNAPSHOT_H__
+#define RATE_SNAPSHOT_H__
+
+#include "exchange_rate_processor.h"
+#include <cstdint>
+#include <string_view>
+
+// Immutable copy of exchange graph and its routing state at some moment,
+// created by ExchangeRateProcessor::createSnapshot(). Requests are answered
+// by the same code as processor uses, so responses are identical to those
+// processor would give at that moment. Snapshot is never modified after
+// construction: any number of threads can answer requests from it
+// concurrently, every thread with its own RequestContext.
+class RateSnapshot {
+public:
+	// Copies graph and routing state of processor, which must be up to date
+	RateSnapshot(std::uint64_t version, const ExchangeRateProcessor& processor);
+
+	RateSnapshot(const RateSnapshot&) = delete;
+	RateSnapshot& operator=(const RateSnapshot&) = delete;
+
+	// Returns sequence number of snapshot, it grows with every snapshot of processor
+	std::uint64_t version() const noexcept
+	{
+		return m_version;
+	}
+
+	// Answers parsed rate request or batch request, responses go to context.
+	// Errors are reported to standard error as processor reports them, lines
+	// which are not requests are reported as errors, snapshot can't change.
+	// "data" is the original line, used for error reporting.
+	void answerLine(const ParsedLine& line, std::string_view data,
+		RequestContext& context) const;
+
+private:
+	// Sequence number of snapshot
+	const std::uint64_t m_version;
+
+	// Copy of processor, used only to answer requests
+	const ExchangeRateProcessor m_processor;
+};
+
+#endif // RATE_SNAPSHOT_H__
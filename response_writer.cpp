@@ -0,0 +1,108 @@
+#include "response_writer.h"
+#include <charconv>
+
+namespace {
+	// Converts number of days since 1970-01-01 to civil date,
+	// inverse of daysFromCivil() used by timestamp parser.
+	void civilFromDays(std::time_t days, long long& year, unsigned& month, unsigned& day) noexcept
+	{
+		days += 719468;
+		const auto era = (days >= 0 ? days : days - 146096) / 146097;
+		const auto dayOfEra = static_cast<unsigned>(days - era * 146097);
+		const auto yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524
+			- dayOfEra / 146096) / 365;
+		const auto dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+		const auto monthIndex = (5 * dayOfYear + 2) / 153;
+		day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+		month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+		year = static_cast<long long>(yearOfEra) + era * 400 + (month <= 2);
+	}
+
+	// Writes value as given number of decimal digits with leading zeros
+	char* writeDigits(char* out, long long value, int count) noexcept
+	{
+		for (int i = count - 1; i >= 0; --i) {
+			out[i] = static_cast<char>('0' + value % 10);
+			value /= 10;
+		}
+		return out + count;
+	}
+}
+
+ResponseWriter::ResponseWriter(std::ostream* stream, std::size_t bufferSize,
+	bool flushPerResponse) :
+	m_stream(stream),
+	m_buffer(),
+	m_bufferSize(bufferSize),
+	m_flushPerResponse(flushPerResponse)
+{
+	m_buffer.reserve(bufferSize);
+}
+
+ResponseWriter::~ResponseWriter()
+{
+	flush();
+}
+
+ResponseWriter& ResponseWriter::operator<<(const double value)
+{
+	char buffer[32];
+	const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+	m_buffer.append(buffer, result.ptr);
+	return *this;
+}
+
+void ResponseWriter::writeTimestamp(const std::time_t time)
+{
+	// Split into days and seconds of day, rounding days towards minus infinity
+	auto days = time / 86400;
+	auto seconds = time % 86400;
+	if (seconds < 0) {
+		seconds += 86400;
+		--days;
+	}
+	long long year = 0;
+	unsigned month = 0;
+	unsigned day = 0;
+	civilFromDays(days, year, month, day);
+
+	char buffer[32];
+	char* out = writeDigits(buffer, year, 4);
+	*out++ = '-';
+	out = writeDigits(out, month, 2);
+	*out++ = '-';
+	out = writeDigits(out, day, 2);
+	*out++ = 'T';
+	out = writeDigits(out, seconds / 3600, 2);
+	*out++ = ':';
+	out = writeDigits(out, seconds / 60 % 60, 2);
+	*out++ = ':';
+	out = writeDigits(out, seconds % 60, 2);
+	m_buffer.append(buffer, out);
+	m_buffer.append("+00:00");
+}
+
+void ResponseWriter::endResponse()
+{
+	if (m_stream && (m_flushPerResponse || m_buffer.length() >= m_bufferSize)) {
+		flush();
+	}
+}
+
+void ResponseWriter::flush()
+{
+	if (!m_stream) {
+		return;
+	}
+	if (!m_buffer.empty()) {
+		m_stream->write(m_buffer.data(), m_buffer.length());
+		m_buffer.clear();
+	}
+	m_stream->flush();
+}
+
+void ResponseWriter::take(std::string& output)
+{
+	output.append(m_buffer);
+	m_buffer.clear();
+}
@@ -0,0 +1,85 @@
+#ifndef RESPONSE_WRITER_H__
+#define RESPONSE_WRITER_H__
+
+#include <cstddef>
+#include <ctime>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Upper limit of output buffer size given on command line. Buffer of this size
+// is reserved up front, larger ones don't make writes any cheaper.
+constexpr std::size_t MAX_OUTPUT_BUFFER_SIZE = 1024 * 1024 * 1024;
+
+// Accumulates responses in memory buffer and writes them to output stream
+// in large chunks. Buffer is written out when it reaches configured size,
+// on explicit flush() (e.g. at the end of batch or when input is idle),
+// or after every response if writer is configured to do so.
+// Writer without stream keeps responses until they are taken by caller.
+class ResponseWriter {
+public:
+	// Creates writer for given stream. If flushPerResponse is true, every
+	// complete response is written and flushed immediately. If stream is nullptr,
+	// responses stay in buffer until take() is called.
+	ResponseWriter(std::ostream* stream, std::size_t bufferSize, bool flushPerResponse);
+
+	ResponseWriter(const ResponseWriter&) = delete;
+	ResponseWriter& operator=(const ResponseWriter&) = delete;
+
+	// Flushes pending data
+	~ResponseWriter();
+
+	// Appends text to current response
+	ResponseWriter& operator<<(std::string_view text)
+	{
+		m_buffer.append(text.data(), text.length());
+		return *this;
+	}
+
+	// Appends single character to current response
+	ResponseWriter& operator<<(char c)
+	{
+		m_buffer.push_back(c);
+		return *this;
+	}
+
+	// Appends floating-point number in shortest form which reads back exactly
+	ResponseWriter& operator<<(double value);
+
+	// Appends value in native binary representation, for binary protocol
+	template <class T>
+	void writeBinary(const T& value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only plain data can be written");
+		m_buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	// Appends UTC time in the input timestamp format, YYYY-MM-DDTHH:MM:SS+00:00
+	void writeTimestamp(std::time_t time);
+
+	// Marks end of response. Buffer is flushed if it is full
+	// or writer flushes every response.
+	void endResponse();
+
+	// Writes buffered data to stream and flushes stream
+	void flush();
+
+	// Appends buffered data to given string instead of writing it to stream
+	void take(std::string& output);
+
+private:
+	// Output stream, nullptr if responses are taken by caller
+	std::ostream* m_stream;
+
+	// Pending output
+	std::string m_buffer;
+
+	// Buffer size which triggers flush
+	std::size_t m_bufferSize;
+
+	// Indicates that every response must be flushed immediately
+	bool m_flushPerResponse;
+};
+
+#endif // RESPONSE_WRITER_H__
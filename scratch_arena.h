@@ -0,0 +1,182 @@
+#ifndef SCRATCH_ARENA_H__
+#define SCRATCH_ARENA_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Monotonic memory arena for temporary data of route computations.
+// Allocation bumps position within current block, memory is never freed
+// individually: everything allocated while Scope object lives is released
+// at once when it is destroyed. Blocks are kept for reuse, so once arena has
+// grown to the size computations need, they run without heap allocations.
+// Arena is not thread-safe.
+class ScratchArena {
+public:
+	// Alignment of blocks, the maximal supported alignment of allocations
+	static constexpr std::size_t ALIGNMENT = 64;
+
+	// Releases memory allocated from arena during lifetime of the scope.
+	// Scopes must be nested, like automatic variables.
+	class Scope {
+	public:
+		explicit Scope(ScratchArena& arena) noexcept :
+			m_arena(arena),
+			m_block(arena.m_block),
+			m_position(arena.m_position)
+		{
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+		// Rewinds arena to the state at scope creation
+		~Scope()
+		{
+			m_arena.m_block = m_block;
+			m_arena.m_position = m_position;
+		}
+
+	private:
+		ScratchArena& m_arena;
+		std::size_t m_block;
+		std::size_t m_position;
+	};
+
+	// Constructs empty arena, the first block is allocated on demand
+	ScratchArena() noexcept :
+		m_blocks(),
+		m_block(0),
+		m_position(0)
+	{
+	}
+
+	ScratchArena(const ScratchArena&) = delete;
+	ScratchArena& operator=(const ScratchArena&) = delete;
+
+	// Frees all blocks
+	~ScratchArena()
+	{
+		for (const auto& block : m_blocks) {
+			::operator delete(block.data, std::align_val_t(ALIGNMENT));
+		}
+	}
+
+	// Returns uninitialized memory of given size and alignment
+	void* allocate(std::size_t size, std::size_t alignment)
+	{
+		// Continue in current block, then try blocks left from earlier computations
+		for (; m_block < m_blocks.size(); ++m_block, m_position = 0) {
+			const auto offset = (m_position + alignment - 1) / alignment * alignment;
+			if (offset + size <= m_blocks[m_block].size) {
+				m_position = offset + size;
+				return m_blocks[m_block].data + offset;
+			}
+		}
+
+		// Add block, sizes grow geometrically
+		const auto blockSize = std::max({size, MIN_BLOCK_SIZE,
+			m_blocks.empty() ? std::size_t(0) : 2 * m_blocks.back().size});
+		m_blocks.reserve(m_blocks.size() + 1);
+		const auto data = static_cast<char*>(::operator new(blockSize,
+			std::align_val_t(ALIGNMENT)));
+		m_blocks.push_back(Block{data, blockSize});
+		m_block = m_blocks.size() - 1;
+		m_position = size;
+		return data;
+	}
+
+private:
+	// Size of the first block in bytes
+	static constexpr std::size_t MIN_BLOCK_SIZE = 64 * 1024;
+
+	// Memory block
+	struct Block {
+		char* data;
+		std::size_t size;
+	};
+
+	// Blocks in order of allocation
+	std::vector<Block> m_blocks;
+
+	// Index of block allocations are taken from
+	std::size_t m_block;
+
+	// Offset of free memory in current block
+	std::size_t m_position;
+};
+
+// Standard allocator taking memory from ScratchArena, for containers which
+// live within single arena scope. Deallocation does nothing, memory returns
+// to arena when scope ends, so containers should be sized up front.
+template <class T>
+class ScratchAllocator {
+public:
+	typedef T value_type;
+
+	// Constructs allocator which takes memory from given arena
+	explicit ScratchAllocator(ScratchArena& arena) noexcept :
+		m_arena(&arena)
+	{
+	}
+
+	// Constructs allocator of other type which shares arena
+	template <class U>
+	ScratchAllocator(const ScratchAllocator<U>& other) noexcept :
+		m_arena(other.arena())
+	{
+	}
+
+	// Allocates array of n elements
+	T* allocate(std::size_t n)
+	{
+		return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+	}
+
+	// Memory is released by arena scope
+	void deallocate(T*, std::size_t) noexcept
+	{
+	}
+
+	// Returns arena of allocator
+	ScratchArena* arena() const noexcept
+	{
+		return m_arena;
+	}
+
+private:
+	ScratchArena* m_arena;
+};
+
+template <class T, class U>
+bool operator==(const ScratchAllocator<T>& a, const ScratchAllocator<U>& b) noexcept
+{
+	return a.arena() == b.arena();
+}
+
+template <class T, class U>
+bool operator!=(const ScratchAllocator<T>& a, const ScratchAllocator<U>& b) noexcept
+{
+	return a.arena() != b.arena();
+}
+
+// Vector which takes memory from ScratchArena
+template <class T>
+using ScratchVector = std::vector<T, ScratchAllocator<T>>;
+
+// Returns empty vector which takes memory from given arena
+template <class T>
+ScratchVector<T> makeScratchVector(ScratchArena& arena)
+{
+	return ScratchVector<T>(ScratchAllocator<T>(arena));
+}
+
+// Returns vector of n copies of value which takes memory from given arena
+template <class T>
+ScratchVector<T> makeScratchVector(ScratchArena& arena, std::size_t n, const T& value)
+{
+	return ScratchVector<T>(n, value, ScratchAllocator<T>(arena));
+}
+
+#endif // SCRATCH_ARENA_H__
@@ -0,0 +1,166 @@
+#ifndef SNAPSHOT_PUBLISHER_H__
+#define SNAPSHOT_PUBLISHER_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// Publishes immutable snapshots from single writer to many concurrent readers
+// (read-copy-update). Writer replaces current snapshot with atomic pointer swap;
+// readers take the latest snapshot without locks. Replaced snapshots are
+// reclaimed with hazard pointers: snapshot is deleted only when no reader
+// announced it in its hazard slot.
+template <class T>
+class SnapshotPublisher {
+	// Hazard slot of single reader, on its own cache line to avoid false sharing
+	struct alignas(64) HazardSlot {
+		// Snapshot the reader uses, nullptr if none
+		std::atomic<const T*> pointer{nullptr};
+
+		// Indicates that slot is owned by a reader
+		std::atomic<bool> used{false};
+	};
+
+public:
+	// Default maximal number of simultaneous readers
+	static constexpr std::size_t DEFAULT_READER_COUNT = 64;
+
+	// Reader of snapshots. Every reader thread needs its own Reader,
+	// Reader can't be shared between threads.
+	class Reader {
+	public:
+		// Claims hazard slot of publisher.
+		// Throws std::runtime_error if all slots are taken.
+		explicit Reader(SnapshotPublisher& publisher) :
+			m_publisher(publisher),
+			m_slot(publisher.claimSlot())
+		{
+		}
+
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+
+		// Releases snapshot and hazard slot
+		~Reader()
+		{
+			release();
+			m_slot->used.store(false, std::memory_order_release);
+		}
+
+		// Returns the latest snapshot, nullptr if nothing is published yet.
+		// Snapshot stays valid until next acquire() or release() of this reader.
+		const T* acquire() noexcept
+		{
+			auto snapshot = m_publisher.m_current.load(std::memory_order_seq_cst);
+			for (;;) {
+				// Announce snapshot, then make sure it wasn't replaced meanwhile,
+				// otherwise writer could have missed the announcement
+				m_slot->pointer.store(snapshot, std::memory_order_seq_cst);
+				const auto current = m_publisher.m_current.load(std::memory_order_seq_cst);
+				if (current == snapshot) {
+					return snapshot;
+				}
+				snapshot = current;
+			}
+		}
+
+		// Allows snapshot returned by acquire() to be reclaimed
+		void release() noexcept
+		{
+			m_slot->pointer.store(nullptr, std::memory_order_release);
+		}
+
+	private:
+		// Publisher of snapshots
+		SnapshotPublisher& m_publisher;
+
+		// Hazard slot owned by this reader
+		HazardSlot* m_slot;
+	};
+
+	// Creates publisher supporting given number of simultaneous readers
+	explicit SnapshotPublisher(std::size_t readerCount = DEFAULT_READER_COUNT) :
+		m_current(nullptr),
+		m_slots(readerCount),
+		m_retired()
+	{
+	}
+
+	SnapshotPublisher(const SnapshotPublisher&) = delete;
+	SnapshotPublisher& operator=(const SnapshotPublisher&) = delete;
+
+	// Deletes all snapshots. No reader may exist at this point.
+	~SnapshotPublisher()
+	{
+		delete m_current.load(std::memory_order_relaxed);
+		for (const auto snapshot : m_retired) {
+			delete snapshot;
+		}
+	}
+
+	// Makes given snapshot current and reclaims replaced snapshots nobody reads.
+	// Must be called from single writer thread.
+	void publish(std::unique_ptr<const T> snapshot)
+	{
+		const auto previous = m_current.exchange(snapshot.release(), std::memory_order_seq_cst);
+		if (previous) {
+			m_retired.push_back(previous);
+		}
+		reclaim();
+	}
+
+	// Returns the latest snapshot to the writer. Readers must use Reader.
+	const T* current() const noexcept
+	{
+		return m_current.load(std::memory_order_relaxed);
+	}
+
+private:
+	// Claims free hazard slot
+	HazardSlot* claimSlot()
+	{
+		for (auto& slot : m_slots) {
+			bool expected = false;
+			if (slot.used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+				return &slot;
+			}
+		}
+		throw std::runtime_error("too many snapshot readers");
+	}
+
+	// Deletes retired snapshots which are not announced by any reader
+	void reclaim()
+	{
+		std::vector<const T*> hazards;
+		hazards.reserve(m_slots.size());
+		for (const auto& slot : m_slots) {
+			if (const auto snapshot = slot.pointer.load(std::memory_order_seq_cst)) {
+				hazards.push_back(snapshot);
+			}
+		}
+
+		const auto end = std::remove_if(m_retired.begin(), m_retired.end(),
+			[&hazards](const T* snapshot) {
+				if (std::find(hazards.begin(), hazards.end(), snapshot) != hazards.end()) {
+					return false;
+				}
+				delete snapshot;
+				return true;
+			});
+		m_retired.erase(end, m_retired.end());
+	}
+
+	// The latest snapshot
+	std::atomic<const T*> m_current;
+
+	// Hazard slots of readers
+	std::vector<HazardSlot> m_slots;
+
+	// Replaced snapshots which may still be in use, accessed by writer only
+	std::vector<const T*> m_retired;
+};
+
+#endif // SNAPSHOT_PUBLISHER_H__
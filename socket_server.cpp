@@ -0,0 +1,599 @@
+#include "socket_server.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <csignal>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+	// Number of bytes read from connection at once
+	constexpr std::size_t READ_CHUNK_SIZE = 64 * 1024;
+
+	// Reading from connection pauses while it has more unsent responses
+	constexpr std::size_t MAX_PENDING_OUTPUT = 4 * 1024 * 1024;
+
+	// Responses of query task are collected in memory, size is only a hint
+	constexpr std::size_t QUERY_OUTPUT_BUFFER_SIZE = 64 * 1024;
+
+	// Longer line means misbehaving client, connection is closed
+	constexpr std::size_t MAX_LINE_LENGTH = 1024 * 1024;
+
+	// Number of events handled per epoll_wait() call
+	constexpr int MAX_EVENTS = 64;
+
+	// Length of queue of pending connections
+	constexpr int LISTEN_BACKLOG = 128;
+
+	// Self-pipe which signal handler writes to, so that stop signal
+	// wakes up event loop in whichever thread it is delivered
+	int signalPipe[2] = { -1, -1 };
+
+	// Handler of stop signals
+	extern "C" void onStopSignal(int)
+	{
+		const char byte = 0;
+		const auto result = write(signalPipe[1], &byte, 1);
+		static_cast<void>(result);
+	}
+
+	// Throws std::runtime_error with description of errno
+	[[noreturn]] void throwSystemError(const std::string& message)
+	{
+		throw std::runtime_error(message + ": " + std::strerror(errno));
+	}
+}
+
+SocketServer::SocketServer(ExchangeRateProcessor& processor, const std::string& queryPath,
+	const std::string& feedPath, const std::size_t queryThreadCount,
+	const std::chrono::milliseconds snapshotInterval) :
+	m_processor(processor),
+	m_queryPath(),
+	m_feedPath(),
+	m_epoll(-1),
+	m_queryListener(-1),
+	m_feedListener(-1),
+	m_connections(),
+	m_feedFd(-1),
+	m_byteCount(0),
+	m_snapshots(std::max<std::size_t>(queryThreadCount, 1)),
+	m_snapshotStale(true),
+	m_snapshotInterval(snapshotInterval),
+	m_snapshotTime(),
+	m_queryThreads(),
+	m_taskMutex(),
+	m_taskQueued(),
+	m_queuedTasks(),
+	m_finishedTasks(),
+	m_stopQueryThreads(false),
+	m_taskEvent(-1)
+{
+	try {
+		m_epoll = epoll_create1(EPOLL_CLOEXEC);
+		if (m_epoll < 0) {
+			throwSystemError("Can't create epoll instance");
+		}
+		m_queryListener = listen(queryPath);
+		m_queryPath = queryPath;
+		if (!feedPath.empty()) {
+			m_feedListener = listen(feedPath);
+			m_feedPath = feedPath;
+		}
+
+		// Stop signals are turned into readable event of the pipe
+		if (pipe2(signalPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+			throwSystemError("Can't create signal pipe");
+		}
+		epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.fd = signalPipe[0];
+		if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, signalPipe[0], &event) != 0) {
+			throwSystemError("Can't register signal pipe");
+		}
+
+		// Query threads report finished tasks through eventfd
+		m_taskEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		event.data.fd = m_taskEvent;
+		if (m_taskEvent < 0 || epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_taskEvent, &event) != 0) {
+			throwSystemError("Can't create task event");
+		}
+		for (std::size_t i = 0; i < std::max<std::size_t>(queryThreadCount, 1); ++i) {
+			m_queryThreads.emplace_back(&SocketServer::answerQueries, this);
+		}
+	} catch (...) {
+		release();
+		throw;
+	}
+}
+
+SocketServer::~SocketServer()
+{
+	release();
+}
+
+void SocketServer::release() noexcept
+{
+	// Tasks are not finished after threads stop, so connections are closed directly
+	stopQueryThreads();
+	for (const auto& entry : m_connections) {
+		close(entry.first);
+	}
+	m_connections.clear();
+	m_feedFd = -1;
+	for (const auto listener : { m_queryListener, m_feedListener }) {
+		if (listener >= 0) {
+			close(listener);
+		}
+	}
+	m_queryListener = m_feedListener = -1;
+	for (const auto path : { &m_queryPath, &m_feedPath }) {
+		if (!path->empty()) {
+			unlink(path->c_str());
+			path->clear();
+		}
+	}
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	for (auto& fd : signalPipe) {
+		if (fd >= 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	if (m_taskEvent >= 0) {
+		close(m_taskEvent);
+		m_taskEvent = -1;
+	}
+	if (m_epoll >= 0) {
+		close(m_epoll);
+		m_epoll = -1;
+	}
+}
+
+void SocketServer::stopQueryThreads() noexcept
+{
+	{
+		std::lock_guard<std::mutex> lock(m_taskMutex);
+		m_stopQueryThreads = true;
+	}
+	m_taskQueued.notify_all();
+	for (auto& thread : m_queryThreads) {
+		thread.join();
+	}
+	m_queryThreads.clear();
+}
+
+std::size_t SocketServer::run()
+{
+	struct sigaction action = {};
+	action.sa_handler = onStopSignal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+
+	// Writes to closed connections are reported as errors instead
+	signal(SIGPIPE, SIG_IGN);
+
+	epoll_event events[MAX_EVENTS];
+	for (;;) {
+		const int count = epoll_wait(m_epoll, events, MAX_EVENTS, -1);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throwSystemError("Can't wait for events");
+		}
+		for (int i = 0; i < count; ++i) {
+			const int fd = events[i].data.fd;
+			if (fd == signalPipe[0]) {
+				return m_byteCount;
+			}
+			if (fd == m_queryListener || fd == m_feedListener) {
+				acceptConnections(fd, fd == m_feedListener);
+				continue;
+			}
+			if (fd == m_taskEvent) {
+				completeQueries();
+				continue;
+			}
+
+			// Connection may be closed by earlier event of the same batch
+			const auto it = m_connections.find(fd);
+			if (it == m_connections.end()) {
+				continue;
+			}
+			// Paused connection is not read whatever the event. Hang-up or error
+			// means its pending responses can't be delivered, so it is closed.
+			auto& connection = *it->second;
+			if (paused(connection)) {
+				if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+					closeConnection(connection);
+					continue;
+				}
+			} else if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				&& !readInput(connection)) {
+				continue;
+			}
+			if (events[i].events & EPOLLOUT) {
+				writeOutput(connection);
+			}
+		}
+	}
+}
+
+int SocketServer::listen(const std::string& path)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (path.length() >= sizeof(address.sun_path)) {
+		throw std::runtime_error("Socket path is too long: " + path);
+	}
+	std::memcpy(address.sun_path, path.c_str(), path.length() + 1);
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		throwSystemError("Can't create socket " + path);
+	}
+
+	// Socket file left by previous run would make bind fail
+	unlink(path.c_str());
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if (bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+		|| ::listen(fd, LISTEN_BACKLOG) != 0
+		|| epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+		const auto error = errno;
+		close(fd);
+		errno = error;
+		throwSystemError("Can't listen on socket " + path);
+	}
+	return fd;
+}
+
+void SocketServer::acceptConnections(const int listener, const bool feed)
+{
+	for (;;) {
+		const int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				std::cerr << "Error: Can't accept connection: " << std::strerror(errno) << std::endl;
+			}
+			return;
+		}
+
+		// Updates of single feed can't interleave with other one
+		if (feed && m_feedFd >= 0) {
+			std::cerr << "Error: Feed is connected already, connection refused" << std::endl;
+			close(fd);
+			continue;
+		}
+
+		auto connection = std::make_unique<Connection>();
+		connection->fd = fd;
+		connection->feed = feed;
+		connection->events = EPOLLIN;
+		epoll_event event = {};
+		event.events = connection->events;
+		event.data.fd = fd;
+		if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+			std::cerr << "Error: Can't register connection: " << std::strerror(errno) << std::endl;
+			close(fd);
+			continue;
+		}
+		if (feed) {
+			m_feedFd = fd;
+		}
+		m_connections.emplace(fd, std::move(connection));
+	}
+}
+
+bool SocketServer::readInput(Connection& connection)
+{
+	// Data is appended to incomplete line left from previous read
+	const auto size = connection.input.size();
+	connection.input.resize(size + READ_CHUNK_SIZE);
+	const auto count = recv(connection.fd, &connection.input[size], READ_CHUNK_SIZE, 0);
+	connection.input.resize(size + (count > 0 ? count : 0));
+	if (count < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			return true;
+		}
+		closeConnection(connection);
+		return false;
+	}
+
+	// Zero bytes read means client closed its side, the last line
+	// may end without newline
+	connection.inputClosed = count == 0;
+	processInput(connection, connection.inputClosed);
+	if (connection.input.size() > MAX_LINE_LENGTH) {
+		std::cerr << "Error: Line is too long, connection closed" << std::endl;
+		closeConnection(connection);
+		return false;
+	}
+	return writeOutput(connection);
+}
+
+void SocketServer::processInput(Connection& connection, const bool inputEnded)
+{
+	if (!connection.feed) {
+		dispatchQueries(connection, inputEnded);
+		return;
+	}
+
+	const char* position = connection.input.data();
+	const char* const end = position + connection.input.size();
+	while (position != end) {
+		const char* newline = static_cast<const char*>(
+			std::memchr(position, '\n', end - position));
+		if (!newline && !inputEnded) {
+			break;
+		}
+		const char* lineEnd = newline ? newline : end;
+		m_processor.processData(std::string_view(position, lineEnd - position));
+		position = newline ? newline + 1 : end;
+	}
+	const auto processed = static_cast<std::size_t>(position - connection.input.data());
+	m_byteCount += processed;
+	connection.input.erase(0, processed);
+
+	// Arbitrage state changed by the updates is reported to the feed,
+	// snapshots then find best rates up to date and have nothing to report
+	if (processed) {
+		m_processor.refreshBestRates();
+		m_processor.takeOutput(connection.output);
+		m_snapshotStale = true;
+	}
+}
+
+void SocketServer::dispatchQueries(Connection& connection, const bool inputEnded)
+{
+	if (connection.busy) {
+		return;
+	}
+
+	// Task takes all complete lines, the last line may end without newline
+	// when input ended
+	const auto lineEnd = connection.input.rfind('\n');
+	const auto size = inputEnded ? connection.input.size()
+		: lineEnd == std::string::npos ? 0 : lineEnd + 1;
+	if (!size) {
+		return;
+	}
+	if (m_snapshotStale && (!m_snapshots.current()
+		|| std::chrono::steady_clock::now() - m_snapshotTime >= m_snapshotInterval)) {
+		publishSnapshot();
+	}
+
+	auto task = std::make_unique<QueryTask>();
+	task->fd = connection.fd;
+	task->input.assign(connection.input, 0, size);
+	connection.input.erase(0, size);
+	connection.busy = true;
+	m_byteCount += size;
+	{
+		std::lock_guard<std::mutex> lock(m_taskMutex);
+		m_queuedTasks.push_back(std::move(task));
+	}
+	m_taskQueued.notify_one();
+}
+
+void SocketServer::publishSnapshot()
+{
+	m_snapshots.publish(m_processor.createSnapshot());
+	m_snapshotStale = false;
+	m_snapshotTime = std::chrono::steady_clock::now();
+
+	// Arbitrage found while bringing best rates up to date belongs to the feed,
+	// it is dropped if there is no feed connection
+	const auto it = m_connections.find(m_feedFd);
+	if (it != m_connections.end()) {
+		m_processor.takeOutput(it->second->output);
+		writeOutput(*it->second);
+	} else {
+		std::string output;
+		m_processor.takeOutput(output);
+	}
+}
+
+void SocketServer::completeQueries()
+{
+	std::uint64_t count = 0;
+	const auto result = read(m_taskEvent, &count, sizeof(count));
+	static_cast<void>(result);
+
+	std::vector<std::unique_ptr<QueryTask>> tasks;
+	{
+		std::lock_guard<std::mutex> lock(m_taskMutex);
+		tasks.swap(m_finishedTasks);
+	}
+	for (const auto& task : tasks) {
+		// Errors of query threads are written by this thread only
+		std::cerr << task->errors << std::flush;
+		const auto it = m_connections.find(task->fd);
+		if (it == m_connections.end()) {
+			continue;
+		}
+		auto& connection = *it->second;
+		connection.busy = false;
+		if (connection.closed) {
+			closeConnection(connection);
+			continue;
+		}
+
+		// Requests read meanwhile are dispatched right away, reading resumes
+		// unless too many responses are unsent
+		connection.output.append(task->output);
+		dispatchQueries(connection, connection.inputClosed);
+		writeOutput(connection);
+	}
+}
+
+void SocketServer::answerQueries()
+{
+	// Every query thread has its own hazard slot and context
+	SnapshotPublisher<RateSnapshot>::Reader reader(m_snapshots);
+	ResponseWriter writer(nullptr, QUERY_OUTPUT_BUFFER_SIZE, false);
+	RequestContext context(writer);
+	std::unique_lock<std::mutex> lock(m_taskMutex);
+	for (;;) {
+		m_taskQueued.wait(lock, [this] { return m_stopQueryThreads || !m_queuedTasks.empty(); });
+		if (m_stopQueryThreads) {
+			return;
+		}
+		auto task = std::move(m_queuedTasks.front());
+		m_queuedTasks.pop_front();
+		lock.unlock();
+
+		// Snapshot published before task was queued or a newer one
+		answerQueryLines(*reader.acquire(), task->input, context);
+		reader.release();
+		writer.take(task->output);
+		task->errors.swap(context.errors);
+		context.errors.clear();
+
+		lock.lock();
+		m_finishedTasks.push_back(std::move(task));
+		const std::uint64_t one = 1;
+		const auto result = write(m_taskEvent, &one, sizeof(one));
+		static_cast<void>(result);
+	}
+}
+
+void SocketServer::answerQueryLines(const RateSnapshot& snapshot, std::string_view lines,
+	RequestContext& context)
+{
+	while (!lines.empty()) {
+		const auto newline = lines.find('\n');
+		const auto line = lines.substr(0, newline);
+		lines.remove_prefix(newline == std::string_view::npos ? lines.size() : newline + 1);
+
+		// Query connections can't change the graph
+		const auto parsed = ExchangeRateProcessor::parseLine(line);
+		if (parsed.kind == ParsedLine::Kind::Info || parsed.kind == ParsedLine::Kind::TransferFee) {
+			context.reportError("graph updates are accepted from feed connection only, data ("
+				+ std::string(line) + ")");
+			continue;
+		}
+		snapshot.answerLine(parsed, line, context);
+	}
+}
+
+bool SocketServer::writeOutput(Connection& connection)
+{
+	while (connection.outputOffset < connection.output.size()) {
+		const auto count = send(connection.fd, connection.output.data() + connection.outputOffset,
+			connection.output.size() - connection.outputOffset, MSG_NOSIGNAL);
+		if (count < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			closeConnection(connection);
+			return false;
+		}
+		connection.outputOffset += count;
+	}
+	const auto pending = connection.output.size() - connection.outputOffset;
+	if (!pending) {
+		connection.output.clear();
+		connection.outputOffset = 0;
+		if (connection.inputClosed && !connection.busy) {
+			closeConnection(connection);
+			return false;
+		}
+	}
+
+	// Wait for socket to become writable while responses are pending,
+	// stop reading while there are too many of them
+	std::uint32_t events = 0;
+	if (pending) {
+		events |= EPOLLOUT;
+	}
+	if (!paused(connection) && !connection.inputClosed) {
+		events |= EPOLLIN;
+	}
+	if (events != connection.events) {
+		epoll_event event = {};
+		event.events = events;
+		event.data.fd = connection.fd;
+		epoll_ctl(m_epoll, EPOLL_CTL_MOD, connection.fd, &event);
+		connection.events = events;
+	}
+	return true;
+}
+
+bool SocketServer::paused(const Connection& connection) noexcept
+{
+	return connection.busy
+		|| connection.output.size() - connection.outputOffset >= MAX_PENDING_OUTPUT;
+}
+
+void SocketServer::closeConnection(Connection& connection)
+{
+	// Descriptor of busy connection stays open, so it is not reused
+	// by new connection before task of this one is finished
+	const int fd = connection.fd;
+	if (!connection.closed) {
+		epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+		connection.closed = true;
+	}
+	if (connection.busy) {
+		return;
+	}
+	if (connection.feed) {
+		m_feedFd = -1;
+	}
+	close(fd);
+	m_connections.erase(fd);
+}
+
+#else
+
+SocketServer::SocketServer(ExchangeRateProcessor& processor, const std::string&,
+	const std::string&, std::size_t, std::chrono::milliseconds snapshotInterval) :
+	m_processor(processor),
+	m_queryPath(),
+	m_feedPath(),
+	m_epoll(-1),
+	m_queryListener(-1),
+	m_feedListener(-1),
+	m_connections(),
+	m_feedFd(-1),
+	m_byteCount(0),
+	m_snapshots(),
+	m_snapshotStale(true),
+	m_snapshotInterval(snapshotInterval),
+	m_snapshotTime(),
+	m_queryThreads(),
+	m_taskMutex(),
+	m_taskQueued(),
+	m_queuedTasks(),
+	m_finishedTasks(),
+	m_stopQueryThreads(false),
+	m_taskEvent(-1)
+{
+	throw std::runtime_error("Server mode is supported on Linux only");
+}
+
+SocketServer::~SocketServer()
+{
+}
+
+std::size_t SocketServer::run()
+{
+	return 0;
+}
+
+#endif
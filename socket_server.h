@@ -0,0 +1,201 @@
+#ifndef SOCKET_SERVER_H__
+#define SOCKET_SERVER_H__
+
+#include "exchange_rate_processor.h"
+#include "rate_snapshot.h"
+#include "snapshot_publisher.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Serves text protocol over Unix domain sockets to many clients at once.
+// Event loop thread multiplexes all connections with epoll and is the only
+// user of processor. Rate info and transfer fees are accepted only from feed
+// connection, at most one at a time, and applied in the order they are read.
+// Query connections send rate requests, which worker threads answer from
+// the latest snapshot of processor (see RateSnapshot), so queries don't wait
+// for updates and updates don't wait for queries. Snapshot is published when
+// queries arrive after graph changed, but not more often than snapshot interval
+// allows, as it copies the whole graph: queries see feed input read before them
+// unless it came within the interval after the latest snapshot. Clients may
+// pipeline requests: all complete lines read are answered
+// and responses are sent in order of requests. Reading from client pauses
+// while its requests are answered or too many of its responses are unsent.
+// Available on Linux only.
+class SocketServer {
+public:
+	// Default minimal interval between snapshots
+	static constexpr std::chrono::milliseconds DEFAULT_SNAPSHOT_INTERVAL{ 10 };
+
+	// Creates sockets listening for query connections and, if feedPath is not
+	// empty, for feed connection, and starts given number of threads answering
+	// queries. Processor must capture responses, see
+	// ExchangeRateProcessorOptions::captureResponses. Throws std::runtime_error
+	// if sockets can't be created or platform is not supported.
+	SocketServer(ExchangeRateProcessor& processor, const std::string& queryPath,
+		const std::string& feedPath, std::size_t queryThreadCount = 1,
+		std::chrono::milliseconds snapshotInterval = DEFAULT_SNAPSHOT_INTERVAL);
+
+	SocketServer(const SocketServer&) = delete;
+	SocketServer& operator=(const SocketServer&) = delete;
+
+	// Stops query threads, closes connections and removes sockets
+	~SocketServer();
+
+	// Serves clients until SIGINT or SIGTERM is received.
+	// Returns number of input bytes processed.
+	std::size_t run();
+
+private:
+	// Client connection
+	struct Connection {
+		// Socket descriptor
+		int fd = -1;
+
+		// Indicates feed connection
+		bool feed = false;
+
+		// Received data not yet processed, ends with incomplete line
+		std::string input;
+
+		// Responses not yet sent and offset of unsent part
+		std::string output;
+		std::size_t outputOffset = 0;
+
+		// Indicates that client closed its side, connection is closed
+		// when the remaining responses are sent
+		bool inputClosed = false;
+
+		// Indicates that query task of connection is being answered. Connection
+		// has at most one task at a time, so responses keep order of requests.
+		bool busy = false;
+
+		// Indicates that connection was closed while busy, it is released
+		// when its task is finished
+		bool closed = false;
+
+		// Events connection is registered for in epoll
+		std::uint32_t events = 0;
+	};
+
+	// Request lines of query connection answered by query thread
+	struct QueryTask {
+		// Socket descriptor of connection
+		int fd = -1;
+
+		// Complete request lines, responses to them and error messages
+		std::string input;
+		std::string output;
+		std::string errors;
+	};
+
+	// Creates socket listening at given path and registers it in epoll
+	int listen(const std::string& path);
+
+	// Accepts pending connections on given listening socket
+	void acceptConnections(int listener, bool feed);
+
+	// Reads available data and processes complete lines.
+	// Returns false if connection got closed.
+	bool readInput(Connection& connection);
+
+	// Processes complete lines of received data: applies lines of feed
+	// connection, hands lines of query connection to query threads
+	void processInput(Connection& connection, bool inputEnded);
+
+	// Hands complete lines of query connection to query threads, unless it
+	// has task in progress. Snapshot is published first if graph changed
+	// and snapshot interval has passed.
+	void dispatchQueries(Connection& connection, bool inputEnded);
+
+	// Publishes snapshot of processor for query threads
+	void publishSnapshot();
+
+	// Takes finished query tasks and sends their responses
+	void completeQueries();
+
+	// Main loop of query thread
+	void answerQueries();
+
+	// Answers request lines from snapshot, responses go to context
+	static void answerQueryLines(const RateSnapshot& snapshot, std::string_view lines,
+		RequestContext& context);
+
+	// Sends as much of pending responses as socket accepts and updates epoll
+	// registration. Returns false if connection got closed.
+	bool writeOutput(Connection& connection);
+
+	// Returns true if connection is not read until its responses are sent
+	static bool paused(const Connection& connection) noexcept;
+
+	// Closes connection and forgets it. Busy connection is only unregistered,
+	// it is released when its task is finished.
+	void closeConnection(Connection& connection);
+
+	// Stops and joins query threads
+	void stopQueryThreads() noexcept;
+
+	// Stops query threads, closes all descriptors and removes sockets
+	void release() noexcept;
+
+	// Processor serving all connections
+	ExchangeRateProcessor& m_processor;
+
+	// Paths of listening sockets, feed path is empty if there is no feed socket
+	std::string m_queryPath;
+	std::string m_feedPath;
+
+	// Descriptors of epoll instance and listening sockets, -1 if not open
+	int m_epoll;
+	int m_queryListener;
+	int m_feedListener;
+
+	// Connections by socket descriptor
+	std::unordered_map<int, std::unique_ptr<Connection>> m_connections;
+
+	// Socket descriptor of feed connection, -1 if feed is not connected
+	int m_feedFd;
+
+	// Number of input bytes processed
+	std::size_t m_byteCount;
+
+	// Snapshots of processor which query threads answer from
+	SnapshotPublisher<RateSnapshot> m_snapshots;
+
+	// Indicates that processor may have changed since the latest snapshot
+	bool m_snapshotStale;
+
+	// Minimal interval between snapshots and time of the latest one
+	const std::chrono::milliseconds m_snapshotInterval;
+	std::chrono::steady_clock::time_point m_snapshotTime;
+
+	// Threads answering queries
+	std::vector<std::thread> m_queryThreads;
+
+	// Protects task queues and stop flag below
+	std::mutex m_taskMutex;
+
+	// Signaled when task is queued or query threads must stop
+	std::condition_variable m_taskQueued;
+
+	// Tasks waiting for query thread and tasks finished by them
+	std::deque<std::unique_ptr<QueryTask>> m_queuedTasks;
+	std::vector<std::unique_ptr<QueryTask>> m_finishedTasks;
+
+	// Indicates that query threads must exit
+	bool m_stopQueryThreads;
+
+	// Descriptor of eventfd query threads signal finished tasks with, -1 if not open
+	int m_taskEvent;
+};
+
+#endif // SOCKET_SERVER_H__
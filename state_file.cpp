@@ -0,0 +1,108 @@
+#include "state_file.h"
+#include <cstdio>
+#include <stdexcept>
+
+namespace {
+	// File signature
+	constexpr char STATE_FILE_MAGIC[8] = { 'E', 'R', 'P', 'S', 'T', 'A', 'T', 'E' };
+
+	// Byte order mark, reads differently on machine with other byte order
+	constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+}
+
+StateFileWriter::StateFileWriter(const std::string& fileName) :
+	m_fileName(fileName),
+	m_temporaryFileName(fileName + ".tmp"),
+	m_stream(m_temporaryFileName, std::ios::binary | std::ios::trunc),
+	m_committed(false)
+{
+	if (!m_stream.is_open()) {
+		throw std::runtime_error("Can't create state file " + m_temporaryFileName);
+	}
+	writeArray(STATE_FILE_MAGIC, sizeof(STATE_FILE_MAGIC));
+	writeValue(STATE_FILE_VERSION);
+	writeValue(BYTE_ORDER_MARK);
+}
+
+StateFileWriter::~StateFileWriter()
+{
+	if (!m_committed) {
+		m_stream.close();
+		std::remove(m_temporaryFileName.c_str());
+	}
+}
+
+void StateFileWriter::writeString(std::string_view value)
+{
+	writeValue(static_cast<std::uint64_t>(value.length()));
+	writeArray(value.data(), value.length());
+}
+
+void StateFileWriter::commit()
+{
+	m_stream.close();
+	if (m_stream.fail()) {
+		throw std::runtime_error("Can't write state file " + m_temporaryFileName);
+	}
+
+	// Rename replaces existing file atomically on POSIX systems,
+	// on Windows existing file has to be removed first
+	if (std::rename(m_temporaryFileName.c_str(), m_fileName.c_str()) != 0
+		&& (std::remove(m_fileName.c_str()) != 0
+			|| std::rename(m_temporaryFileName.c_str(), m_fileName.c_str()) != 0)) {
+		throw std::runtime_error("Can't replace state file " + m_fileName);
+	}
+	m_committed = true;
+}
+
+void StateFileWriter::write(const void* data, std::size_t size)
+{
+	if (!m_stream.write(static_cast<const char*>(data), size)) {
+		throw std::runtime_error("Can't write state file " + m_temporaryFileName);
+	}
+}
+
+StateFileReader::StateFileReader(const char* fileName) :
+	m_file(fileName),
+	m_position(0)
+{
+	char magic[sizeof(STATE_FILE_MAGIC)];
+	if (m_file.contents().size() < sizeof(magic)) {
+		throw std::runtime_error(std::string("Not a state file ") + fileName);
+	}
+	readArray(magic, sizeof(magic));
+	if (std::memcmp(magic, STATE_FILE_MAGIC, sizeof(magic)) != 0) {
+		throw std::runtime_error(std::string("Not a state file ") + fileName);
+	}
+	if (readValue<std::uint32_t>() != STATE_FILE_VERSION) {
+		throw std::runtime_error(std::string("Unsupported version of state file ") + fileName);
+	}
+	if (readValue<std::uint32_t>() != BYTE_ORDER_MARK) {
+		throw std::runtime_error(std::string("Unsupported byte order of state file ") + fileName);
+	}
+}
+
+std::string_view StateFileReader::readString()
+{
+	const auto length = readValue<std::uint64_t>();
+	return std::string_view(read(static_cast<std::size_t>(length), 1),
+		static_cast<std::size_t>(length));
+}
+
+void StateFileReader::checkEnd() const
+{
+	if (m_position != m_file.contents().size()) {
+		throw std::runtime_error("Unexpected data at the end of state file");
+	}
+}
+
+const char* StateFileReader::read(std::size_t count, std::size_t elementSize)
+{
+	const auto contents = m_file.contents();
+	if (count > (contents.size() - m_position) / elementSize) {
+		throw std::runtime_error("Unexpected end of state file");
+	}
+	const auto data = contents.data() + m_position;
+	m_position += count * elementSize;
+	return data;
+}
@@ -0,0 +1,121 @@
+#ifndef STATE_FILE_H__
+#define STATE_FILE_H__
+
+#include "mapped_file.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Binary state file: fixed header (magic, format version, byte order mark)
+// followed by values and arrays in native representation, in order defined
+// by the code which writes them. Errors are reported with std::runtime_error.
+
+// Version of state file format, incremented on every change of its contents
+constexpr std::uint32_t STATE_FILE_VERSION = 2;
+
+// Writes state file. Data goes to temporary file next to target one,
+// which replaces target on commit(), so readers never see partial file.
+class StateFileWriter {
+public:
+	// Creates temporary file and writes header
+	explicit StateFileWriter(const std::string& fileName);
+
+	StateFileWriter(const StateFileWriter&) = delete;
+	StateFileWriter& operator=(const StateFileWriter&) = delete;
+
+	// Removes temporary file unless it was committed
+	~StateFileWriter();
+
+	// Writes single value
+	template <class T>
+	void writeValue(const T& value)
+	{
+		writeArray(&value, 1);
+	}
+
+	// Writes array of values
+	template <class T>
+	void writeArray(const T* data, std::size_t count)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only plain data can be written");
+		write(data, count * sizeof(T));
+	}
+
+	// Writes string as its length followed by characters
+	void writeString(std::string_view value);
+
+	// Completes file and replaces target file with it
+	void commit();
+
+private:
+	// Writes raw bytes
+	void write(const void* data, std::size_t size);
+
+	// Target and temporary file names
+	std::string m_fileName;
+	std::string m_temporaryFileName;
+
+	// Temporary file stream
+	std::ofstream m_stream;
+
+	// Indicates that temporary file replaced target
+	bool m_committed;
+};
+
+// Reads state file mapped into memory. Header is checked on construction.
+class StateFileReader {
+public:
+	// Maps file and checks its header
+	explicit StateFileReader(const char* fileName);
+
+	StateFileReader(const StateFileReader&) = delete;
+	StateFileReader& operator=(const StateFileReader&) = delete;
+
+	// Reads single value
+	template <class T>
+	T readValue()
+	{
+		T value;
+		readArray(&value, 1);
+		return value;
+	}
+
+	// Reads array of values
+	template <class T>
+	void readArray(T* data, std::size_t count)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only plain data can be read");
+		std::memcpy(data, read(count, sizeof(T)), count * sizeof(T));
+	}
+
+	// Reads string written by StateFileWriter::writeString(). Returned view
+	// points into mapped file, it is valid while reader exists.
+	std::string_view readString();
+
+	// Returns number of bytes left to read. Counts of arrays are checked
+	// against it before their storage is allocated.
+	std::size_t remaining() const noexcept
+	{
+		return m_file.contents().size() - m_position;
+	}
+
+	// Throws if file has data after the last read value
+	void checkEnd() const;
+
+private:
+	// Returns pointer to next "count" elements of given size and skips them.
+	// Throws if file is shorter.
+	const char* read(std::size_t count, std::size_t elementSize);
+
+	// Mapped file
+	MappedFile m_file;
+
+	// Offset of the next value
+	std::size_t m_position;
+};
+
+#endif // STATE_FILE_H__
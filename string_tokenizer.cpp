@@ -1,28 +1,28 @@
 #include "string_tokenizer.h"
 
-StringTokenizer::StringTokenizer(const std::string& s) :
+StringTokenizer::StringTokenizer(std::string_view s) noexcept :
 	m_string(s),
 	m_token(),
 	m_offset(0)
 {
 }
 
-void StringTokenizer::reset()
+void StringTokenizer::reset() noexcept
 {
 	m_offset = 0;
-	m_token.clear();
+	m_token = std::string_view();
 }
 
-bool StringTokenizer::parseNextToken(const std::string& delimiters) 
+bool StringTokenizer::parseNextToken(std::string_view delimiters) noexcept
 {
 	auto i = m_string.find_first_not_of(delimiters, m_offset);
-	if (i == std::string::npos) {
+	if (i == std::string_view::npos) {
 		m_offset = m_string.length();
 		return false;
 	}
 
 	auto j = m_string.find_first_of(delimiters, i);
-	if (j == std::string::npos) {
+	if (j == std::string_view::npos) {
 		m_token = m_string.substr(i);
 		m_offset = m_string.length();
 		return true;
@@ -1,35 +1,37 @@
 #ifndef STRING_TOKENIZER_H__
 #define STRING_TOKENIZER_H__
 
-#include <string>
+#include <string_view>
 
 // This class tokenize string using provided delimiters.
+// Tokens are views into parsed string, no copies are made,
+// so string must outlive tokenizer and its tokens.
 // Based on this public material:
 // https://stackoverflow.com/a/53862/1540501
 class StringTokenizer {
 public:
 	// Initializes StringTokenizer object with given string and delimiters.
-	StringTokenizer(const std::string& s);
+	StringTokenizer(std::string_view s) noexcept;
 
 	// Reset parsing state.
-	void reset();
+	void reset() noexcept;
 
 	// Attempt to parse next token using provided delimiters.
 	// Returns true if token parsed, otherwise returns false.
-	bool parseNextToken(const std::string& delimiters);
+	bool parseNextToken(std::string_view delimiters) noexcept;
 
 	// Returns last parsed token
-	const std::string& getToken() const noexcept
+	std::string_view getToken() const noexcept
 	{
 		return m_token;
 	}
 
 private:
 	// String to be parsed
-	const std::string& m_string;
+	std::string_view m_string;
 
 	// Last parsed token
-	std::string m_token;
+	std::string_view m_token;
 
 	// Current offset 
 	std::size_t m_offset;
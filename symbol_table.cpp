@@ -0,0 +1,32 @@
+#include "symbol_table.h"
+
+SymbolTable::SymbolTable() :
+	m_names(),
+	m_ids()
+{
+}
+
+std::pair<std::size_t, bool> SymbolTable::intern(std::string_view name)
+{
+	const auto it = m_ids.find(name);
+	if (it != m_ids.end()) {
+		return std::make_pair(it->second, false);
+	}
+
+	// Store name first, map key must refer to stored copy
+	const auto id = m_names.size();
+	m_names.emplace_back(name);
+	m_ids.emplace(m_names.back(), id);
+	return std::make_pair(id, true);
+}
+
+std::size_t SymbolTable::find(std::string_view name) const
+{
+	const auto it = m_ids.find(name);
+	return it == m_ids.end() ? INVALID_ID : it->second;
+}
+
+void SymbolTable::reserve(std::size_t count)
+{
+	m_ids.reserve(count);
+}
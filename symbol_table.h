@@ -0,0 +1,57 @@
+#ifndef SYMBOL_TABLE_H__
+#define SYMBOL_TABLE_H__
+
+#include <cstddef>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+// Interns names (of exchanges or currencies) as dense integer identifiers
+// 0, 1, 2, ... in order of first appearance. Name is hashed once on lookup,
+// all further processing works with identifiers.
+class SymbolTable {
+public:
+	// Identifier returned when symbol is not found
+	static constexpr std::size_t INVALID_ID = std::numeric_limits<std::size_t>::max();
+
+	// Constructor
+	SymbolTable();
+
+	SymbolTable(const SymbolTable&) = delete;
+	SymbolTable& operator=(const SymbolTable&) = delete;
+
+	// Returns identifier of given name, adding it if name is new.
+	// Second member of result is true if name was added.
+	std::pair<std::size_t, bool> intern(std::string_view name);
+
+	// Returns identifier of given name or INVALID_ID if name is unknown
+	std::size_t find(std::string_view name) const;
+
+	// Returns name of symbol with given identifier
+	const std::string& name(std::size_t id) const noexcept
+	{
+		return m_names[id];
+	}
+
+	// Returns number of symbols
+	std::size_t size() const noexcept
+	{
+		return m_names.size();
+	}
+
+	// Pre-allocate index for given number of symbols
+	void reserve(std::size_t count);
+
+private:
+	// Symbol names by identifier. Deque never relocates elements,
+	// so views into names stay valid as keys of m_ids.
+	std::deque<std::string> m_names;
+
+	// Mapping of symbol name to identifier
+	std::unordered_map<std::string_view, std::size_t> m_ids;
+};
+
+#endif // SYMBOL_TABLE_H__
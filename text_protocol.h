@@ -0,0 +1,76 @@
+#ifndef TEXT_PROTOCOL_H__
+#define TEXT_PROTOCOL_H__
+
+#include "response_writer.h"
+#include <cstddef>
+#include <ctime>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Keywords and token delimiters of line-based text protocol
+constexpr std::string_view TOKEN_DELIMITERS = " \t\v\r\n";
+constexpr std::string_view EXCHANGE_RATE_REQUEST = "EXCHANGE_RATE_REQUEST";
+constexpr std::string_view EXCHANGE_RATE_BATCH_REQUEST = "EXCHANGE_RATE_BATCH_REQUEST";
+constexpr std::string_view TRANSFER_FEE = "TRANSFER_FEE";
+constexpr std::string_view MAX_HOPS_OPTION = "MAX_HOPS=";
+constexpr std::string_view TOP_PATHS_OPTION = "TOP=";
+constexpr std::string_view BEST_RATES_BEGIN = "BEST_RATES_BEGIN";
+constexpr std::string_view BEST_RATES_END = "BEST_RATES_END";
+constexpr std::string_view ARBITRAGE_BEGIN = "ARBITRAGE_BEGIN";
+constexpr std::string_view ARBITRAGE_END = "ARBITRAGE_END";
+constexpr std::string_view ARBITRAGE_CLEARED = "ARBITRAGE_CLEARED";
+
+// Rates of found path, reported in extended responses
+struct PathRates {
+	// Product of factors of all hops, 0 if there is no path
+	double totalRate = 0.0;
+
+	// Factor and quote timestamp of edge leading to each path vertex,
+	// entry of the first (source) vertex is unused
+	std::vector<std::pair<double, std::time_t>> hops;
+};
+
+// Writes response to rate request: header, exchange/currency pairs of the path
+// and footer. "path" can be nullptr, then just headers are written.
+// "names" provides exchangeName(index) and currencyName(index) of path vertices,
+// vertices for which isTransferHub(index) is true are skipped.
+// If "rates" is given, header is followed by total rate and every hop line
+// by its factor and quote timestamp (extended response). Factor of hop
+// following skipped vertex includes factor of hop leading to it.
+template <class Names>
+void writeBestRatesResponse(ResponseWriter& out, const Names& names,
+	std::string_view sourceExchange, std::string_view sourceCurrency,
+	std::string_view destinationExchange, std::string_view destinationCurrency,
+	const std::vector<std::size_t>* path, const PathRates* rates = nullptr)
+{
+	out << BEST_RATES_BEGIN << ' ' << sourceExchange << ' ' << sourceCurrency
+		<< ' ' << destinationExchange << ' ' << destinationCurrency;
+	if (rates) {
+		out << ' ' << rates->totalRate;
+	}
+	out << '\n';
+	if (path) {
+		double skippedFactor = 1.0;
+		for (std::size_t i = 0; i < path->size(); ++i) {
+			const auto index = (*path)[i];
+			if (names.isTransferHub(index)) {
+				if (rates && i > 0) {
+					skippedFactor *= rates->hops[i].first;
+				}
+				continue;
+			}
+			out << names.exchangeName(index) << ", " << names.currencyName(index);
+			if (rates && i > 0) {
+				out << ", " << skippedFactor * rates->hops[i].first << ", ";
+				out.writeTimestamp(rates->hops[i].second);
+				skippedFactor = 1.0;
+			}
+			out << '\n';
+		}
+	}
+	out << BEST_RATES_END << '\n';
+	out.endResponse();
+}
+
+#endif // TEXT_PROTOCOL_H__
@@ -0,0 +1,92 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(std::size_t threadCount) :
+	m_workers(),
+	m_mutex(),
+	m_batchStarted(),
+	m_batchFinished(),
+	m_task(nullptr),
+	m_taskCount(0),
+	m_nextTask(0),
+	m_busyWorkers(0),
+	m_batchNumber(0),
+	m_stop(false)
+{
+	for (std::size_t i = 1; i < threadCount; ++i) {
+		m_workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_batchStarted.notify_all();
+	for (auto& worker : m_workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::run(std::size_t taskCount, const std::function<void(std::size_t)>& task)
+{
+	// Nothing to share with workers if there is single task
+	if (m_workers.empty() || taskCount < 2) {
+		for (std::size_t i = 0; i < taskCount; ++i) {
+			task(i);
+		}
+		return;
+	}
+
+	// Publish batch and wake up workers
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_task = &task;
+		m_taskCount = taskCount;
+		m_nextTask = 0;
+		m_busyWorkers = m_workers.size();
+		++m_batchNumber;
+	}
+	m_batchStarted.notify_all();
+
+	// Help workers, then wait until all of them are done with this batch
+	executeTasks();
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_batchFinished.wait(lock, [this] { return m_busyWorkers == 0; });
+	m_task = nullptr;
+}
+
+void ThreadPool::workerLoop()
+{
+	std::size_t batchNumber = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		m_batchStarted.wait(lock, [this, batchNumber] {
+			return m_stop || m_batchNumber != batchNumber;
+		});
+		if (m_stop) {
+			return;
+		}
+		batchNumber = m_batchNumber;
+
+		lock.unlock();
+		executeTasks();
+		lock.lock();
+
+		if (--m_busyWorkers == 0) {
+			m_batchFinished.notify_one();
+		}
+	}
+}
+
+void ThreadPool::executeTasks()
+{
+	for (;;) {
+		const auto i = m_nextTask.fetch_add(1);
+		if (i >= m_taskCount) {
+			break;
+		}
+		(*m_task)(i);
+	}
+}
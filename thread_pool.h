@@ -0,0 +1,78 @@
+#ifndef THREAD_POOL_H__
+#define THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Upper limit of thread counts taken from command line, far above any
+// useful number, so that mistyped counts are rejected before threads
+// and per-thread buffers are created.
+constexpr std::size_t MAX_THREAD_COUNT = 1024;
+
+// Fixed-size pool of worker threads executing batches of independent tasks.
+// Thread calling run() takes part in execution too.
+class ThreadPool {
+public:
+	// Creates pool using given total number of threads, including calling thread.
+	explicit ThreadPool(std::size_t threadCount);
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Stops and joins worker threads
+	~ThreadPool();
+
+	// Returns total number of threads, including calling thread
+	std::size_t threadCount() const noexcept
+	{
+		return m_workers.size() + 1;
+	}
+
+	// Calls task(i) for each i in [0, taskCount) on pool threads and waits
+	// for completion. Tasks must be independent and must not throw.
+	void run(std::size_t taskCount, const std::function<void(std::size_t)>& task);
+
+private:
+	// Worker thread main loop
+	void workerLoop();
+
+	// Executes tasks of current batch until none left
+	void executeTasks();
+
+	// Worker threads
+	std::vector<std::thread> m_workers;
+
+	// Protects batch state below
+	std::mutex m_mutex;
+
+	// Signaled when new batch is started or pool is stopped
+	std::condition_variable m_batchStarted;
+
+	// Signaled when last worker finished current batch
+	std::condition_variable m_batchFinished;
+
+	// Task of current batch
+	const std::function<void(std::size_t)>* m_task;
+
+	// Number of tasks in current batch
+	std::size_t m_taskCount;
+
+	// Index of next task to execute
+	std::atomic<std::size_t> m_nextTask;
+
+	// Number of workers which didn't finish current batch yet
+	std::size_t m_busyWorkers;
+
+	// Incremented with each batch, so workers can tell new batch from old one
+	std::size_t m_batchNumber;
+
+	// Indicates that workers must exit
+	bool m_stop;
+};
+
+#endif // THREAD_POOL_H__
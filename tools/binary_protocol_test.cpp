@@ -0,0 +1,144 @@
+// Test of price update ordering in binary protocol. Binary timestamps are in
+// nanoseconds while quotes keep whole seconds, so updates of the same edge
+// within one second must still replace each other in stream order, and an
+// update of an earlier second must still be ignored. Checked with both routing
+// engines. Returns 0 if all checks pass. Build from repository root:
+// g++ -std=c++17 -O2 -pthread -I. -o binary_protocol_test
+//     tools/binary_protocol_test.cpp exchange_rate_processor.cpp floyd_warsall.cpp
+//     mapped_file.cpp rate_snapshot.cpp response_writer.cpp state_file.cpp
+//     string_tokenizer.cpp symbol_table.cpp thread_pool.cpp
+
+#include "../binary_protocol.h"
+#include "../exchange_rate_processor.h"
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <utility>
+
+namespace {
+	// Wire identifiers of symbols used by the test
+	constexpr std::uint32_t EXCHANGE = 1;
+	constexpr std::uint32_t BTC = 1;
+	constexpr std::uint32_t USD = 2;
+
+	// Timestamp of the first update, 2018-01-01T00:00:00Z in nanoseconds
+	constexpr std::int64_t START_TIME = 1514764800 * NANOSECONDS_PER_SECOND;
+
+	// Appends value to frame fields
+	template <class T>
+	void append(std::string& fields, T value)
+	{
+		char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		fields.append(bytes, sizeof(T));
+	}
+
+	// Returns frame of given type and fields, without length prefix
+	std::string frame(BinaryFrameType type, const std::string& fields)
+	{
+		std::string result;
+		append(result, type);
+		return result + fields;
+	}
+
+	// Returns Symbol frame
+	std::string symbolFrame(BinarySymbolKind kind, std::uint32_t id, const char* name)
+	{
+		std::string fields;
+		append(fields, kind);
+		append(fields, id);
+		return frame(BinaryFrameType::Symbol, fields + name);
+	}
+
+	// Returns PriceUpdate frame of BTC/USD on the test exchange
+	std::string priceUpdateFrame(std::int64_t timestamp, double forwardFactor)
+	{
+		std::string fields;
+		append(fields, timestamp);
+		append(fields, EXCHANGE);
+		append(fields, BTC);
+		append(fields, USD);
+		append(fields, forwardFactor);
+		append(fields, 1.0 / forwardFactor);
+		return frame(BinaryFrameType::PriceUpdate, fields);
+	}
+
+	// Returns RateRequest frame for BTC to USD on the test exchange
+	std::string rateRequestFrame()
+	{
+		std::string fields;
+		append(fields, EXCHANGE);
+		append(fields, BTC);
+		append(fields, EXCHANGE);
+		append(fields, USD);
+		append(fields, std::uint32_t(0));
+		append(fields, std::uint32_t(1));
+		return frame(BinaryFrameType::RateRequest, fields);
+	}
+
+	// Applies price updates with given timestamp offsets (in nanoseconds from
+	// START_TIME) and rates, then requests BTC to USD and returns total rate
+	// of the response, -1 if response is malformed.
+	double rateAfterUpdates(RoutingEngine engine,
+		std::initializer_list<std::pair<std::int64_t, double>> updates)
+	{
+		ExchangeRateProcessorOptions options;
+		options.routingEngine = engine;
+		options.protocol = WireProtocol::Binary;
+		options.captureResponses = true;
+		ExchangeRateProcessor processor(options);
+		processor.processFrame(symbolFrame(BinarySymbolKind::Exchange, EXCHANGE, "KRAKEN"));
+		processor.processFrame(symbolFrame(BinarySymbolKind::Currency, BTC, "BTC"));
+		processor.processFrame(symbolFrame(BinarySymbolKind::Currency, USD, "USD"));
+		for (const auto& update : updates) {
+			processor.processFrame(priceUpdateFrame(START_TIME + update.first, update.second));
+		}
+		processor.processFrame(rateRequestFrame());
+
+		// BestRates frame: length, type, 4 identifiers, total rate, ...
+		std::string output;
+		processor.takeOutput(output);
+		constexpr std::size_t RATE_OFFSET = BINARY_FRAME_PREFIX_SIZE + sizeof(BinaryFrameType)
+			+ 4 * sizeof(std::uint32_t);
+		if (output.size() < RATE_OFFSET + sizeof(double)
+			|| output[BINARY_FRAME_PREFIX_SIZE] != static_cast<char>(BinaryFrameType::BestRates)) {
+			return -1.0;
+		}
+		double rate;
+		std::memcpy(&rate, output.data() + RATE_OFFSET, sizeof(rate));
+		return rate;
+	}
+
+	// Prints result of single check, returns true if it passed
+	bool check(const char* name, RoutingEngine engine, double rate, double expected)
+	{
+		const auto passed = rate == expected;
+		std::cout << (passed ? "ok   " : "FAIL ") << name
+			<< (engine == RoutingEngine::AllPairs ? " (all-pairs)" : " (single-source)");
+		if (!passed) {
+			std::cout << ": rate " << rate << ", expected " << expected;
+		}
+		std::cout << std::endl;
+		return passed;
+	}
+}
+
+int main()
+{
+	constexpr std::int64_t HALF_SECOND = NANOSECONDS_PER_SECOND / 2;
+	bool passed = true;
+	for (const auto engine : { RoutingEngine::AllPairs, RoutingEngine::SingleSource }) {
+		passed &= check("later update in the same second replaces quote", engine,
+			rateAfterUpdates(engine, { { 0, 1000.0 }, { HALF_SECOND, 1001.0 } }), 1001.0);
+		passed &= check("later lower rate in the same second replaces quote", engine,
+			rateAfterUpdates(engine, { { 0, 1000.0 }, { HALF_SECOND, 999.0 } }), 999.0);
+		passed &= check("update in the same second at the same nanosecond replaces quote", engine,
+			rateAfterUpdates(engine, { { HALF_SECOND, 1000.0 }, { HALF_SECOND, 1002.0 } }), 1002.0);
+		passed &= check("update of earlier second is ignored", engine,
+			rateAfterUpdates(engine, { { NANOSECONDS_PER_SECOND, 1000.0 }, { HALF_SECOND, 1003.0 } }),
+			1000.0);
+	}
+	return passed ? 0 : 1;
+}
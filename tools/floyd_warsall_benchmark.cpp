@@ -0,0 +1,310 @@
+// Benchmark of all-pairs best rates computation (computeBestRates). For every
+// graph size runs copy of the original kernel (nested std::vector rows, branch
+// per cell), then tiled kernel with scalar row updates, with AVX2 row updates
+// if CPU supports it, and with the best kernel on thread pool, and reports time
+// and speed-up over the original. Tables of scalar, AVX2 and threaded runs
+// must be identical, rates of the original kernel must agree within tolerance.
+// Returns 0 if they do. Build from repository root:
+// g++ -std=c++17 -O2 -pthread -I. -o floyd_warsall_benchmark
+//     tools/floyd_warsall_benchmark.cpp floyd_warsall.cpp thread_pool.cpp
+// Run: floyd_warsall_benchmark [--sizes=N,N,...] [--threads=N] [--rounds=N]
+// Default sizes are 256, 1024 and 2048 vertices, default thread count is
+// number of hardware threads.
+
+#include "../flat_matrix.h"
+#include "../floyd_warsall.h"
+#include "../thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+	const char* const SIZES_OPTION = "--sizes=";
+	const char* const THREADS_OPTION = "--threads=";
+	const char* const ROUNDS_OPTION = "--rounds=";
+
+	// Number of outgoing edges of every vertex, besides ring keeping graph connected
+	constexpr std::size_t EDGES_PER_VERTEX = 8;
+
+	// Maximal relative difference of rates of original and tiled kernels
+	constexpr double MAX_RATE_DIFFERENCE = 1e-9;
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Command line settings
+	struct Settings {
+		// Numbers of graph vertices
+		std::vector<std::size_t> sizes = { 256, 1024, 2048 };
+
+		// Number of threads of threaded run
+		std::size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+		// Number of runs per kernel, the fastest one is reported
+		std::size_t roundCount = 1;
+	};
+
+	// Edge of generated graph
+	struct Edge {
+		std::size_t source;
+		std::size_t destination;
+		double rate;
+	};
+
+	// Returns value of command line argument if it starts with given option prefix,
+	// otherwise returns nullptr.
+	const char* getOptionValue(const char* arg, const char* option)
+	{
+		const auto length = std::strlen(option);
+		return std::strncmp(arg, option, length) == 0 ? arg + length : nullptr;
+	}
+
+	// Parses positive integer option value. Returns false if value is invalid.
+	bool parseCount(const char* value, std::size_t& count)
+	{
+		char* end = nullptr;
+		count = std::strtoul(value, &end, 10);
+		return *value && !*end && count > 0;
+	}
+
+	// Parses comma-separated list of graph sizes. Returns false if it is invalid.
+	bool parseSizes(const char* value, std::vector<std::size_t>& sizes)
+	{
+		sizes.clear();
+		for (;;) {
+			char* end = nullptr;
+			const auto size = std::strtoul(value, &end, 10);
+			if (end == value || size < 2) {
+				return false;
+			}
+			sizes.push_back(size);
+			if (!*end) {
+				return true;
+			}
+			if (*end != ',') {
+				return false;
+			}
+			value = end + 1;
+		}
+	}
+
+	// Parse options from command line. Returns false on invalid option.
+	bool parseCommandLine(int argc, char** argv, Settings& settings)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const char* arg = argv[i];
+			bool valid = false;
+			if (const char* value = getOptionValue(arg, SIZES_OPTION)) {
+				valid = parseSizes(value, settings.sizes);
+			} else if (const char* value = getOptionValue(arg, THREADS_OPTION)) {
+				valid = parseCount(value, settings.threadCount);
+			} else if (const char* value = getOptionValue(arg, ROUNDS_OPTION)) {
+				valid = parseCount(value, settings.roundCount);
+			}
+			if (!valid) {
+				std::cerr << "Error: Invalid command line argument " << arg << std::endl;
+				std::cerr << "Usage: floyd_warsall_benchmark [--sizes=N,N,...] [--threads=N]"
+					" [--rounds=N]" << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Generates graph of n vertices like exchange graph without arbitrage:
+	// rates are ratios of random vertex prices less spread. Ring of edges
+	// keeps every vertex reachable from every other one.
+	std::vector<Edge> generateGraph(std::size_t n)
+	{
+		std::mt19937 random(static_cast<unsigned>(n));
+		std::uniform_real_distribution<double> price(0.01, 100.0);
+		std::uniform_real_distribution<double> spread(0.99, 0.999);
+		std::uniform_int_distribution<std::size_t> vertex(0, n - 1);
+		std::vector<double> prices(n);
+		for (auto& value : prices) {
+			value = price(random);
+		}
+		std::vector<Edge> edges;
+		for (std::size_t i = 0; i < n; ++i) {
+			edges.push_back(Edge{i, (i + 1) % n, prices[i] / prices[(i + 1) % n] * spread(random)});
+			for (std::size_t e = 0; e < EDGES_PER_VERTEX; ++e) {
+				const auto j = vertex(random);
+				if (j != i) {
+					edges.push_back(Edge{i, j, prices[i] / prices[j] * spread(random)});
+				}
+			}
+		}
+		return edges;
+	}
+
+	// Original kernel, before tables became flat tiled matrices:
+	// rows are separate vectors and every cell update is a branch
+	void computeBestRatesOriginal(std::vector<std::vector<double>>& rate,
+		std::vector<std::vector<std::size_t>>& next)
+	{
+		const auto n = rate.size();
+		for (std::size_t k = 0; k < n; ++k) {
+			auto& rateKRow = rate[k];
+			for (std::size_t i = 0; i < n; ++i) {
+				auto& rateRow = rate[i];
+				auto& nextRow = next[i];
+				for (std::size_t j = 0; j < n; ++j) {
+					auto& r = rateRow[j];
+					const auto newR = rateRow[k] * rateKRow[j];
+					if (r < newR) {
+						r = newR;
+						nextRow[j] = nextRow[k];
+					}
+				}
+			}
+		}
+	}
+
+	// Tables of tiled kernel
+	struct Tables {
+		FlatMatrix<double> rate;
+		FlatMatrix<NextVertex> next;
+		FlatMatrix<HopCount> hops;
+	};
+
+	// Fills tables with edges as computeBestRates() expects them
+	void initializeTables(std::size_t n, const std::vector<Edge>& edges, Tables& tables)
+	{
+		tables.rate.assign(n, 0.0);
+		tables.next.assign(n, NO_NEXT_VERTEX);
+		tables.hops.assign(n, 0);
+		for (const auto& edge : edges) {
+			tables.rate(edge.source, edge.destination) = edge.rate;
+			tables.next(edge.source, edge.destination) = static_cast<NextVertex>(edge.destination);
+			tables.hops(edge.source, edge.destination) = 1;
+		}
+	}
+
+	// Returns true if cells of both tables are identical
+	bool sameTables(const Tables& a, const Tables& b)
+	{
+		const auto n = a.rate.size();
+		for (std::size_t i = 0; i < n; ++i) {
+			if (!std::equal(a.rate.row(i), a.rate.row(i) + n, b.rate.row(i))
+				|| !std::equal(a.next.row(i), a.next.row(i) + n, b.next.row(i))
+				|| !std::equal(a.hops.row(i), a.hops.row(i) + n, b.hops.row(i))) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Returns seconds of the fastest of given number of runs of tiled kernel.
+	// Tables are reinitialized before every run.
+	double measureTiled(std::size_t n, const std::vector<Edge>& edges, std::size_t roundCount,
+		ThreadPool* threadPool, Tables& tables)
+	{
+		double best = std::numeric_limits<double>::infinity();
+		for (std::size_t round = 0; round < roundCount; ++round) {
+			initializeTables(n, edges, tables);
+			const auto start = Clock::now();
+			computeBestRates(tables.rate, tables.next, tables.hops, threadPool);
+			const std::chrono::duration<double> elapsed = Clock::now() - start;
+			best = std::min(best, elapsed.count());
+		}
+		return best;
+	}
+
+	// Prints time of kernel and its speed-up over the original one
+	void report(std::size_t n, const std::string& kernel, double seconds, double originalSeconds)
+	{
+		std::cout << std::setw(6) << n << "  " << std::left << std::setw(18) << kernel
+			<< std::right << std::fixed << std::setprecision(3) << std::setw(10) << seconds
+			<< " s" << std::setprecision(1) << std::setw(8) << originalSeconds / seconds
+			<< "x" << std::endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	if (!parseCommandLine(argc, argv, settings)) {
+		return 1;
+	}
+	const bool avx2 = useScalarFloydWarsall(false);
+	ThreadPool threadPool(settings.threadCount);
+	std::cout << "Best of " << settings.roundCount << " rounds, AVX2 "
+		<< (avx2 ? "supported" : "not supported") << ", speed-up over original kernel"
+		<< std::endl;
+
+	bool passed = true;
+	for (const auto n : settings.sizes) {
+		const auto edges = generateGraph(n);
+
+		// Original kernel
+		double originalSeconds = std::numeric_limits<double>::infinity();
+		std::vector<std::vector<double>> originalRate;
+		std::vector<std::vector<std::size_t>> originalNext;
+		for (std::size_t round = 0; round < settings.roundCount; ++round) {
+			originalRate.assign(n, std::vector<double>(n, 0.0));
+			originalNext.assign(n, std::vector<std::size_t>(n, NO_NEXT_VERTEX));
+			for (const auto& edge : edges) {
+				originalRate[edge.source][edge.destination] = edge.rate;
+				originalNext[edge.source][edge.destination] = edge.destination;
+			}
+			const auto start = Clock::now();
+			computeBestRatesOriginal(originalRate, originalNext);
+			const std::chrono::duration<double> elapsed = Clock::now() - start;
+			originalSeconds = std::min(originalSeconds, elapsed.count());
+		}
+		report(n, "original", originalSeconds, originalSeconds);
+
+		// Tiled kernels, the fastest single-threaded one runs on thread pool too
+		Tables scalar;
+		useScalarFloydWarsall(true);
+		report(n, "tiled scalar", measureTiled(n, edges, settings.roundCount, nullptr, scalar),
+			originalSeconds);
+		useScalarFloydWarsall(false);
+		Tables single;
+		if (avx2) {
+			report(n, "tiled AVX2", measureTiled(n, edges, settings.roundCount, nullptr, single),
+				originalSeconds);
+			if (!sameTables(scalar, single)) {
+				std::cerr << "Error: Scalar and AVX2 tables differ for " << n << " vertices"
+					<< std::endl;
+				passed = false;
+			}
+		}
+		Tables threaded;
+		report(n, std::string(avx2 ? "tiled AVX2, " : "tiled scalar, ")
+			+ std::to_string(settings.threadCount) + " thr",
+			measureTiled(n, edges, settings.roundCount, &threadPool, threaded), originalSeconds);
+		if (!sameTables(scalar, threaded)) {
+			std::cerr << "Error: Single-threaded and threaded tables differ for " << n
+				<< " vertices" << std::endl;
+			passed = false;
+		}
+
+		// Ties may be broken differently, but best rates are the same
+		double maxDifference = 0.0;
+		for (std::size_t i = 0; i < n; ++i) {
+			for (std::size_t j = 0; j < n; ++j) {
+				const auto expected = originalRate[i][j];
+				const auto actual = scalar.rate(i, j);
+				if (expected != actual) {
+					maxDifference = std::max(maxDifference,
+						std::fabs(expected - actual) / std::max(expected, actual));
+				}
+			}
+		}
+		if (maxDifference > MAX_RATE_DIFFERENCE) {
+			std::cerr << "Error: Rates of original and tiled kernels differ by "
+				<< maxDifference << " for " << n << " vertices" << std::endl;
+			passed = false;
+		}
+	}
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,344 @@
+// Load generator for server mode (--listen). Opens query connections which
+// pipeline rate requests taken from file, optionally replays rate info to feed
+// socket at given rate meanwhile, and reports request latency percentiles.
+// Linux only. Build: g++ -std=c++17 -O2 -pthread -o load_generator load_generator.cpp
+
+#include "../text_protocol.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+	const char* const SOCKET_OPTION = "--socket=";
+	const char* const REQUESTS_OPTION = "--requests=";
+	const char* const CONNECTIONS_OPTION = "--connections=";
+	const char* const DEPTH_OPTION = "--depth=";
+	const char* const COUNT_OPTION = "--count=";
+	const char* const FEED_SOCKET_OPTION = "--feed-socket=";
+	const char* const FEED_OPTION = "--feed=";
+	const char* const FEED_RATE_OPTION = "--feed-rate=";
+
+	// Number of bytes read from socket at once
+	constexpr std::size_t READ_CHUNK_SIZE = 64 * 1024;
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Command line settings
+	struct Settings {
+		// Query and feed socket paths
+		const char* socketPath = nullptr;
+		const char* feedSocketPath = nullptr;
+
+		// Files of rate requests and of rate info for feed
+		const char* requestFileName = nullptr;
+		const char* feedFileName = nullptr;
+
+		// Number of query connections
+		std::size_t connectionCount = 1;
+
+		// Maximal number of requests in flight per connection
+		std::size_t depth = 1;
+
+		// Total number of requests to send
+		std::size_t requestCount = 100000;
+
+		// Rate info lines sent to feed per second
+		std::size_t feedRate = 1000;
+	};
+
+	// Returns value of command line argument if it starts with given option prefix,
+	// otherwise returns nullptr.
+	const char* getOptionValue(const char* arg, const char* option)
+	{
+		const auto length = std::strlen(option);
+		return std::strncmp(arg, option, length) == 0 ? arg + length : nullptr;
+	}
+
+	// Parses positive integer option value. Returns false if value is invalid.
+	bool parseCount(const char* value, std::size_t& count)
+	{
+		char* end = nullptr;
+		count = std::strtoul(value, &end, 10);
+		return *value && !*end && count > 0;
+	}
+
+	// Parse options from command line. Returns false on invalid option.
+	bool parseCommandLine(int argc, char** argv, Settings& settings)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const char* arg = argv[i];
+			bool valid = true;
+			if (const char* value = getOptionValue(arg, SOCKET_OPTION)) {
+				settings.socketPath = value;
+			} else if (const char* value = getOptionValue(arg, REQUESTS_OPTION)) {
+				settings.requestFileName = value;
+			} else if (const char* value = getOptionValue(arg, CONNECTIONS_OPTION)) {
+				valid = parseCount(value, settings.connectionCount);
+			} else if (const char* value = getOptionValue(arg, DEPTH_OPTION)) {
+				valid = parseCount(value, settings.depth);
+			} else if (const char* value = getOptionValue(arg, COUNT_OPTION)) {
+				valid = parseCount(value, settings.requestCount);
+			} else if (const char* value = getOptionValue(arg, FEED_SOCKET_OPTION)) {
+				settings.feedSocketPath = value;
+			} else if (const char* value = getOptionValue(arg, FEED_OPTION)) {
+				settings.feedFileName = value;
+			} else if (const char* value = getOptionValue(arg, FEED_RATE_OPTION)) {
+				valid = parseCount(value, settings.feedRate);
+			} else {
+				valid = false;
+			}
+			if (!valid) {
+				std::cerr << "Error: Invalid command line argument " << arg << std::endl;
+				return false;
+			}
+		}
+		if (!settings.socketPath || !settings.requestFileName
+			|| !settings.feedSocketPath != !settings.feedFileName) {
+			std::cerr << "Usage: load_generator --socket=PATH --requests=FILE [--connections=N]"
+				" [--depth=N] [--count=N] [--feed-socket=PATH --feed=FILE [--feed-rate=N]]"
+				<< std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Reads non-empty lines of file. Throws std::runtime_error if file can't be read.
+	std::vector<std::string> readLines(const char* fileName, bool requests)
+	{
+		std::ifstream file(fileName);
+		if (!file.is_open()) {
+			throw std::runtime_error(std::string("Can't open file ") + fileName);
+		}
+		std::vector<std::string> lines;
+		std::string line;
+		while (std::getline(file, line)) {
+			// Only single-path requests are taken, every one gets single response.
+			// Feed takes the other lines.
+			const bool request = line.compare(0, EXCHANGE_RATE_REQUEST.length(),
+				EXCHANGE_RATE_REQUEST) == 0 && line.find(TOP_PATHS_OPTION) == std::string::npos;
+			const bool feedLine = line.compare(0, EXCHANGE_RATE_REQUEST.length(),
+				EXCHANGE_RATE_REQUEST) != 0 && line.compare(0,
+				EXCHANGE_RATE_BATCH_REQUEST.length(), EXCHANGE_RATE_BATCH_REQUEST) != 0;
+			if (!line.empty() && (requests ? request : feedLine)) {
+				lines.push_back(line + '\n');
+			}
+		}
+		if (lines.empty()) {
+			throw std::runtime_error(std::string("No usable lines in file ") + fileName);
+		}
+		return lines;
+	}
+
+	// Connects to Unix domain socket. Throws std::runtime_error on failure.
+	int connectTo(const char* path)
+	{
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if (std::strlen(path) >= sizeof(address.sun_path)) {
+			throw std::runtime_error(std::string("Socket path is too long: ") + path);
+		}
+		std::strcpy(address.sun_path, path);
+		const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&address),
+			sizeof(address)) != 0) {
+			const auto error = std::string(std::strerror(errno));
+			if (fd >= 0) {
+				close(fd);
+			}
+			throw std::runtime_error(std::string("Can't connect to ") + path + ": " + error);
+		}
+		return fd;
+	}
+
+	// Sends whole buffer. Throws std::runtime_error on failure.
+	void sendAll(int fd, const std::string& data)
+	{
+		for (std::size_t offset = 0; offset < data.size();) {
+			const auto count = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+			if (count < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				throw std::runtime_error(std::string("Can't send: ") + std::strerror(errno));
+			}
+			offset += count;
+		}
+	}
+
+	// Sends "count" requests over single connection keeping up to "depth" of
+	// them in flight. Latency of every request, from send to the end of its
+	// response, is appended to "latencies" in nanoseconds.
+	void runQueries(const Settings& settings, const std::vector<std::string>& requests,
+		std::size_t first, std::size_t count, std::vector<std::int64_t>& latencies)
+	{
+		const int fd = connectTo(settings.socketPath);
+		std::deque<Clock::time_point> inFlight;
+		std::string batch;
+		std::string input;
+		std::vector<char> chunk(READ_CHUNK_SIZE);
+		std::size_t sent = 0;
+		std::size_t next = first % requests.size();
+		while (latencies.size() < count) {
+			// Top up requests in flight with one write
+			batch.clear();
+			const auto now = Clock::now();
+			while (inFlight.size() < settings.depth && sent < count) {
+				batch += requests[next];
+				next = (next + 1) % requests.size();
+				inFlight.push_back(now);
+				++sent;
+			}
+			if (!batch.empty()) {
+				sendAll(fd, batch);
+			}
+
+			// Every response ends with its own line
+			const auto received = recv(fd, chunk.data(), chunk.size(), 0);
+			if (received <= 0) {
+				if (received < 0 && errno == EINTR) {
+					continue;
+				}
+				close(fd);
+				throw std::runtime_error("Connection closed by server");
+			}
+			const auto receiveTime = Clock::now();
+			input.append(chunk.data(), received);
+			std::size_t position = 0;
+			for (auto newline = input.find('\n'); newline != std::string::npos;
+				newline = input.find('\n', position)) {
+				if (std::string_view(input).substr(position, newline - position) == BEST_RATES_END
+					&& !inFlight.empty()) {
+					latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+						receiveTime - inFlight.front()).count());
+					inFlight.pop_front();
+				}
+				position = newline + 1;
+			}
+			input.erase(0, position);
+		}
+		close(fd);
+	}
+
+	// Sends feed lines at given rate until "stop" is set, file is repeated
+	void runFeed(const Settings& settings, const std::vector<std::string>& lines,
+		const std::atomic<bool>& stop, std::size_t& lineCount)
+	{
+		const int fd = connectTo(settings.feedSocketPath);
+		const auto start = Clock::now();
+		std::string batch;
+		while (!stop) {
+			// Send lines due by now, then sleep for a millisecond
+			const std::chrono::duration<double> elapsed = Clock::now() - start;
+			const auto due = static_cast<std::size_t>(elapsed.count() * settings.feedRate);
+			batch.clear();
+			for (; lineCount < due; ++lineCount) {
+				batch += lines[lineCount % lines.size()];
+			}
+			if (!batch.empty()) {
+				sendAll(fd, batch);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		close(fd);
+	}
+
+	// Returns latency at given fraction of sorted latencies in microseconds
+	double percentile(const std::vector<std::int64_t>& sorted, double fraction)
+	{
+		const auto index = std::min(sorted.size() - 1,
+			static_cast<std::size_t>(fraction * sorted.size()));
+		return sorted[index] / 1e3;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	if (!parseCommandLine(argc, argv, settings)) {
+		return 1;
+	}
+
+	try {
+		const auto requests = readLines(settings.requestFileName, true);
+		const auto feedLines = settings.feedFileName
+			? readLines(settings.feedFileName, false) : std::vector<std::string>();
+
+		// Feed runs alongside queries
+		std::atomic<bool> stopFeed(false);
+		std::size_t feedLineCount = 0;
+		std::thread feed;
+		if (settings.feedFileName) {
+			feed = std::thread([&] {
+				try {
+					runFeed(settings, feedLines, stopFeed, feedLineCount);
+				} catch (std::exception& ex) {
+					std::cerr << "Error: " << ex.what() << std::endl;
+				}
+			});
+		}
+
+		// Requests are split evenly among connections
+		const auto start = Clock::now();
+		std::vector<std::vector<std::int64_t>> latencies(settings.connectionCount);
+		std::vector<std::thread> connections;
+		std::atomic<bool> failed(false);
+		for (std::size_t i = 0; i < settings.connectionCount; ++i) {
+			const auto count = settings.requestCount / settings.connectionCount
+				+ (i < settings.requestCount % settings.connectionCount);
+			latencies[i].reserve(count);
+			connections.emplace_back([&, i, count] {
+				try {
+					runQueries(settings, requests, i * requests.size() / settings.connectionCount,
+						count, latencies[i]);
+				} catch (std::exception& ex) {
+					std::cerr << "Error: " << ex.what() << std::endl;
+					failed = true;
+				}
+			});
+		}
+		for (auto& connection : connections) {
+			connection.join();
+		}
+		const std::chrono::duration<double> elapsed = Clock::now() - start;
+		stopFeed = true;
+		if (feed.joinable()) {
+			feed.join();
+		}
+
+		std::vector<std::int64_t> all;
+		for (const auto& connectionLatencies : latencies) {
+			all.insert(all.end(), connectionLatencies.begin(), connectionLatencies.end());
+		}
+		if (all.empty()) {
+			std::cerr << "Error: No responses received" << std::endl;
+			return 1;
+		}
+		std::sort(all.begin(), all.end());
+		std::cout << "Requests: " << all.size() << " in " << elapsed.count() << " s, "
+			<< all.size() / elapsed.count() << " requests/s" << std::endl;
+		if (settings.feedFileName) {
+			std::cout << "Feed: " << feedLineCount << " lines, "
+				<< feedLineCount / elapsed.count() << " lines/s" << std::endl;
+		}
+		std::cout << "Latency (us): p50 " << percentile(all, 0.5) << ", p99 "
+			<< percentile(all, 0.99) << ", p999 " << percentile(all, 0.999)
+			<< ", max " << all.back() / 1e3 << std::endl;
+		return failed ? 2 : 0;
+	} catch (std::exception& ex) {
+		std::cerr << "Error: " << ex.what() << std::endl;
+		return 1;
+	}
+}
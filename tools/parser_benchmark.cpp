@@ -0,0 +1,322 @@
+// Micro-benchmark of price line parsing. Parses generated rate info lines with
+// ExchangeRateProcessor::parseLine() and with copy of the parser it replaced
+// (tokens copied into std::string, std::stod, timestamp through std::get_time),
+// and reports lines per second and heap allocations per line of both.
+// Processor state is not touched, so only parsing is measured. Build from
+// repository root:
+// g++ -std=c++17 -O2 -pthread -I. -o parser_benchmark
+//     tools/parser_benchmark.cpp exchange_rate_processor.cpp floyd_warsall.cpp
+//     mapped_file.cpp rate_snapshot.cpp response_writer.cpp state_file.cpp
+//     string_tokenizer.cpp symbol_table.cpp thread_pool.cpp
+// Run: parser_benchmark [--lines=N] [--rounds=N]
+
+#include "../exchange_rate_processor.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+	const char* const LINES_OPTION = "--lines=";
+	const char* const ROUNDS_OPTION = "--rounds=";
+
+	// Number of exchanges and currencies of generated lines
+	constexpr std::size_t EXCHANGE_COUNT = 20;
+	constexpr std::size_t CURRENCY_COUNT = 50;
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Number of heap allocations made by the program so far
+	std::atomic<std::size_t> allocationCount(0);
+
+	// Command line settings
+	struct Settings {
+		// Number of generated lines
+		std::size_t lineCount = 1000000;
+
+		// Number of passes over lines per parser, the fastest one is reported
+		std::size_t roundCount = 3;
+	};
+
+	// Returns value of command line argument if it starts with given option prefix,
+	// otherwise returns nullptr.
+	const char* getOptionValue(const char* arg, const char* option)
+	{
+		const auto length = std::strlen(option);
+		return std::strncmp(arg, option, length) == 0 ? arg + length : nullptr;
+	}
+
+	// Parses positive integer option value. Returns false if value is invalid.
+	bool parseCount(const char* value, std::size_t& count)
+	{
+		char* end = nullptr;
+		count = std::strtoul(value, &end, 10);
+		return *value && !*end && count > 0;
+	}
+
+	// Parse options from command line. Returns false on invalid option.
+	bool parseCommandLine(int argc, char** argv, Settings& settings)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const char* arg = argv[i];
+			bool valid = false;
+			if (const char* value = getOptionValue(arg, LINES_OPTION)) {
+				valid = parseCount(value, settings.lineCount);
+			} else if (const char* value = getOptionValue(arg, ROUNDS_OPTION)) {
+				valid = parseCount(value, settings.roundCount);
+			}
+			if (!valid) {
+				std::cerr << "Error: Invalid command line argument " << arg << std::endl;
+				std::cerr << "Usage: parser_benchmark [--lines=N] [--rounds=N]" << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Generates rate info lines, one second apart, with names and factors
+	// of realistic length
+	std::vector<std::string> generateLines(const Settings& settings)
+	{
+		std::mt19937 random(1);
+		std::uniform_int_distribution<std::size_t> exchange(0, EXCHANGE_COUNT - 1);
+		std::uniform_int_distribution<std::size_t> currency(0, CURRENCY_COUNT - 1);
+		std::uniform_real_distribution<double> factor(0.001, 1000.0);
+		std::vector<std::string> lines;
+		lines.reserve(settings.lineCount);
+		char line[256];
+		for (std::size_t i = 0; i < settings.lineCount; ++i) {
+			const auto forward = factor(random);
+			std::snprintf(line, sizeof(line),
+				"2018-01-%02uT%02u:%02u:%02u+00:00 EXCHANGE%zu CUR%zu CUR%zu %.10g %.10g",
+				static_cast<unsigned>(1 + i / 86400 % 28), static_cast<unsigned>(i / 3600 % 24),
+				static_cast<unsigned>(i / 60 % 60), static_cast<unsigned>(i % 60),
+				exchange(random), currency(random), currency(random), forward,
+				0.998 / forward);
+			lines.push_back(line);
+		}
+		return lines;
+	}
+
+	// Parser as it was before tokens became views: every token is copied
+	// into std::string, numbers are parsed by std::stod and timestamp by
+	// std::get_time into std::mktime.
+	namespace copying {
+		const std::string TOKEN_DELIMITERS = " \t\v\r\n";
+
+		// Parsed rate info
+		struct Info {
+			std::time_t timestamp = 0;
+			std::string exchange;
+			std::string sourceCurrency;
+			std::string destinationCurrency;
+			double forwardFactor = 0.0;
+			double backwardFactor = 0.0;
+		};
+
+		// Tokenizer copying every token
+		class StringTokenizer {
+		public:
+			explicit StringTokenizer(const std::string& s) :
+				m_string(s),
+				m_token(),
+				m_offset(0)
+			{
+			}
+
+			bool parseNextToken(const std::string& delimiters)
+			{
+				const auto i = m_string.find_first_not_of(delimiters, m_offset);
+				if (i == std::string::npos) {
+					m_offset = m_string.length();
+					return false;
+				}
+				const auto j = m_string.find_first_of(delimiters, i);
+				m_token = m_string.substr(i, j == std::string::npos ? std::string::npos : j - i);
+				m_offset = j == std::string::npos ? m_string.length() : j;
+				return true;
+			}
+
+			const std::string& getToken() const
+			{
+				return m_token;
+			}
+
+		private:
+			const std::string& m_string;
+			std::string m_token;
+			std::size_t m_offset;
+		};
+
+		std::string parseStringField(StringTokenizer& data, const char* fieldName)
+		{
+			if (!data.parseNextToken(TOKEN_DELIMITERS)) {
+				throw std::invalid_argument(std::string("missing ") + fieldName);
+			}
+			return data.getToken();
+		}
+
+		double parseDoubleField(StringTokenizer& data, const char* fieldName)
+		{
+			const auto s = parseStringField(data, fieldName);
+			std::size_t pos = 0;
+			const auto v = std::stod(s, &pos);
+			if (pos < s.length()) {
+				throw std::invalid_argument("invalid floating-point number");
+			}
+			return v;
+		}
+
+		std::time_t parseTimestampField(StringTokenizer& data, const char* fieldName)
+		{
+			auto timestamp = parseStringField(data, fieldName);
+			if (timestamp.length() != 25) {
+				throw std::invalid_argument("invalid length of time field");
+			}
+			const auto tzSign = timestamp[19];
+			auto timeZone = timestamp.substr(20);
+			timestamp.erase(timestamp.begin() + 19, timestamp.end());
+
+			std::tm tmbTimestamp;
+			std::memset(&tmbTimestamp, 0, sizeof(tmbTimestamp));
+			std::istringstream timestampInputStream(timestamp);
+			timestampInputStream >> std::get_time(&tmbTimestamp, "%Y-%m-%dT%H:%M:%S");
+			std::tm tmbTimeZone;
+			std::memset(&tmbTimeZone, 0, sizeof(tmbTimeZone));
+			std::istringstream timeZoneInputStream(timeZone);
+			timeZoneInputStream >> std::get_time(&tmbTimeZone, "%H:%M");
+			if (timestampInputStream.fail() || timeZoneInputStream.fail()) {
+				throw std::invalid_argument("invalid time field");
+			}
+			const auto t = std::mktime(&tmbTimestamp);
+			return t + (tzSign == '+' ? -1 : +1) * (tmbTimeZone.tm_min + 60 * tmbTimeZone.tm_hour) * 60;
+		}
+
+		Info parseInfo(const std::string& line)
+		{
+			StringTokenizer data(line);
+			Info info;
+			info.timestamp = parseTimestampField(data, "timestamp");
+			info.exchange = parseStringField(data, "exchange");
+			info.sourceCurrency = parseStringField(data, "source_currency");
+			info.destinationCurrency = parseStringField(data, "destination_currency");
+			info.forwardFactor = parseDoubleField(data, "forward_factor");
+			info.backwardFactor = parseDoubleField(data, "backward_factor");
+			return info;
+		}
+	}
+
+	// Result of one parser
+	struct Measurement {
+		double seconds = 0.0;
+		std::size_t allocations = 0;
+		double checksum = 0.0;
+	};
+
+	// Runs parser over all lines given number of times, returns the fastest
+	// pass. Checksum of parsed timestamps and factors keeps parsing from being
+	// optimized out and tells whether parsers agree.
+	template <class Parse>
+	Measurement measure(const std::vector<std::string>& lines, std::size_t roundCount, Parse parse)
+	{
+		Measurement best;
+		for (std::size_t round = 0; round < roundCount; ++round) {
+			double checksum = 0.0;
+			const auto allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+			const auto start = Clock::now();
+			for (const auto& line : lines) {
+				checksum += parse(line);
+			}
+			const std::chrono::duration<double> elapsed = Clock::now() - start;
+			if (round == 0 || elapsed.count() < best.seconds) {
+				best.seconds = elapsed.count();
+			}
+			best.allocations = allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+			best.checksum = checksum;
+		}
+		return best;
+	}
+
+	// Prints throughput of parser
+	void report(const char* name, const Measurement& measurement, std::size_t lineCount)
+	{
+		std::cout << std::left << std::setw(10) << name << std::right << std::fixed
+			<< std::setprecision(0) << std::setw(12) << lineCount / measurement.seconds
+			<< " lines/s" << std::setprecision(1) << std::setw(10)
+			<< measurement.seconds * 1e9 / lineCount << " ns/line" << std::setprecision(2)
+			<< std::setw(8) << static_cast<double>(measurement.allocations) / lineCount
+			<< " allocations/line" << std::endl;
+	}
+}
+
+// Counting allocation functions. Array forms of operator new and delete call
+// these; aligned forms, which parsers don't use, keep the library's pair.
+void* operator new(std::size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	if (!parseCommandLine(argc, argv, settings)) {
+		return 1;
+	}
+	const auto lines = generateLines(settings);
+
+	// Copying parser gives UTC only in UTC time zone, std::mktime uses local one
+#ifdef _WIN32
+	_putenv_s("TZ", "UTC");
+	_tzset();
+#else
+	setenv("TZ", "UTC", 1);
+	tzset();
+#endif
+
+	const auto before = measure(lines, settings.roundCount, [](const std::string& line) {
+		const auto info = copying::parseInfo(line);
+		return static_cast<double>(info.timestamp) + info.forwardFactor + info.backwardFactor;
+	});
+	const auto after = measure(lines, settings.roundCount, [](const std::string& line) {
+		const auto parsed = ExchangeRateProcessor::parseLine(line);
+		return static_cast<double>(parsed.timestamp) + parsed.forwardFactor
+			+ parsed.backwardFactor;
+	});
+	if (before.checksum != after.checksum) {
+		std::cerr << "Error: Parsers disagree, checksums " << before.checksum << " and "
+			<< after.checksum << std::endl;
+		return 1;
+	}
+
+	std::cout << settings.lineCount << " rate info lines, best of " << settings.roundCount
+		<< " rounds" << std::endl;
+	report("copying", before, settings.lineCount);
+	report("parseLine", after, settings.lineCount);
+	std::cout << "Speed-up: " << std::setprecision(1) << before.seconds / after.seconds
+		<< "x" << std::endl;
+	return 0;
+}
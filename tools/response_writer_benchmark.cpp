@@ -0,0 +1,201 @@
+// Benchmark of response output for replay of many requests (1M by default).
+// Answers the same requests over small graph three times, writing responses
+// to standard output:
+//   endl per line       responses written line by line with std::endl, as
+//                       printPath did before ResponseWriter (one flush per line)
+//   flush per response  ResponseWriter with --flush-per-response behaviour
+//   buffered            ResponseWriter with buffer of given size, flushed at the end
+// and reports requests per second of each to standard error. Redirect standard
+// output to file or pipe, as a consumer would read it; all three modes write
+// the same bytes. Build from repository root:
+// g++ -std=c++17 -O2 -pthread -I. -o response_writer_benchmark
+//     tools/response_writer_benchmark.cpp exchange_rate_processor.cpp floyd_warsall.cpp
+//     mapped_file.cpp rate_snapshot.cpp response_writer.cpp state_file.cpp
+//     string_tokenizer.cpp symbol_table.cpp thread_pool.cpp
+// Run: response_writer_benchmark [--requests=N] [--output-buffer=BYTES] > FILE
+
+#include "../exchange_rate_processor.h"
+#include "../text_protocol.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+	const char* const REQUESTS_OPTION = "--requests=";
+	const char* const OUTPUT_BUFFER_OPTION = "--output-buffer=";
+
+	// Number of exchanges and currencies of generated graph
+	constexpr std::size_t EXCHANGE_COUNT = 4;
+	constexpr std::size_t CURRENCY_COUNT = 5;
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Command line settings
+	struct Settings {
+		// Number of requests answered in every mode
+		std::size_t requestCount = 1000000;
+
+		// Output buffer size of buffered mode
+		std::size_t outputBufferSize = ExchangeRateProcessorOptions().outputBufferSize;
+	};
+
+	// Returns value of command line argument if it starts with given option prefix,
+	// otherwise returns nullptr.
+	const char* getOptionValue(const char* arg, const char* option)
+	{
+		const auto length = std::strlen(option);
+		return std::strncmp(arg, option, length) == 0 ? arg + length : nullptr;
+	}
+
+	// Parses positive integer option value. Returns false if value is invalid.
+	bool parseCount(const char* value, std::size_t& count)
+	{
+		char* end = nullptr;
+		count = std::strtoul(value, &end, 10);
+		return *value && !*end && count > 0;
+	}
+
+	// Parse options from command line. Returns false on invalid option.
+	bool parseCommandLine(int argc, char** argv, Settings& settings)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const char* arg = argv[i];
+			bool valid = false;
+			if (const char* value = getOptionValue(arg, REQUESTS_OPTION)) {
+				valid = parseCount(value, settings.requestCount);
+			} else if (const char* value = getOptionValue(arg, OUTPUT_BUFFER_OPTION)) {
+				valid = parseCount(value, settings.outputBufferSize);
+			}
+			if (!valid) {
+				std::cerr << "Error: Invalid command line argument " << arg << std::endl;
+				std::cerr << "Usage: response_writer_benchmark [--requests=N] [--output-buffer=BYTES]"
+					" > FILE" << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Generates rate info for every currency pair of every exchange,
+	// rates are ratios of currency prices less spread
+	std::vector<std::string> generateInfo()
+	{
+		std::mt19937 random(1);
+		std::uniform_real_distribution<double> price(0.5, 2.0);
+		std::uniform_real_distribution<double> spread(0.95, 1.0);
+		std::vector<double> prices(CURRENCY_COUNT);
+		for (auto& value : prices) {
+			value = price(random);
+		}
+		std::vector<std::string> lines;
+		char line[256];
+		for (std::size_t exchange = 0; exchange < EXCHANGE_COUNT; ++exchange) {
+			for (std::size_t source = 0; source < CURRENCY_COUNT; ++source) {
+				for (std::size_t destination = source + 1; destination < CURRENCY_COUNT; ++destination) {
+					const auto forward = prices[source] / prices[destination];
+					std::snprintf(line, sizeof(line), "2018-01-01T00:00:00+00:00 E%zu C%zu C%zu %.17g %.17g",
+						exchange, source, destination, forward * spread(random), spread(random) / forward);
+					lines.push_back(line);
+				}
+			}
+		}
+		return lines;
+	}
+
+	// Generates requests between random exchange/currency pairs
+	std::vector<std::string> generateRequests(const Settings& settings)
+	{
+		std::mt19937 random(2);
+		std::uniform_int_distribution<std::size_t> exchange(0, EXCHANGE_COUNT - 1);
+		std::uniform_int_distribution<std::size_t> currency(0, CURRENCY_COUNT - 1);
+		const auto vertex = [&] {
+			return " E" + std::to_string(exchange(random)) + " C" + std::to_string(currency(random));
+		};
+		std::vector<std::string> requests;
+		requests.reserve(settings.requestCount);
+		for (std::size_t i = 0; i < settings.requestCount; ++i) {
+			requests.push_back(std::string(EXCHANGE_RATE_REQUEST) + vertex() + vertex());
+		}
+		return requests;
+	}
+
+	// Loads rate info into processor
+	void loadInfo(ExchangeRateProcessor& processor, const std::vector<std::string>& info)
+	{
+		for (const auto& line : info) {
+			processor.processData(line);
+		}
+	}
+
+	// Prints throughput of mode
+	void report(const char* mode, double seconds, std::size_t requestCount)
+	{
+		std::cerr << std::left << std::setw(20) << mode << std::right << std::fixed
+			<< std::setprecision(3) << std::setw(8) << seconds << " s" << std::setprecision(0)
+			<< std::setw(12) << requestCount / seconds << " requests/s" << std::endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	if (!parseCommandLine(argc, argv, settings)) {
+		return 1;
+	}
+
+	// As in main.cpp, standard streams don't synchronize with C stdio
+	std::ios::sync_with_stdio(false);
+	const auto info = generateInfo();
+	const auto requests = generateRequests(settings);
+	std::cerr << settings.requestCount << " requests, output buffer "
+		<< settings.outputBufferSize << " bytes" << std::endl;
+
+	// Responses are taken from processor and written line by line with
+	// std::endl, like before ResponseWriter existed
+	{
+		ExchangeRateProcessorOptions options;
+		options.captureResponses = true;
+		ExchangeRateProcessor processor(options);
+		loadInfo(processor, info);
+		std::string output;
+		const auto start = Clock::now();
+		for (const auto& request : requests) {
+			output.clear();
+			processor.processData(request);
+			processor.takeOutput(output);
+			std::string_view rest = output;
+			for (auto newline = rest.find('\n'); newline != std::string_view::npos;
+				newline = rest.find('\n')) {
+				std::cout << rest.substr(0, newline) << std::endl;
+				rest.remove_prefix(newline + 1);
+			}
+		}
+		const std::chrono::duration<double> elapsed = Clock::now() - start;
+		report("endl per line", elapsed.count(), requests.size());
+	}
+
+	// ResponseWriter in its two modes
+	for (const bool flushPerResponse : { true, false }) {
+		ExchangeRateProcessorOptions options;
+		options.outputBufferSize = settings.outputBufferSize;
+		options.flushPerResponse = flushPerResponse;
+		ExchangeRateProcessor processor(options);
+		loadInfo(processor, info);
+		const auto start = Clock::now();
+		for (const auto& request : requests) {
+			processor.processData(request);
+		}
+		processor.flushOutput();
+		const std::chrono::duration<double> elapsed = Clock::now() - start;
+		report(flushPerResponse ? "flush per response" : "buffered", elapsed.count(),
+			requests.size());
+	}
+	return 0;
+}
@@ -0,0 +1,239 @@
+// Benchmark of per-query cost of rate requests on large graph. Loads generated
+// rate info for many exchanges and currencies (10k exchange/currency pairs by
+// default) into processor, then answers random requests of every kind: plain
+// best rate, hop-bounded (MAX_HOPS, hop-bounded Bellman-Ford), K best paths
+// (TOP, Yen's algorithm) and both options together, and reports mean, p50 and
+// p99 latency of each kind. Rates have no arbitrage. Build from repository root:
+// g++ -std=c++17 -O2 -pthread -I. -o routing_benchmark
+//     tools/routing_benchmark.cpp exchange_rate_processor.cpp floyd_warsall.cpp
+//     mapped_file.cpp rate_snapshot.cpp response_writer.cpp state_file.cpp
+//     string_tokenizer.cpp symbol_table.cpp thread_pool.cpp
+// Run: routing_benchmark [--engine=single-source|all-pairs] [--exchanges=N]
+//     [--currencies=N] [--quotes=N] [--queries=N] [--max-hops=N] [--top=N]
+// All-pairs engine keeps n^2 tables, use it with smaller graphs.
+
+#include "../exchange_rate_processor.h"
+#include "../text_protocol.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+	const char* const ENGINE_OPTION = "--engine=";
+	const char* const ENGINE_ALL_PAIRS = "all-pairs";
+	const char* const ENGINE_SINGLE_SOURCE = "single-source";
+	const char* const EXCHANGES_OPTION = "--exchanges=";
+	const char* const CURRENCIES_OPTION = "--currencies=";
+	const char* const QUOTES_OPTION = "--quotes=";
+	const char* const QUERIES_OPTION = "--queries=";
+	const char* const MAX_HOPS_VALUE_OPTION = "--max-hops=";
+	const char* const TOP_VALUE_OPTION = "--top=";
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Command line settings
+	struct Settings {
+		// Routing engine of processor
+		RoutingEngine routingEngine = RoutingEngine::SingleSource;
+
+		// Number of exchanges and currencies
+		std::size_t exchangeCount = 100;
+		std::size_t currencyCount = 100;
+
+		// Number of quoted currency pairs per exchange
+		std::size_t quoteCount = 300;
+
+		// Number of requests of every kind
+		std::size_t queryCount = 200;
+
+		// Values of MAX_HOPS and TOP options of requests
+		std::size_t maxHops = 3;
+		std::size_t topPaths = 5;
+	};
+
+	// Returns value of command line argument if it starts with given option prefix,
+	// otherwise returns nullptr.
+	const char* getOptionValue(const char* arg, const char* option)
+	{
+		const auto length = std::strlen(option);
+		return std::strncmp(arg, option, length) == 0 ? arg + length : nullptr;
+	}
+
+	// Parses positive integer option value. Returns false if value is invalid.
+	bool parseCount(const char* value, std::size_t& count)
+	{
+		char* end = nullptr;
+		count = std::strtoul(value, &end, 10);
+		return *value && !*end && count > 0;
+	}
+
+	// Parse options from command line. Returns false on invalid option.
+	bool parseCommandLine(int argc, char** argv, Settings& settings)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const char* arg = argv[i];
+			bool valid = true;
+			if (const char* value = getOptionValue(arg, ENGINE_OPTION)) {
+				if (std::strcmp(value, ENGINE_ALL_PAIRS) == 0) {
+					settings.routingEngine = RoutingEngine::AllPairs;
+				} else if (std::strcmp(value, ENGINE_SINGLE_SOURCE) == 0) {
+					settings.routingEngine = RoutingEngine::SingleSource;
+				} else {
+					valid = false;
+				}
+			} else if (const char* value = getOptionValue(arg, EXCHANGES_OPTION)) {
+				valid = parseCount(value, settings.exchangeCount);
+			} else if (const char* value = getOptionValue(arg, CURRENCIES_OPTION)) {
+				valid = parseCount(value, settings.currencyCount) && settings.currencyCount > 1;
+			} else if (const char* value = getOptionValue(arg, QUOTES_OPTION)) {
+				valid = parseCount(value, settings.quoteCount);
+			} else if (const char* value = getOptionValue(arg, QUERIES_OPTION)) {
+				valid = parseCount(value, settings.queryCount);
+			} else if (const char* value = getOptionValue(arg, MAX_HOPS_VALUE_OPTION)) {
+				valid = parseCount(value, settings.maxHops);
+			} else if (const char* value = getOptionValue(arg, TOP_VALUE_OPTION)) {
+				valid = parseCount(value, settings.topPaths) && settings.topPaths <= MAX_PATH_COUNT;
+			} else {
+				valid = false;
+			}
+			if (!valid) {
+				std::cerr << "Error: Invalid command line argument " << arg << std::endl;
+				std::cerr << "Usage: routing_benchmark [--engine=single-source|all-pairs]"
+					" [--exchanges=N] [--currencies=N] [--quotes=N] [--queries=N]"
+					" [--max-hops=N] [--top=N]" << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Generates rate info lines: every exchange quotes random currency pairs,
+	// rates are ratios of currency prices less spread, so there is no arbitrage.
+	// Exchange/currency pairs which got quotes are added to "pairs".
+	std::vector<std::string> generateInfo(const Settings& settings, std::mt19937& random,
+		std::vector<std::pair<std::size_t, std::size_t>>& pairs)
+	{
+		std::uniform_int_distribution<std::size_t> currency(0, settings.currencyCount - 1);
+		std::uniform_real_distribution<double> price(0.01, 100.0);
+		std::uniform_real_distribution<double> spread(0.99, 0.999);
+		std::vector<double> prices(settings.currencyCount);
+		for (auto& value : prices) {
+			value = price(random);
+		}
+		std::set<std::pair<std::size_t, std::size_t>> quoted;
+		std::vector<std::string> lines;
+		char line[256];
+		for (std::size_t exchange = 0; exchange < settings.exchangeCount; ++exchange) {
+			for (std::size_t i = 0; i < settings.quoteCount; ++i) {
+				const auto source = currency(random);
+				auto destination = currency(random);
+				if (destination == source) {
+					destination = (destination + 1) % settings.currencyCount;
+				}
+				const auto forward = prices[source] / prices[destination];
+				std::snprintf(line, sizeof(line), "2018-01-01T00:00:00+00:00 E%zu C%zu C%zu %.17g %.17g",
+					exchange, source, destination, forward * spread(random), spread(random) / forward);
+				lines.push_back(line);
+				quoted.emplace(exchange, source);
+				quoted.emplace(exchange, destination);
+			}
+		}
+		pairs.assign(quoted.begin(), quoted.end());
+		return lines;
+	}
+
+	// Generates requests between random exchange/currency pairs with given options
+	std::vector<std::string> generateRequests(const Settings& settings, std::mt19937& random,
+		const std::vector<std::pair<std::size_t, std::size_t>>& pairs, const std::string& options)
+	{
+		std::uniform_int_distribution<std::size_t> pair(0, pairs.size() - 1);
+		const auto name = [&pairs](std::size_t index) {
+			return " E" + std::to_string(pairs[index].first) + " C" + std::to_string(pairs[index].second);
+		};
+		std::vector<std::string> requests;
+		for (std::size_t i = 0; i < settings.queryCount; ++i) {
+			requests.push_back(std::string(EXCHANGE_RATE_REQUEST) + name(pair(random))
+				+ name(pair(random)) + options);
+		}
+		return requests;
+	}
+
+	// Answers requests one by one and prints their latency. The first request
+	// also brings best rates up to date in all-pairs mode, it is not counted.
+	void measure(ExchangeRateProcessor& processor, const char* kind,
+		const std::vector<std::string>& requests)
+	{
+		std::string output;
+		processor.processData(requests.front());
+		processor.takeOutput(output);
+		std::vector<double> latencies;
+		std::size_t responseLines = 0;
+		for (const auto& request : requests) {
+			output.clear();
+			const auto start = Clock::now();
+			processor.processData(request);
+			const std::chrono::duration<double, std::micro> elapsed = Clock::now() - start;
+			latencies.push_back(elapsed.count());
+			processor.takeOutput(output);
+			responseLines += std::count(output.begin(), output.end(), '\n');
+		}
+		double total = 0.0;
+		for (const auto latency : latencies) {
+			total += latency;
+		}
+		std::sort(latencies.begin(), latencies.end());
+		std::cout << std::left << std::setw(22) << kind << std::right << std::fixed
+			<< std::setprecision(1) << " mean " << std::setw(10) << total / latencies.size()
+			<< " us  p50 " << std::setw(10) << latencies[latencies.size() / 2]
+			<< " us  p99 " << std::setw(10) << latencies[latencies.size() * 99 / 100]
+			<< " us  " << std::setprecision(1)
+			<< static_cast<double>(responseLines) / requests.size() << " lines/response"
+			<< std::endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	if (!parseCommandLine(argc, argv, settings)) {
+		return 1;
+	}
+
+	std::mt19937 random(1);
+	std::vector<std::pair<std::size_t, std::size_t>> pairs;
+	const auto info = generateInfo(settings, random, pairs);
+
+	ExchangeRateProcessorOptions options;
+	options.routingEngine = settings.routingEngine;
+	options.captureResponses = true;
+	ExchangeRateProcessor processor(options);
+	processor.reserve(settings.exchangeCount, settings.currencyCount);
+	const auto loadStart = Clock::now();
+	for (const auto& line : info) {
+		processor.processData(line);
+	}
+	const std::chrono::duration<double> loadTime = Clock::now() - loadStart;
+	std::cout << pairs.size() << " exchange/currency pairs, " << info.size()
+		<< " quotes loaded in " << std::setprecision(3) << loadTime.count() << " s, "
+		<< settings.queryCount << " requests of every kind" << std::endl;
+
+	const auto maxHops = std::string(" ") + std::string(MAX_HOPS_OPTION)
+		+ std::to_string(settings.maxHops);
+	const auto topPaths = std::string(" ") + std::string(TOP_PATHS_OPTION)
+		+ std::to_string(settings.topPaths);
+	measure(processor, "best rate", generateRequests(settings, random, pairs, ""));
+	measure(processor, maxHops.substr(1).c_str(), generateRequests(settings, random, pairs, maxHops));
+	measure(processor, topPaths.substr(1).c_str(), generateRequests(settings, random, pairs, topPaths));
+	measure(processor, (maxHops.substr(1) + topPaths).c_str(),
+		generateRequests(settings, random, pairs, maxHops + topPaths));
+	return 0;
+}
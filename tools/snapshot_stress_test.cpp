@@ -0,0 +1,341 @@
+// Stress test of rate snapshots (RateSnapshot, SnapshotPublisher) under many
+// concurrent readers. Writer thread applies generated rate info to processor
+// and publishes snapshot every few lines, like server mode does, while reader
+// threads answer generated requests from the latest snapshot. Sampled responses
+// are then checked against single-threaded processor given the same input up to
+// the snapshot, so readers must never see torn or reclaimed state. Meant to be
+// run under ThreadSanitizer (and separately AddressSanitizer). Returns 0 if all
+// samples match. Build from repository root:
+// g++ -std=c++17 -O1 -g -fsanitize=thread -pthread -I. -o snapshot_stress_test
+//     tools/snapshot_stress_test.cpp exchange_rate_processor.cpp floyd_warsall.cpp
+//     mapped_file.cpp rate_snapshot.cpp response_writer.cpp state_file.cpp
+//     string_tokenizer.cpp symbol_table.cpp thread_pool.cpp
+
+#include "../exchange_rate_processor.h"
+#include "../rate_snapshot.h"
+#include "../response_writer.h"
+#include "../snapshot_publisher.h"
+#include "../text_protocol.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+	const char* const ENGINE_OPTION = "--engine=";
+	const char* const ENGINE_ALL_PAIRS = "all-pairs";
+	const char* const ENGINE_SINGLE_SOURCE = "single-source";
+	const char* const READERS_OPTION = "--readers=";
+	const char* const LINES_OPTION = "--lines=";
+	const char* const SNAPSHOT_LINES_OPTION = "--snapshot-lines=";
+	const char* const SEED_OPTION = "--seed=";
+
+	// Number of exchanges and currencies of generated graph
+	constexpr std::size_t EXCHANGE_COUNT = 6;
+	constexpr std::size_t CURRENCY_COUNT = 5;
+
+	// Number of generated requests readers choose from
+	constexpr std::size_t REQUEST_COUNT = 200;
+
+	// Number of requests readers answer, all together, per snapshot. Writer
+	// waits for them, so snapshots don't go by unread.
+	constexpr std::size_t REQUESTS_PER_SNAPSHOT = 8;
+
+	// Every reader keeps every n-th response for checking
+	constexpr std::size_t SAMPLE_INTERVAL = 4;
+
+	// Maximal number of mismatches printed
+	constexpr std::size_t MAX_REPORTED_MISMATCHES = 5;
+
+	// Command line settings
+	struct Settings {
+		// Routing engine of processor
+		RoutingEngine routingEngine = RoutingEngine::AllPairs;
+
+		// Number of reader threads
+		std::size_t readerCount = 4;
+
+		// Number of rate info lines applied by writer
+		std::size_t lineCount = 5000;
+
+		// Number of rate info lines between snapshots
+		std::size_t snapshotLines = 10;
+
+		// Seed of generated input
+		unsigned seed = 1;
+	};
+
+	// Response of reader kept for checking
+	struct Sample {
+		// Number of rate info lines the snapshot was created after
+		std::size_t lineCount = 0;
+
+		// Index of request and its response
+		std::size_t request = 0;
+		std::string response;
+	};
+
+	// Returns value of command line argument if it starts with given option prefix,
+	// otherwise returns nullptr.
+	const char* getOptionValue(const char* arg, const char* option)
+	{
+		const auto length = std::strlen(option);
+		return std::strncmp(arg, option, length) == 0 ? arg + length : nullptr;
+	}
+
+	// Parses positive integer option value. Returns false if value is invalid.
+	bool parseCount(const char* value, std::size_t& count)
+	{
+		char* end = nullptr;
+		count = std::strtoul(value, &end, 10);
+		return *value && !*end && count > 0;
+	}
+
+	// Parse options from command line. Returns false on invalid option.
+	bool parseCommandLine(int argc, char** argv, Settings& settings)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const char* arg = argv[i];
+			bool valid = true;
+			std::size_t seed = 0;
+			if (const char* value = getOptionValue(arg, ENGINE_OPTION)) {
+				if (std::strcmp(value, ENGINE_ALL_PAIRS) == 0) {
+					settings.routingEngine = RoutingEngine::AllPairs;
+				} else if (std::strcmp(value, ENGINE_SINGLE_SOURCE) == 0) {
+					settings.routingEngine = RoutingEngine::SingleSource;
+				} else {
+					valid = false;
+				}
+			} else if (const char* value = getOptionValue(arg, READERS_OPTION)) {
+				valid = parseCount(value, settings.readerCount);
+			} else if (const char* value = getOptionValue(arg, LINES_OPTION)) {
+				valid = parseCount(value, settings.lineCount) && settings.lineCount < 86400;
+			} else if (const char* value = getOptionValue(arg, SNAPSHOT_LINES_OPTION)) {
+				valid = parseCount(value, settings.snapshotLines);
+			} else if (const char* value = getOptionValue(arg, SEED_OPTION)) {
+				valid = parseCount(value, seed);
+				settings.seed = static_cast<unsigned>(seed);
+			} else {
+				valid = false;
+			}
+			if (!valid) {
+				std::cerr << "Error: Invalid command line argument " << arg << std::endl;
+				std::cerr << "Usage: snapshot_stress_test [--engine=all-pairs|single-source]"
+					" [--readers=N] [--lines=N] [--snapshot-lines=N] [--seed=N]" << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Generates rate info lines, one second apart, over small graph, so that
+	// quotes are replaced often and paths change between snapshots. Rates are
+	// fixed currency prices less random spread, so there is no arbitrage:
+	// paths through cycles take slow simple path search, which isn't the point here.
+	std::vector<std::string> generateInfo(const Settings& settings, std::mt19937& random)
+	{
+		std::uniform_int_distribution<std::size_t> exchange(0, EXCHANGE_COUNT - 1);
+		std::uniform_int_distribution<std::size_t> currency(0, CURRENCY_COUNT - 1);
+		std::uniform_real_distribution<double> price(0.5, 2.0);
+		std::uniform_real_distribution<double> spread(0.95, 1.0);
+		std::vector<double> prices(CURRENCY_COUNT);
+		for (auto& value : prices) {
+			value = price(random);
+		}
+		std::vector<std::string> lines;
+		char line[256];
+		for (std::size_t i = 0; i < settings.lineCount; ++i) {
+			const auto source = currency(random);
+			auto destination = currency(random);
+			if (destination == source) {
+				destination = (destination + 1) % CURRENCY_COUNT;
+			}
+			const auto forward = prices[source] / prices[destination];
+			std::snprintf(line, sizeof(line), "2018-01-01T%02u:%02u:%02u+00:00 E%zu C%zu C%zu %.17g %.17g",
+				static_cast<unsigned>(i / 3600), static_cast<unsigned>(i / 60 % 60),
+				static_cast<unsigned>(i % 60), exchange(random), source, destination,
+				forward * spread(random), spread(random) / forward);
+			lines.push_back(line);
+		}
+		return lines;
+	}
+
+	// Generates single-path requests, with and without options, and batch requests
+	std::vector<std::string> generateRequests(std::mt19937& random)
+	{
+		std::uniform_int_distribution<std::size_t> exchange(0, EXCHANGE_COUNT - 1);
+		std::uniform_int_distribution<std::size_t> currency(0, CURRENCY_COUNT - 1);
+		std::uniform_int_distribution<int> kind(0, 4);
+		std::uniform_int_distribution<int> limit(1, 4);
+		const auto vertex = [&] {
+			return " E" + std::to_string(exchange(random)) + " C" + std::to_string(currency(random));
+		};
+		std::vector<std::string> requests;
+		for (std::size_t i = 0; i < REQUEST_COUNT; ++i) {
+			std::string request;
+			switch (kind(random)) {
+			case 0:
+				request = std::string(EXCHANGE_RATE_BATCH_REQUEST) + vertex() + vertex() + vertex() + vertex();
+				break;
+			case 1:
+				request = std::string(EXCHANGE_RATE_REQUEST) + vertex() + vertex() + ' '
+					+ std::string(MAX_HOPS_OPTION) + std::to_string(limit(random));
+				break;
+			case 2:
+				request = std::string(EXCHANGE_RATE_REQUEST) + vertex() + vertex() + ' '
+					+ std::string(TOP_PATHS_OPTION) + std::to_string(limit(random));
+				break;
+			default:
+				request = std::string(EXCHANGE_RATE_REQUEST) + vertex() + vertex();
+				break;
+			}
+			requests.push_back(request);
+		}
+		return requests;
+	}
+
+	// Creates processor capturing its responses
+	ExchangeRateProcessorOptions processorOptions(const Settings& settings)
+	{
+		ExchangeRateProcessorOptions options;
+		options.routingEngine = settings.routingEngine;
+		options.captureResponses = true;
+		return options;
+	}
+
+	// Answers requests from the latest snapshot until writer is done. Every
+	// snapshot is checked to be at least as new as the previous one and to give
+	// the same response twice, sampled responses are kept for checking.
+	void runReader(SnapshotPublisher<RateSnapshot>& snapshots,
+		const std::vector<std::size_t>& snapshotLineCounts, const std::vector<std::string>& requests,
+		const std::atomic<bool>& writerDone, unsigned seed, std::vector<Sample>& samples,
+		std::atomic<std::size_t>& answered, std::atomic<std::size_t>& failures)
+	{
+		SnapshotPublisher<RateSnapshot>::Reader reader(snapshots);
+		ResponseWriter writer(nullptr, 64 * 1024, false);
+		RequestContext context(writer);
+		std::mt19937 random(seed);
+		std::uniform_int_distribution<std::size_t> choose(0, requests.size() - 1);
+		std::uint64_t lastVersion = 0;
+		std::string response;
+		std::string repeated;
+		for (std::size_t count = 0; !writerDone.load(std::memory_order_acquire); ++count) {
+			const auto snapshot = reader.acquire();
+			if (!snapshot) {
+				continue;
+			}
+			if (snapshot->version() < lastVersion) {
+				++failures;
+			}
+			lastVersion = snapshot->version();
+
+			const auto request = choose(random);
+			const std::string_view line = requests[request];
+			const auto parsed = ExchangeRateProcessor::parseLine(line);
+			response.clear();
+			snapshot->answerLine(parsed, line, context);
+			writer.take(response);
+			repeated.clear();
+			snapshot->answerLine(parsed, line, context);
+			writer.take(repeated);
+			if (repeated != response) {
+				++failures;
+			}
+			context.errors.clear();
+			reader.release();
+			answered.fetch_add(1, std::memory_order_relaxed);
+
+			if (count % SAMPLE_INTERVAL == 0) {
+				samples.push_back({ snapshotLineCounts[lastVersion], request, response });
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	if (!parseCommandLine(argc, argv, settings)) {
+		return 1;
+	}
+
+	std::mt19937 random(settings.seed);
+	const auto info = generateInfo(settings, random);
+	const auto requests = generateRequests(random);
+
+	// Number of info lines applied before every snapshot, by version. Entry is
+	// written before snapshot is published, so readers see it.
+	std::vector<std::size_t> snapshotLineCounts(settings.lineCount / settings.snapshotLines + 2, 0);
+
+	SnapshotPublisher<RateSnapshot> snapshots(settings.readerCount);
+	std::atomic<bool> writerDone(false);
+	std::atomic<std::size_t> answered(0);
+	std::atomic<std::size_t> failures(0);
+	std::vector<std::vector<Sample>> samples(settings.readerCount);
+	std::vector<std::thread> readers;
+	for (std::size_t i = 0; i < settings.readerCount; ++i) {
+		readers.emplace_back(runReader, std::ref(snapshots), std::cref(snapshotLineCounts),
+			std::cref(requests), std::cref(writerDone), settings.seed + static_cast<unsigned>(i) + 1,
+			std::ref(samples[i]), std::ref(answered), std::ref(failures));
+	}
+
+	// Writer: arbitrage reports and other output of processor are dropped
+	ExchangeRateProcessor processor(processorOptions(settings));
+	std::string output;
+	std::size_t snapshotCount = 0;
+	for (std::size_t i = 0; i < info.size(); ++i) {
+		processor.processData(info[i]);
+		if ((i + 1) % settings.snapshotLines == 0 || i + 1 == info.size()) {
+			snapshotLineCounts[++snapshotCount] = i + 1;
+			auto snapshot = processor.createSnapshot();
+			processor.takeOutput(output);
+			output.clear();
+			snapshots.publish(std::move(snapshot));
+			while (answered.load(std::memory_order_relaxed) < snapshotCount * REQUESTS_PER_SNAPSHOT) {
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			}
+		}
+	}
+	writerDone.store(true, std::memory_order_release);
+	for (auto& reader : readers) {
+		reader.join();
+	}
+
+	// Replay input once more, checking samples in order of their snapshots
+	std::vector<Sample> allSamples;
+	for (auto& readerSamples : samples) {
+		allSamples.insert(allSamples.end(), readerSamples.begin(), readerSamples.end());
+	}
+	std::stable_sort(allSamples.begin(), allSamples.end(),
+		[](const Sample& a, const Sample& b) { return a.lineCount < b.lineCount; });
+	ExchangeRateProcessor reference(processorOptions(settings));
+	std::size_t applied = 0;
+	std::size_t mismatches = 0;
+	for (const auto& sample : allSamples) {
+		for (; applied < sample.lineCount; ++applied) {
+			reference.processData(info[applied]);
+		}
+		reference.takeOutput(output);
+		output.clear();
+		reference.processData(requests[sample.request]);
+		reference.takeOutput(output);
+		if (output != sample.response && ++mismatches <= MAX_REPORTED_MISMATCHES) {
+			std::cerr << "Mismatch after " << sample.lineCount << " lines for "
+				<< requests[sample.request] << "\nsnapshot:\n" << sample.response
+				<< "reference:\n" << output;
+		}
+		output.clear();
+	}
+
+	std::cout << "Snapshots: " << snapshotCount << ", samples checked: "
+		<< allSamples.size() << ", mismatches: " << mismatches
+		<< ", unstable or out of order: " << failures.load() << std::endl;
+	return mismatches || failures.load() || allSamples.empty() ? 1 : 0;
+}
@@ -0,0 +1,281 @@
+// Equivalence test of rate info timestamp parsing. Timestamps are parsed by
+// ExchangeRateProcessor::parseLine() and by copy of the parser it replaced
+// (std::get_time into std::mktime, run with TZ=UTC as mktime uses local time
+// zone), which must give the same time for:
+//   edge cases       time zone offsets, leap days, ends of months, leap second
+//                    and limits of supported range (2000-01-01T00:00:00Z to
+//                    2136-02-07T06:28:15Z)
+//   random           random date, time and time zone offset of years 2001-2135
+// parseLine() must reject timestamps just outside supported range, malformed
+// timestamps and impossible dates, which the old parser accepted or normalized.
+// Returns 0 if all checks pass. Build from repository root:
+// g++ -std=c++17 -O2 -pthread -I. -o timestamp_parser_test
+//     tools/timestamp_parser_test.cpp exchange_rate_processor.cpp floyd_warsall.cpp
+//     mapped_file.cpp rate_snapshot.cpp response_writer.cpp state_file.cpp
+//     string_tokenizer.cpp symbol_table.cpp thread_pool.cpp
+// Run: timestamp_parser_test [--count=N] [--seed=N]
+
+#include "../exchange_rate_processor.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+	const char* const COUNT_OPTION = "--count=";
+	const char* const SEED_OPTION = "--seed=";
+
+	// Number of mismatches printed before the rest is only counted
+	constexpr std::size_t MAX_REPORTED_MISMATCHES = 10;
+
+	// Command line settings
+	struct Settings {
+		// Number of random timestamps
+		std::size_t count = 1000000;
+
+		// Seed of random timestamps
+		unsigned seed = 1;
+	};
+
+	// Returns value of command line argument if it starts with given option prefix,
+	// otherwise returns nullptr.
+	const char* getOptionValue(const char* arg, const char* option)
+	{
+		const auto length = std::strlen(option);
+		return std::strncmp(arg, option, length) == 0 ? arg + length : nullptr;
+	}
+
+	// Parses positive integer option value. Returns false if value is invalid.
+	bool parseCount(const char* value, std::size_t& count)
+	{
+		char* end = nullptr;
+		count = std::strtoul(value, &end, 10);
+		return *value && !*end && count > 0;
+	}
+
+	// Parse options from command line. Returns false on invalid option.
+	bool parseCommandLine(int argc, char** argv, Settings& settings)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const char* arg = argv[i];
+			bool valid = false;
+			if (const char* value = getOptionValue(arg, COUNT_OPTION)) {
+				valid = parseCount(value, settings.count);
+			} else if (const char* value = getOptionValue(arg, SEED_OPTION)) {
+				std::size_t seed = 0;
+				valid = parseCount(value, seed);
+				settings.seed = static_cast<unsigned>(seed);
+			}
+			if (!valid) {
+				std::cerr << "Error: Invalid command line argument " << arg << std::endl;
+				std::cerr << "Usage: timestamp_parser_test [--count=N] [--seed=N]" << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Timestamp parser as it was before arithmetic parsing: std::get_time
+	// and std::mktime, so result is UTC only if local time zone is UTC.
+	// Unlike the original, failure of time zone stream is checked.
+	// Returns false if timestamp is rejected.
+	bool parseTimestampOriginal(const std::string& value, std::time_t& result)
+	{
+		std::string timestamp(value);
+		constexpr std::size_t TIME_STRING_LENGTH = 25;
+		if (timestamp.length() != TIME_STRING_LENGTH) {
+			return false;
+		}
+		const auto tzSign = timestamp[19];
+		if (!(tzSign == '-' || tzSign == '+')) {
+			return false;
+		}
+		auto timeZone = timestamp.substr(20);
+		timestamp.erase(timestamp.begin() + 19, timestamp.end());
+
+		std::tm tmbTimestamp;
+		std::memset(&tmbTimestamp, 0, sizeof(tmbTimestamp));
+		tmbTimestamp.tm_isdst = 0;
+		std::istringstream timestampInputStream(timestamp);
+		timestampInputStream >> std::get_time(&tmbTimestamp, "%Y-%m-%dT%H:%M:%S");
+		if (timestampInputStream.fail()) {
+			return false;
+		}
+		std::tm tmbTimeZone;
+		std::memset(&tmbTimeZone, 0, sizeof(tmbTimeZone));
+		std::istringstream timeZoneInputStream(timeZone);
+		timeZoneInputStream >> std::get_time(&tmbTimeZone, "%H:%M");
+		if (timeZoneInputStream.fail()) {
+			return false;
+		}
+		const auto t = std::mktime(&tmbTimestamp);
+		const int tzOffset = (tzSign == '+' ? -1 : +1)
+			* (tmbTimeZone.tm_min + 60 * tmbTimeZone.tm_hour) * 60;
+		result = t + tzOffset;
+		return true;
+	}
+
+	// Parses timestamp of rate info line with parseLine(). Returns false
+	// if line is rejected.
+	bool parseTimestamp(const std::string& value, std::time_t& result)
+	{
+		const auto parsed = ExchangeRateProcessor::parseLine(value + " EX A B 0.5 1.5");
+		if (parsed.kind != ParsedLine::Kind::Info) {
+			return false;
+		}
+		result = parsed.timestamp;
+		return true;
+	}
+
+	// Returns number of days in given month (1..12) of given year
+	int daysInMonth(int year, int month)
+	{
+		constexpr int DAYS[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+		const bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+		return month == 2 && leap ? 29 : DAYS[month - 1];
+	}
+
+	// Returns timestamp text of given fields, offset in minutes
+	std::string formatTimestamp(int year, int month, int day, int hour, int minute, int second,
+		int offset)
+	{
+		char text[32];
+		const auto absOffset = offset < 0 ? -offset : offset;
+		std::snprintf(text, sizeof(text), "%04d-%02d-%02dT%02d:%02d:%02d%c%02d:%02d", year, month,
+			day, hour, minute, second, offset < 0 ? '-' : '+', absOffset / 60, absOffset % 60);
+		return text;
+	}
+
+	// Compares both parsers on given timestamps, which both must accept.
+	// Prints result, returns true if they agree on all.
+	bool checkSameTime(const char* name, const std::vector<std::string>& timestamps)
+	{
+		std::size_t mismatches = 0;
+		for (const auto& timestamp : timestamps) {
+			std::time_t expected = 0;
+			std::time_t actual = 0;
+			const bool expectedValid = parseTimestampOriginal(timestamp, expected);
+			const bool actualValid = parseTimestamp(timestamp, actual);
+			if (expectedValid && actualValid && expected == actual) {
+				continue;
+			}
+			if (++mismatches <= MAX_REPORTED_MISMATCHES) {
+				std::cout << "     " << timestamp << ": " << (actualValid
+					? std::to_string(actual) : std::string("rejected")) << ", expected "
+					<< (expectedValid ? std::to_string(expected) : std::string("rejected"))
+					<< std::endl;
+			}
+		}
+		std::cout << (mismatches ? "FAIL " : "ok   ") << timestamps.size() << " " << name;
+		if (mismatches) {
+			std::cout << ": " << mismatches << " mismatches";
+		}
+		std::cout << std::endl;
+		return mismatches == 0;
+	}
+
+	// Checks that parseLine() rejects all given timestamps.
+	// Prints result, returns true if it does.
+	bool checkRejected(const char* name, const std::vector<std::string>& timestamps)
+	{
+		std::size_t accepted = 0;
+		for (const auto& timestamp : timestamps) {
+			std::time_t actual = 0;
+			if (parseTimestamp(timestamp, actual)) {
+				++accepted;
+				std::cout << "     " << timestamp << ": accepted as " << actual << std::endl;
+			}
+		}
+		std::cout << (accepted ? "FAIL " : "ok   ") << timestamps.size() << " " << name;
+		if (accepted) {
+			std::cout << ": " << accepted << " accepted";
+		}
+		std::cout << std::endl;
+		return accepted == 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	if (!parseCommandLine(argc, argv, settings)) {
+		return 1;
+	}
+
+	// Original parser gives UTC only in UTC time zone
+#ifdef _WIN32
+	_putenv_s("TZ", "UTC");
+	_tzset();
+#else
+	setenv("TZ", "UTC", 1);
+	tzset();
+#endif
+
+	bool passed = true;
+	passed &= checkSameTime("time zone offsets", {
+		"2018-06-15T12:00:00+00:00", "2018-06-15T12:00:00-00:00",
+		"2018-06-15T12:00:00+05:30", "2018-06-15T12:00:00-09:30",
+		"2018-06-15T12:00:00+23:59", "2018-06-15T12:00:00-23:59",
+		"2018-01-01T00:30:00+01:00", "2018-12-31T23:30:00-01:00",
+		"2017-11-01T09:42:23+00:00", "2017-11-01T09:42:23+14:00" });
+	passed &= checkSameTime("leap days and ends of months", {
+		"2000-02-29T12:00:00+00:00", "2000-03-01T00:00:00+00:00",
+		"2004-02-29T23:59:59+00:00", "2024-02-29T00:00:00-05:00",
+		"2096-02-29T00:00:00+00:00", "2100-02-28T23:59:59+00:00",
+		"2100-03-01T00:00:00+00:00", "2132-02-29T00:00:00+00:00",
+		"2019-01-31T23:59:59+00:00", "2019-04-30T23:59:59+00:00",
+		"2019-06-30T23:59:59+00:00", "2019-09-30T23:59:59+00:00",
+		"2019-11-30T23:59:59+00:00", "2019-12-31T23:59:59+00:00",
+		"2019-12-31T23:59:59-23:59", "2016-12-31T23:59:60+00:00" });
+	passed &= checkSameTime("timestamps at limits of supported range", {
+		"2000-01-01T00:00:00+00:00", "1999-12-31T23:00:00-01:00",
+		"1999-12-31T00:01:00-23:59", "2136-02-07T06:28:15+00:00",
+		"2136-02-07T07:28:15+01:00", "2136-02-08T06:27:15+23:59" });
+
+	// Random fields, every day of month is possible
+	std::mt19937 random(settings.seed);
+	std::uniform_int_distribution<int> year(2001, 2135);
+	std::uniform_int_distribution<int> month(1, 12);
+	std::uniform_int_distribution<int> hour(0, 23);
+	std::uniform_int_distribution<int> minuteOrSecond(0, 59);
+	std::uniform_int_distribution<int> offset(-(23 * 60 + 59), 23 * 60 + 59);
+	std::vector<std::string> timestamps;
+	timestamps.reserve(settings.count);
+	for (std::size_t i = 0; i < settings.count; ++i) {
+		const auto y = year(random);
+		const auto m = month(random);
+		std::uniform_int_distribution<int> day(1, daysInMonth(y, m));
+		timestamps.push_back(formatTimestamp(y, m, day(random), hour(random),
+			minuteOrSecond(random), minuteOrSecond(random), offset(random)));
+	}
+	passed &= checkSameTime("random timestamps", timestamps);
+
+	// The original parser accepted some of these, mktime normalized impossible dates
+	passed &= checkRejected("impossible dates and times", {
+		"2001-02-29T00:00:00+00:00", "2100-02-29T00:00:00+00:00",
+		"2019-04-31T00:00:00+00:00", "2019-06-31T00:00:00+00:00",
+		"2019-13-01T00:00:00+00:00", "2019-00-10T00:00:00+00:00",
+		"2019-01-00T00:00:00+00:00", "2019-01-32T00:00:00+00:00",
+		"2019-01-01T24:00:00+00:00", "2019-01-01T23:60:00+00:00",
+		"2019-01-01T23:59:61+00:00", "2019-01-01T00:00:00+24:00",
+		"2019-01-01T00:00:00+00:60" });
+	passed &= checkRejected("malformed timestamps", {
+		"2019/01/01T00:00:00+00:00", "2019-01-01 00:00:00+00:00",
+		"2019-01-01T00-00:00+00:00", "2019-01-01T00:00:00 00:00",
+		"2019-01-01T00:00:00+0000 ", "2019-01-01T00:00:0x+00:00",
+		"2O19-01-01T00:00:00+00:00", "2019-01-01T00:00:00+0a:00",
+		"2019-01-01T00:00:00+00:00Z", "2019-01-01T00:00:00Z",
+		"19-01-01T00:00:00+00:00" });
+	passed &= checkRejected("timestamps outside supported range", {
+		"1999-12-31T23:59:59+00:00", "2000-01-01T00:59:59+01:00",
+		"2000-01-01T00:00:00+00:01", "2136-02-07T06:28:16+00:00",
+		"2136-02-07T05:28:16-01:00", "1970-01-01T00:00:00+00:00",
+		"9999-12-31T23:59:59+00:00" });
+	return passed ? 0 : 1;
+}